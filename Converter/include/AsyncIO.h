@@ -0,0 +1,48 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "unsuck/unsuck.hpp"
+
+using std::shared_ptr;
+using std::string;
+using std::vector;
+using std::function;
+
+// writes <size> bytes of <buffer> to <file> at <offset>
+struct AsyncWrite {
+	shared_ptr<PositionalFile> file = nullptr;
+	int64_t offset = 0;
+	shared_ptr<Buffer> buffer = nullptr;
+	int64_t size = 0;
+
+	// called from a thread of the backend once the data is written.
+	// receives the buffer, e.g. to hand it back to a pool for reuse.
+	function<void(shared_ptr<Buffer>)> onComplete;
+};
+
+// Issues positional writes asynchronously, with at most <queueDepth> writes in flight.
+struct AsyncIOBackend {
+
+	virtual ~AsyncIOBackend() {}
+
+	virtual string name() = 0;
+
+	// Buffers that are written over and over, e.g. the buffers of a pool.
+	// Backends may pin them once instead of for every write. Call before submitting any writes.
+	virtual void registerBuffers(const vector<shared_ptr<Buffer>>&) {}
+
+	// queues a write. Blocks while the queue is full.
+	virtual void submit(AsyncWrite write) = 0;
+
+	// blocks until all submitted writes completed
+	virtual void drain() = 0;
+
+};
+
+// <type> is "uring", "threads" or "auto".
+// "auto" uses io_uring if the kernel supports it, and a pool of threads issuing blocking writes otherwise.
+shared_ptr<AsyncIOBackend> createAsyncIOBackend(string type, int64_t queueDepth);
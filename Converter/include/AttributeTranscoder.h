@@ -0,0 +1,392 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <limits>
+#include <iostream>
+#include <unordered_map>
+
+#include "unsuck/unsuck.hpp"
+#include "Attributes.h"
+#include "Vector3.h"
+#include "LasLoader/LasRecords.h"
+
+using std::string;
+using std::vector;
+using std::unordered_map;
+
+// Converts batches of raw LAS point records into the output attribute layout.
+//
+// A TranscodePlan is compiled once for a pair of input point format and output attributes,
+// and then applied to whole batches of records. Formats 0-3 and 6-8 get kernels that are
+// instantiated for the specific format, so that the checks for optional fields vanish at
+// compile time. All other formats go through the generic instantiation.
+// Statistics aren't gathered while copying. They are computed in a separate pass over the
+// transcoded batch, one attribute at a time, see gatherAttributeStatistics().
+
+struct TranscodeCopy {
+	int sourceOffset = 0;
+	int targetOffset = 0;
+	int size = 0;
+};
+
+// an output attribute written by a plan, and where it is located within the output point
+struct TranscodeTarget {
+	int attributeIndex = 0;
+	int offset = 0;
+};
+
+struct TranscodePlan;
+
+using TranscodeKernel = void(*)(const TranscodePlan& plan, const uint8_t* records, int64_t count, uint8_t* target);
+
+struct TranscodePlan {
+
+	int format = -1;
+	int64_t sourceStride = 0;
+	int64_t targetStride = 0;
+
+	// offsets of the standard attributes in the output point. -1 if either input or output doesn't have them.
+	int intensity = -1;
+	int returnNumber = -1;
+	int numberOfReturns = -1;
+	int classification = -1;
+	int classificationFlags = -1;
+	int scanAngleRank = -1;
+	int scanAngle = -1;
+	int userData = -1;
+	int pointSourceId = -1;
+	int gpsTime = -1;
+	int rgb = -1;
+	int nir = -1;
+
+	// fields that are copied verbatim, i.e. wave packets and extra bytes
+	vector<TranscodeCopy> copies;
+
+	// all output attributes written by this plan, except for position
+	vector<TranscodeTarget> targets;
+
+	TranscodeKernel kernel = nullptr;
+
+	// converts <count> records with a distance of sourceStride bytes.
+	// positions are not handled here, see writePositions().
+	void transcode(const uint8_t* records, int64_t count, uint8_t* target) const {
+		kernel(*this, records, count, target);
+	}
+
+};
+
+template<int FORMAT>
+void transcodeRecords(const TranscodePlan& plan, const uint8_t* records, int64_t count, uint8_t* target) {
+
+	// FORMAT is -1 for the generic kernel
+	const int format = FORMAT >= 0 ? FORMAT : plan.format;
+	const bool isExtended = isExtendedLasFormat(format);
+	const LasRecordLayout layout = lasRecordLayout(format);
+
+	for (int64_t i = 0; i < count; i++) {
+		const uint8_t* record = records + i * plan.sourceStride;
+		uint8_t* point = target + i * plan.targetStride;
+
+		const auto& base = *reinterpret_cast<const LasRecord0*>(record);
+
+		if (plan.intensity >= 0) {
+			memcpy(point + plan.intensity, &base.intensity, 2);
+		}
+
+		if (!isExtended) {
+			if (plan.returnNumber >= 0) {
+				point[plan.returnNumber] = (base.returnBits >> 0) & 0b111;
+			}
+			if (plan.numberOfReturns >= 0) {
+				point[plan.numberOfReturns] = (base.returnBits >> 3) & 0b111;
+			}
+			if (plan.classification >= 0) {
+				point[plan.classification] = base.classificationBits & 0b1'1111;
+			}
+			if (plan.scanAngleRank >= 0) {
+				memcpy(point + plan.scanAngleRank, &base.scanAngleRank, 1);
+			}
+			if (plan.userData >= 0) {
+				point[plan.userData] = base.userData;
+			}
+			if (plan.pointSourceId >= 0) {
+				memcpy(point + plan.pointSourceId, &base.pointSourceID, 2);
+			}
+		} else {
+			const auto& extended = *reinterpret_cast<const LasRecord6*>(record);
+
+			if (plan.returnNumber >= 0) {
+				point[plan.returnNumber] = (extended.returnBits >> 0) & 0b1111;
+			}
+			if (plan.numberOfReturns >= 0) {
+				point[plan.numberOfReturns] = (extended.returnBits >> 4) & 0b1111;
+			}
+			if (plan.classificationFlags >= 0) {
+				point[plan.classificationFlags] = extended.flagBits & 0b1111;
+			}
+			if (plan.classification >= 0) {
+				point[plan.classification] = extended.classification;
+			}
+			if (plan.userData >= 0) {
+				point[plan.userData] = extended.userData;
+			}
+			if (plan.scanAngle >= 0) {
+				memcpy(point + plan.scanAngle, &extended.scanAngle, 2);
+			}
+			if (plan.pointSourceId >= 0) {
+				memcpy(point + plan.pointSourceId, &extended.pointSourceID, 2);
+			}
+		}
+
+		if (layout.gpsTime >= 0 && plan.gpsTime >= 0) {
+			memcpy(point + plan.gpsTime, record + layout.gpsTime, 8);
+		}
+		if (layout.rgb >= 0 && plan.rgb >= 0) {
+			memcpy(point + plan.rgb, record + layout.rgb, 6);
+		}
+		if (layout.nir >= 0 && plan.nir >= 0) {
+			memcpy(point + plan.nir, record + layout.nir, 2);
+		}
+
+		for (const auto& copy : plan.copies) {
+			memcpy(point + copy.targetOffset, record + copy.sourceOffset, copy.size);
+		}
+	}
+}
+
+// number of attributes that computeOutputAttributes() lists for the standard part of a record.
+// Return bits are split into return number and number of returns.
+inline int numStandardLasAttributes(int format) {
+	switch (format) {
+		case 0: return 8;
+		case 1: return 9;
+		case 2: return 9;
+		case 3: return 10;
+		case 4: return 14;
+		case 5: return 15;
+		case 6: return 10;
+		case 7: return 11;
+		case 8: return 12;
+		case 9: return 15;
+		case 10: return 17;
+		default: return -1;
+	}
+}
+
+inline TranscodeKernel selectTranscodeKernel(int format) {
+	switch (format) {
+		case 0: return transcodeRecords<0>;
+		case 1: return transcodeRecords<1>;
+		case 2: return transcodeRecords<2>;
+		case 3: return transcodeRecords<3>;
+		case 6: return transcodeRecords<6>;
+		case 7: return transcodeRecords<7>;
+		case 8: return transcodeRecords<8>;
+		default: return transcodeRecords<-1>;
+	}
+}
+
+inline TranscodePlan compileTranscodePlan(int format, int64_t sourceStride, Attributes& inputAttributes, Attributes& outputAttributes) {
+
+	const int numStandard = numStandardLasAttributes(format);
+
+	if (numStandard < 0) {
+		string msg = "ERROR: las format not supported: " + formatNumber(format) + "\n";
+		std::cout << msg;
+
+		exit(123);
+	}
+
+	TranscodePlan plan;
+	plan.format = format;
+	plan.sourceStride = sourceStride;
+	plan.targetStride = outputAttributes.bytes;
+	plan.kernel = selectTranscodeKernel(format);
+
+	const auto indexOf = [&outputAttributes](const string& name) {
+		for (int i = 0; i < int(outputAttributes.list.size()); i++) {
+			if (outputAttributes.list[i].name == name) {
+				return i;
+			}
+		}
+
+		return -1;
+	};
+
+	unordered_map<string, int*> standardTargets = {
+		{"intensity", &plan.intensity},
+		{"return number", &plan.returnNumber},
+		{"number of returns", &plan.numberOfReturns},
+		{"classification", &plan.classification},
+		{"classification flags", &plan.classificationFlags},
+		{"scan angle rank", &plan.scanAngleRank},
+		{"scan angle", &plan.scanAngle},
+		{"user data", &plan.userData},
+		{"point source id", &plan.pointSourceId},
+		{"gps-time", &plan.gpsTime},
+		{"rgb", &plan.rgb},
+		{"nir", &plan.nir},
+	};
+
+	// the fields of a wave packet, relative to its start
+	const int wavePacket = lasRecordLayout(format).wavePacket;
+	unordered_map<string, int> waveFields = {
+		{"wave packet descriptor index", 0},
+		{"byte offset to waveform data", 1},
+		{"waveform packet size", 9},
+		{"return point waveform location", 13},
+		{"XYZ(t)", 17},
+	};
+
+	for (int i = 0; i < numStandard; i++) {
+		const Attribute& attribute = inputAttributes.list[i];
+		const int targetOffset = outputAttributes.getOffset(attribute.name);
+
+		if (attribute.name == "position" || targetOffset < 0) {
+			continue;
+		}
+
+		if (standardTargets.find(attribute.name) != standardTargets.end()) {
+			*standardTargets[attribute.name] = targetOffset;
+		} else if (wavePacket >= 0 && waveFields.find(attribute.name) != waveFields.end()) {
+			plan.copies.push_back({ wavePacket + waveFields[attribute.name], targetOffset, attribute.size });
+		} else {
+			continue;
+		}
+
+		plan.targets.push_back({ indexOf(attribute.name), targetOffset });
+	}
+
+	// extra bytes follow the standard part of the record, in the order of their descriptors
+	int sourceOffset = lasRecordSize(format);
+	for (int i = numStandard; i < int(inputAttributes.list.size()); i++) {
+		const Attribute& attribute = inputAttributes.list[i];
+		const int targetOffset = outputAttributes.getOffset(attribute.name);
+
+		if (targetOffset >= 0) {
+			plan.copies.push_back({ sourceOffset, targetOffset, attribute.size });
+			plan.targets.push_back({ indexOf(attribute.name), targetOffset });
+		}
+
+		sourceOffset += attribute.size;
+	}
+
+	{ // merge copies of fields that are adjacent in both input and output
+		vector<TranscodeCopy> merged;
+
+		for (const auto& copy : plan.copies) {
+			const bool isAdjacent = !merged.empty()
+				&& merged.back().sourceOffset + merged.back().size == copy.sourceOffset
+				&& merged.back().targetOffset + merged.back().size == copy.targetOffset;
+
+			if (isAdjacent) {
+				merged.back().size += copy.size;
+			} else {
+				merged.push_back(copy);
+			}
+		}
+
+		plan.copies = merged;
+	}
+
+	return plan;
+}
+
+// positions are always the first attribute of the output
+inline void writePositions(const int32_t* X, const int32_t* Y, const int32_t* Z, int64_t count, uint8_t* target, int64_t targetStride) {
+	for (int64_t i = 0; i < count; i++) {
+		uint8_t* point = target + i * targetStride;
+
+		memcpy(point + 0, &X[i], 4);
+		memcpy(point + 4, &Y[i], 4);
+		memcpy(point + 8, &Z[i], 4);
+	}
+}
+
+inline void setComponent(Vector3& vector, int index, double value) {
+	if (index == 0) {
+		vector.x = value;
+	} else if (index == 1) {
+		vector.y = value;
+	} else {
+		vector.z = value;
+	}
+}
+
+inline double getComponent(const Vector3& vector, int index) {
+	return index == 0 ? vector.x : (index == 1 ? vector.y : vector.z);
+}
+
+// extends min/max by the values of an attribute with up to 3 elements of type T
+template<class T>
+void gatherMinMax(const uint8_t* data, int64_t stride, int64_t count, int numElements, Vector3& min, Vector3& max) {
+
+	for (int element = 0; element < std::min(numElements, 3); element++) {
+		const uint8_t* column = data + element * sizeof(T);
+
+		T low = std::numeric_limits<T>::max();
+		T high = std::numeric_limits<T>::lowest();
+
+		for (int64_t i = 0; i < count; i++) {
+			T value;
+			memcpy(&value, column + i * stride, sizeof(T));
+
+			low = std::min(low, value);
+			high = std::max(high, value);
+		}
+
+		if (count > 0) {
+			setComponent(min, element, std::min(getComponent(min, element), double(low)));
+			setComponent(max, element, std::max(getComponent(max, element), double(high)));
+		}
+	}
+}
+
+// updates min, max and histograms of all attributes that the plan wrote into the batch
+inline void gatherAttributeStatistics(const TranscodePlan& plan, const uint8_t* data, int64_t count, Attributes& attributes) {
+
+	for (const auto& target : plan.targets) {
+		Attribute& attribute = attributes.list[target.attributeIndex];
+		const uint8_t* column = data + target.offset;
+		const int64_t stride = plan.targetStride;
+		const int numElements = attribute.numElements;
+
+		switch (attribute.type) {
+			case AttributeType::INT8:   gatherMinMax<int8_t>(column, stride, count, numElements, attribute.min, attribute.max); break;
+			case AttributeType::INT16:  gatherMinMax<int16_t>(column, stride, count, numElements, attribute.min, attribute.max); break;
+			case AttributeType::INT32:  gatherMinMax<int32_t>(column, stride, count, numElements, attribute.min, attribute.max); break;
+			case AttributeType::INT64:  gatherMinMax<int64_t>(column, stride, count, numElements, attribute.min, attribute.max); break;
+			case AttributeType::UINT8:  gatherMinMax<uint8_t>(column, stride, count, numElements, attribute.min, attribute.max); break;
+			case AttributeType::UINT16: gatherMinMax<uint16_t>(column, stride, count, numElements, attribute.min, attribute.max); break;
+			case AttributeType::UINT32: gatherMinMax<uint32_t>(column, stride, count, numElements, attribute.min, attribute.max); break;
+			case AttributeType::UINT64: gatherMinMax<uint64_t>(column, stride, count, numElements, attribute.min, attribute.max); break;
+			case AttributeType::FLOAT:  gatherMinMax<float>(column, stride, count, numElements, attribute.min, attribute.max); break;
+			case AttributeType::DOUBLE: gatherMinMax<double>(column, stride, count, numElements, attribute.min, attribute.max); break;
+			default: break;
+		}
+
+		if (attribute.name == "classification") {
+			for (int64_t i = 0; i < count; i++) {
+				attribute.histogram[column[i * stride]]++;
+			}
+		}
+	}
+}
+
+// extends the bounds of the position attribute by the coordinates of raw records, in the coordinate system of the source
+inline void gatherPositionBounds(const uint8_t* records, int64_t stride, int64_t count, Vector3 scale, Vector3 offset, Attribute& position) {
+
+	Vector3 low = { Infinity, Infinity, Infinity };
+	Vector3 high = { -Infinity, -Infinity, -Infinity };
+
+	gatherMinMax<int32_t>(records, stride, count, 3, low, high);
+
+	for (int i = 0; i < 3 && count > 0; i++) {
+		const double a = getComponent(low, i) * getComponent(scale, i) + getComponent(offset, i);
+		const double b = getComponent(high, i) * getComponent(scale, i) + getComponent(offset, i);
+
+		setComponent(position.min, i, std::min({ getComponent(position.min, i), a, b }));
+		setComponent(position.max, i, std::max({ getComponent(position.max, i), a, b }));
+	}
+}
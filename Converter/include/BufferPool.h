@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <bit>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+
+#include "unsuck/unsuck.hpp"
+
+using std::shared_ptr;
+using std::make_shared;
+using std::mutex;
+using std::lock_guard;
+using std::vector;
+using std::unordered_map;
+
+// Recycles the memory of point buffers of varying sizes, e.g. the points that samplers move into a parent node.
+// Sizes are rounded up to one of 4 classes per power of two. Released memory is kept for buffers of the same class,
+// up to <maxCachedBytes> in total.
+struct BufferPool {
+
+	static constexpr int64_t minSize = 4 * 1024;
+	static constexpr int64_t maxCachedBytes = 256 * 1024 * 1024;
+
+	mutex mtx;
+	unordered_map<int64_t, vector<Buffer*>> cached;
+	int64_t cachedBytes = 0;
+
+	// never destroyed, since buffers may still be released while static destructors run
+	static BufferPool& instance() {
+		static BufferPool* pool = new BufferPool();
+
+		return *pool;
+	}
+
+	static int64_t classSize(int64_t size) {
+		if (size <= minSize) {
+			return minSize;
+		}
+
+		const int64_t step = std::bit_floor(uint64_t(size)) / 4;
+
+		return ((size + step - 1) / step) * step;
+	}
+
+	// a buffer of exactly <size> bytes. Its memory goes back to the pool once the buffer and all slices of it are gone.
+	shared_ptr<Buffer> acquire(int64_t size) {
+		const int64_t capacity = classSize(size);
+
+		Buffer* block = nullptr;
+		{
+			lock_guard<mutex> lock(mtx);
+
+			auto& list = cached[capacity];
+
+			if (!list.empty()) {
+				block = list.back();
+				list.pop_back();
+
+				cachedBytes -= capacity;
+			}
+		}
+
+		if (block == nullptr) {
+			block = new Buffer(capacity);
+		}
+
+		shared_ptr<Buffer> owner(block, [this](Buffer* block) {
+			release(block);
+		});
+
+		return make_shared<Buffer>(owner, 0, size);
+	}
+
+private:
+
+	void release(Buffer* block) {
+		{
+			lock_guard<mutex> lock(mtx);
+
+			if (cachedBytes + block->size <= maxCachedBytes) {
+				cached[block->size].push_back(block);
+				cachedBytes += block->size;
+
+				return;
+			}
+		}
+
+		delete block;
+	}
+
+};
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+#include "unsuck/unsuck.hpp"
+
+using std::shared_ptr;
+using std::unique_ptr;
+using std::string;
+using std::vector;
+using std::mutex;
+using std::lock_guard;
+using std::atomic_int64_t;
+
+// name of the arena file, inside the chunks directory
+inline const string arenaFilename = "chunks.arena";
+
+// byte range of a chunk within the arena file
+struct ChunkExtent {
+	int64_t offset = 0;
+	int64_t size = 0;
+};
+
+// A single file that holds the points of all chunks.
+// Every chunk gets a contiguous region, sized after the number of points that the counting pass found in it.
+// Writers reserve space in that region through an atomic cursor, and write to the reserved offset.
+// Points beyond the reserved capacity, which only happens if counts were estimated,
+// are appended to the end of the file as additional extents of the chunk.
+struct ChunkArena {
+
+	shared_ptr<PositionalFile> file = nullptr;
+
+	vector<int64_t> begins;
+	vector<int64_t> capacities;
+	unique_ptr<atomic_int64_t[]> cursors;
+
+	// end of the reserved regions and of all overflow extents
+	atomic_int64_t end = 0;
+
+	mutex mtx_overflow;
+	vector<vector<ChunkExtent>> overflow;
+
+	ChunkArena(string path, const vector<int64_t>& capacities) {
+
+		file = make_shared<PositionalFile>(path, true);
+
+		if (!file->isOpen()) {
+			cout << "ERROR: failed to create chunk arena " << path << endl;
+			exit(123);
+		}
+
+		this->capacities = capacities;
+		this->cursors.reset(new atomic_int64_t[capacities.size()]);
+		this->overflow.resize(capacities.size());
+
+		int64_t offset = 0;
+		for (int64_t i = 0; i < capacities.size(); i++) {
+			begins.push_back(offset);
+			cursors[i] = 0;
+
+			offset += capacities[i];
+		}
+
+		end = offset;
+
+		file->reserve(offset);
+	}
+
+	// Reserves <size> bytes for the chunk. Returns a single extent,
+	// or two if the reservation crosses the end of the chunk's region.
+	vector<ChunkExtent> reserve(int64_t chunkIndex, int64_t size) {
+
+		const int64_t capacity = capacities[chunkIndex];
+		const int64_t cursor = cursors[chunkIndex].fetch_add(size);
+
+		if (cursor + size <= capacity) {
+			return { { begins[chunkIndex] + cursor, size } };
+		}
+
+		vector<ChunkExtent> extents;
+
+		const int64_t fitting = std::max(capacity - cursor, int64_t(0));
+		if (fitting > 0) {
+			extents.push_back({ begins[chunkIndex] + cursor, fitting });
+		}
+
+		const int64_t remaining = size - fitting;
+		const ChunkExtent extent = { end.fetch_add(remaining), remaining };
+		extents.push_back(extent);
+
+		lock_guard<mutex> lock(mtx_overflow);
+		overflow[chunkIndex].push_back(extent);
+
+		return extents;
+	}
+
+	// all ranges that hold points of the chunk
+	vector<ChunkExtent> extentsOf(int64_t chunkIndex) {
+
+		vector<ChunkExtent> extents;
+
+		const int64_t used = std::min(int64_t(cursors[chunkIndex]), capacities[chunkIndex]);
+		if (used > 0) {
+			extents.push_back({ begins[chunkIndex], used });
+		}
+
+		lock_guard<mutex> lock(mtx_overflow);
+		extents.insert(extents.end(), overflow[chunkIndex].begin(), overflow[chunkIndex].end());
+
+		return extents;
+	}
+
+};
+
+// Keeps the points of all chunks in memory, for inputs that fit the memory budget.
+// The chunker adds buckets, i.e. slices of its sorted batches, and the indexer takes them per chunk.
+// This skips writing the arena file and reading it back.
+struct ChunkMemory {
+
+	mutex mtx;
+	vector<vector<shared_ptr<Buffer>>> buckets;
+	vector<int64_t> sizes;
+
+	ChunkMemory(int64_t numChunks) {
+		buckets.resize(numChunks);
+		sizes.resize(numChunks, 0);
+	}
+
+	void add(int64_t chunkIndex, shared_ptr<Buffer> bucket) {
+		lock_guard<mutex> lock(mtx);
+
+		buckets[chunkIndex].push_back(bucket);
+		sizes[chunkIndex] += bucket->size;
+	}
+
+	int64_t sizeOf(int64_t chunkIndex) {
+		lock_guard<mutex> lock(mtx);
+
+		return sizes[chunkIndex];
+	}
+
+	// removes the buckets of the chunk from the store
+	vector<shared_ptr<Buffer>> take(int64_t chunkIndex) {
+		lock_guard<mutex> lock(mtx);
+
+		vector<shared_ptr<Buffer>> taken = std::move(buckets[chunkIndex]);
+		buckets[chunkIndex].clear();
+		sizes[chunkIndex] = 0;
+
+		return taken;
+	}
+
+};
+
+// set by the chunker if it kept the chunks in memory. The indexer takes the chunks from here.
+inline shared_ptr<ChunkMemory> chunkMemory = nullptr;
@@ -2,190 +2,245 @@
 
 #include <memory>
 #include <string>
-#include <unordered_map>
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <chrono>
-#include <fstream>
+#include <deque>
+#include <functional>
 
 #include "unsuck/unsuck.hpp"
 #include "converter_utils.h"
+#include "AsyncIO.h"
 
 using std::shared_ptr;
 using std::string;
-using std::unordered_map;
+using std::deque;
 using std::vector;
 using std::thread;
 using std::mutex;
 using std::lock_guard;
-using std::fstream;
-using std::ios;
+using std::unique_lock;
+using std::condition_variable;
 using std::atomic_int64_t;
+using std::function;
 
+// Writes buffers to fixed locations of files, e.g. the chunks within the ChunkArena.
+// - writes are issued through an AsyncIOBackend, if one is given. Otherwise, a pool of flush threads takes them from a queue.
+// - the number of queued bytes is bounded. write() blocks until there is room in the budget.
 struct ConcurrentWriter {
 
-	unordered_map<string, vector<shared_ptr<Buffer>>> todo;
-	unordered_map<string, int> locks;
+	// a buffer that goes to a fixed location of a file, see write(file, offset, data)
+	struct PositionalWrite {
+		shared_ptr<PositionalFile> file = nullptr;
+		int64_t offset = 0;
+		shared_ptr<Buffer> buffer = nullptr;
+		// called once the buffer is written
+		function<void()> callback = nullptr;
+	};
+
+	deque<PositionalWrite> positionalTodo;
+
+	int64_t maxBytesQueued = 0;
 	atomic_int64_t todoBytes = 0;
 	atomic_int64_t writtenBytes = 0;
 
+	// counters
+	atomic_int64_t numQueued = 0;
+	atomic_int64_t maxNumQueued = 0;
+	atomic_int64_t maxBytesQueuedObserved = 0;
+	atomic_int64_t numWrites = 0;
+	// seconds that producers spent waiting for room in the budget
+	std::atomic<double> blockedDuration = 0.0;
+
 	vector<thread> threads;
+	shared_ptr<AsyncIOBackend> io = nullptr;
 
 	mutex mtx_todo;
+	condition_variable cv_work;
+	condition_variable cv_space;
 	size_t numThreads = 1;
 
 	bool joinRequested = false;
-	mutex mtx_join;
 
 	double tStart = 0;
 
-	ConcurrentWriter(size_t numThreads, State& state) {
+	ConcurrentWriter(size_t numThreads, State& state, int64_t maxBytesQueued = 2'000 * 1024 * 1024, shared_ptr<AsyncIOBackend> io = nullptr) {
 		this->numThreads = numThreads;
+		this->maxBytesQueued = maxBytesQueued;
+		this->io = io;
 
 		this->tStart = now();
 
-		for (int64_t i = 0; i < numThreads; i++) {
-			threads.emplace_back([&]() {
-				flushThread();
-			});
-		}
-
-		using namespace std::chrono_literals;
+		state.setName("DISTRIBUTING");
 
-		threads.emplace_back([&]() {
-			while (true) {
-
-				{
-					lock_guard<mutex> lockT(mtx_todo);
-					lock_guard<mutex> lockJ(mtx_join);
-
-					const bool nothingTodo = todo.size() == 0;
-
-					if (nothingTodo && joinRequested) {
-						return;
-					}
-
-					const int64_t mbTodo = todoBytes / (1024 * 1024);
-					const int64_t mbDone = writtenBytes / (1024 * 1024);
+		// the backend handles positional writes on its own
+		if (io == nullptr) {
+			startThreads();
+		}
 
-					const double duration = now() - tStart;
-					const double throughput = mbDone / duration;
+	}
 
-					state.name = "DISTRIBUTING";
-				}
+	~ConcurrentWriter() {
+		this->join();
+	}
 
-				std::this_thread::sleep_for(100ms);
-			}
-		});
+	void startThreads() {
+		for (size_t i = 0; i < numThreads; i++) {
+			threads.emplace_back([&]() {
+				flushThread();
+			});
+		}
+	}
 
+	// number of buffers waiting to be written
+	int64_t queueDepth() {
+		return numQueued;
 	}
 
-	~ConcurrentWriter() {
-		this->join();
+	// megabytes written per second since the writer was created
+	double throughput() {
+		const double duration = now() - tStart;
+
+		return duration > 0.0 ? (double(writtenBytes) / (1024.0 * 1024.0)) / duration : 0.0;
 	}
 
 	void waitUntilMemoryBelow(int64_t maxMegabytesOutstanding) {
 
-		using namespace std::chrono_literals;
+		unique_lock<mutex> lock(mtx_todo);
 
-		while (todoBytes / (1024 * 1024) > maxMegabytesOutstanding) {
-			std::this_thread::sleep_for(10ms);
+		if (todoBytes / (1024 * 1024) <= maxMegabytesOutstanding) {
+			return;
 		}
 
+		const double tWait = now();
+
+		cv_space.wait(lock, [this, maxMegabytesOutstanding]() {
+			return todoBytes / (1024 * 1024) <= maxMegabytesOutstanding;
+		});
+
+		blockedDuration = blockedDuration + (now() - tWait);
 	}
 
 	void flushThread() {
 
-		using namespace std::chrono_literals;
-
 		while (true) {
 
-			string path = "";
-			vector<shared_ptr<Buffer>> work;
+			PositionalWrite positional;
 
 			{
-				lock_guard<mutex> lockT(mtx_todo);
-				lock_guard<mutex> lockJ(mtx_join);
+				unique_lock<mutex> lock(mtx_todo);
 
-				const bool nothingTodo = todo.size() == 0;
+				cv_work.wait(lock, [this]() {
+					return !positionalTodo.empty() || joinRequested;
+				});
 
-				if (nothingTodo && joinRequested) {
+				if (positionalTodo.empty()) {
+					// join requested and nothing left to do
 					return;
-				} else {
+				}
 
-					auto it = todo.begin();
+				// writes to different offsets of the same file don't need to wait for each other
+				positional = positionalTodo.front();
+				positionalTodo.pop_front();
+			}
 
-					while (it != todo.end()) {
+			positional.file->write(positional.buffer->data, positional.buffer->size, positional.offset);
 
-						string path = it->first;
+			onWritten(positional.buffer->size);
 
-						if (locks.find(path) == locks.end()) {
-							break;
-						}
+			if (positional.callback != nullptr) {
+				positional.callback();
+			}
+		}
 
-						it++;
-					}
+	}
 
+	// bookkeeping once a buffer reached the file
+	void onWritten(int64_t bytes) {
 
+		{
+			lock_guard<mutex> lock(mtx_todo);
 
+			todoBytes -= bytes;
+			writtenBytes += bytes;
+			numQueued--;
+			numWrites++;
+		}
 
-					if (it != todo.end()) {
-						path = it->first;
-						work = it->second;
+		cv_space.notify_all();
+	}
 
-						todo.erase(it);
-						locks[path] = 1;
-					}
+	// blocks the producer while the queued bytes exceed the budget. A single buffer larger
+	// than the budget is still accepted once the queue is empty.
+	void reserveBudget(unique_lock<mutex>& lock, int64_t size) {
 
-				}
-			}
+		const auto hasRoom = [this, size]() {
+			return todoBytes == 0 || todoBytes + size <= maxBytesQueued;
+		};
 
-			// if no work available, sleep and try again later
-			if (work.size() == 0) {
-				std::this_thread::sleep_for(10ms);
-				continue;
-			}
+		if (!hasRoom()) {
+			const double tWait = now();
 
-			fstream fout;
-			fout.open(path, ios::out | ios::app | ios::binary);
+			cv_space.wait(lock, hasRoom);
 
-			for (auto batch : work) {
-				fout.write(batch->data_char, batch->size);
+			blockedDuration = blockedDuration + (now() - tWait);
+		}
 
-				todoBytes -= batch->size;
-				writtenBytes += batch->size;
-			}
+		todoBytes += size;
+		numQueued++;
 
-			fout.close();
+		maxNumQueued = std::max(int64_t(maxNumQueued), int64_t(numQueued));
+		maxBytesQueuedObserved = std::max(int64_t(maxBytesQueuedObserved), int64_t(todoBytes));
+	}
 
-			{
-				lock_guard<mutex> lockT(mtx_todo);
-				lock_guard<mutex> lockJ(mtx_join);
+	// writes <data> to <file> at <offset>. Writes to different offsets of the same file may run concurrently.
+	// <callback> is invoked from a writer thread once the data is written.
+	void write(shared_ptr<PositionalFile> file, int64_t offset, shared_ptr<Buffer> data, function<void()> callback = nullptr) {
+		{
+			unique_lock<mutex> lock(mtx_todo);
 
-				auto itLocks = locks.find(path);
-				locks.erase(itLocks);
-			}
+			reserveBudget(lock, data->size);
 
+			if (io == nullptr) {
+				positionalTodo.push_back({ file, offset, data, callback });
+			}
 		}
 
-	}
-
-	void write(string path, shared_ptr<Buffer> data) {
-		lock_guard<mutex> lock(mtx_todo);
-
-		todoBytes += data->size;
+		if (io != nullptr) {
+			AsyncWrite write;
+			write.file = file;
+			write.offset = offset;
+			write.buffer = data;
+			write.size = data->size;
+			write.onComplete = [this, callback](shared_ptr<Buffer> buffer) {
+				onWritten(buffer->size);
+
+				if (callback != nullptr) {
+					callback();
+				}
+			};
 
-		todo[path].push_back(data);
+			io->submit(write);
+		} else {
+			cv_work.notify_one();
+		}
 	}
 
 	void join() {
+		if (io != nullptr) {
+			io->drain();
+		}
+
 		{
-			lock_guard<mutex> lock(mtx_join);
+			lock_guard<mutex> lock(mtx_todo);
 
 			joinRequested = true;
 		}
 
+		cv_work.notify_all();
+
 		for (auto& t : threads) {
 			t.join();
 		}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	#define POTREE_X86_KERNELS
+	#include <immintrin.h>
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+	#endif
+#endif
+
+// MSVC allows intrinsics of any instruction set in any function, gcc and clang need to be told per function
+#if defined(POTREE_X86_KERNELS) && !defined(_MSC_VER)
+	#define POTREE_TARGET_AVX2 __attribute__((target("avx2")))
+	#define POTREE_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+	#define POTREE_TARGET_AVX2
+	#define POTREE_TARGET_AVX512
+#endif
+
+using std::string;
+
+// Up to 8 points in SoA layout, so that one AVX-512 or two AVX2 instructions process all of them.
+// Unused lanes hold infinity, which is never closer than any distance.
+struct PointBlock8 {
+	alignas(64) double x[8];
+	double y[8];
+	double z[8];
+};
+
+// Returns whether any point in <blocks> is closer than sqrt(squaredDistance) to (x, y, z).
+using AnyCloserKernel = bool(*)(const PointBlock8* const* blocks, int64_t numBlocks, double x, double y, double z, double squaredDistance);
+
+inline bool anyCloser_scalar(const PointBlock8* const* blocks, int64_t numBlocks, double x, double y, double z, double squaredDistance) {
+
+	for (int64_t i = 0; i < numBlocks; i++) {
+		const PointBlock8& block = *blocks[i];
+
+		for (int64_t j = 0; j < 8; j++) {
+			const double dx = block.x[j] - x;
+			const double dy = block.y[j] - y;
+			const double dz = block.z[j] - z;
+
+			if (dx * dx + dy * dy + dz * dz < squaredDistance) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+#if defined(POTREE_X86_KERNELS)
+
+POTREE_TARGET_AVX2
+inline bool anyCloser_avx2(const PointBlock8* const* blocks, int64_t numBlocks, double x, double y, double z, double squaredDistance) {
+
+	const __m256d px = _mm256_set1_pd(x);
+	const __m256d py = _mm256_set1_pd(y);
+	const __m256d pz = _mm256_set1_pd(z);
+	const __m256d limit = _mm256_set1_pd(squaredDistance);
+
+	for (int64_t i = 0; i < numBlocks; i++) {
+		const PointBlock8& block = *blocks[i];
+
+		for (int64_t j = 0; j < 8; j += 4) {
+			const __m256d dx = _mm256_sub_pd(_mm256_load_pd(block.x + j), px);
+			const __m256d dy = _mm256_sub_pd(_mm256_load_pd(block.y + j), py);
+			const __m256d dz = _mm256_sub_pd(_mm256_load_pd(block.z + j), pz);
+
+			const __m256d dd = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+
+			if (_mm256_movemask_pd(_mm256_cmp_pd(dd, limit, _CMP_LT_OQ)) != 0) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+POTREE_TARGET_AVX512
+inline bool anyCloser_avx512(const PointBlock8* const* blocks, int64_t numBlocks, double x, double y, double z, double squaredDistance) {
+
+	const __m512d px = _mm512_set1_pd(x);
+	const __m512d py = _mm512_set1_pd(y);
+	const __m512d pz = _mm512_set1_pd(z);
+	const __m512d limit = _mm512_set1_pd(squaredDistance);
+
+	for (int64_t i = 0; i < numBlocks; i++) {
+		const PointBlock8& block = *blocks[i];
+
+		const __m512d dx = _mm512_sub_pd(_mm512_load_pd(block.x), px);
+		const __m512d dy = _mm512_sub_pd(_mm512_load_pd(block.y), py);
+		const __m512d dz = _mm512_sub_pd(_mm512_load_pd(block.z), pz);
+
+		const __m512d dd = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)), _mm512_mul_pd(dz, dz));
+
+		if (_mm512_cmp_pd_mask(dd, limit, _CMP_LT_OQ) != 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+#endif
+
+enum class SimdLevel {
+	SCALAR,
+	AVX2,
+	AVX512
+};
+
+// the widest instruction set that both the cpu and the operating system support
+inline SimdLevel detectSimdLevel() {
+
+#if defined(POTREE_X86_KERNELS) && defined(_MSC_VER)
+
+	int info[4];
+	__cpuid(info, 1);
+
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+
+	if (!osxsave) {
+		return SimdLevel::SCALAR;
+	}
+
+	// whether the os saves the ymm (0b110) and zmm (0b1110'0000) registers
+	const uint64_t xcr0 = _xgetbv(0);
+	const bool osAvx = (xcr0 & 0b110) == 0b110;
+	const bool osAvx512 = (xcr0 & 0b1110'0110) == 0b1110'0110;
+
+	__cpuidex(info, 7, 0);
+
+	const bool avx2 = (info[1] & (1 << 5)) != 0;
+	const bool avx512f = (info[1] & (1 << 16)) != 0;
+
+	if (avx512f && osAvx512) {
+		return SimdLevel::AVX512;
+	} else if (avx2 && osAvx) {
+		return SimdLevel::AVX2;
+	}
+
+	return SimdLevel::SCALAR;
+
+#elif defined(POTREE_X86_KERNELS)
+
+	// also checks whether the os supports the registers
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f")) {
+		return SimdLevel::AVX512;
+	} else if (__builtin_cpu_supports("avx2")) {
+		return SimdLevel::AVX2;
+	}
+
+	return SimdLevel::SCALAR;
+
+#else
+
+	return SimdLevel::SCALAR;
+
+#endif
+}
+
+inline string toString(SimdLevel level) {
+	if (level == SimdLevel::AVX512) {
+		return "AVX-512";
+	} else if (level == SimdLevel::AVX2) {
+		return "AVX2";
+	} else {
+		return "scalar";
+	}
+}
+
+inline AnyCloserKernel anyCloserKernel(SimdLevel level) {
+
+#if defined(POTREE_X86_KERNELS)
+	if (level == SimdLevel::AVX512) {
+		return anyCloser_avx512;
+	} else if (level == SimdLevel::AVX2) {
+		return anyCloser_avx2;
+	}
+#endif
+
+	return anyCloser_scalar;
+}
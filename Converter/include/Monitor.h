@@ -23,7 +23,8 @@ struct Monitor {
 		const auto CPU = getCpuData();
 		constexpr double GB = 1024.0 * 1024.0 * 1024.0;
 
-		const double throughput = (this->state->pointsProcessed / this->state->duration) / 1'000'000.0;
+		const double duration = this->state->duration;
+		const double throughput = (this->state->pointsProcessed / duration) / 1'000'000.0;
 
 		const double progressPass = 100.0 * this->state->progress();
 		const double progressTotal = (100.0 * (this->state->currentPass - 1) + progressPass) / this->state->numPasses;
@@ -31,7 +32,7 @@ struct Monitor {
 		const string strProgressPass = formatNumber(progressPass) + "%";
 		const string strProgressTotal = formatNumber(progressTotal) + "%";
 		const string strTime = formatNumber(now()) + "s";
-		const string strDuration = formatNumber(this->state->duration) + "s";
+		const string strDuration = formatNumber(duration) + "s";
 		const string strThroughput = formatNumber(throughput) + "MPs";
 
 		const string strRAM = formatNumber(double(ram.virtual_usedByProcess) / GB, 1)
@@ -40,7 +41,7 @@ struct Monitor {
 
 		stringstream ss;
 		ss << "[" << strProgressTotal << ", " << strTime << "], "
-			<< "[" << this->state->name << ": " << strProgressPass 
+			<< "[" << this->state->getName() << ": " << strProgressPass 
 			<< ", duration: " << strDuration 
 			<< ", throughput: " << strThroughput << "]"
 			<< "[RAM: " << strRAM << ", CPU: " << strCPU << "]" << endl;
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <bit>
+#include <functional>
+
+using std::string;
+
+// Identifies an octree node by its level and the morton code of its position at that level,
+// packed into 64 bits: a leading 1 bit, followed by the child index of each level from the root down.
+// The root is 0b1, its child 5 is 0b1'101, and so on. Keys of a lower level are always smaller,
+// and keys of the same level are ordered like their names, so sorting keys sorts nodes breadth first.
+struct NodeKey {
+
+	// 3 bits per level and the leading bit fit into 64 bits
+	static constexpr int64_t maxLevel = 21;
+
+	uint64_t value = 1;
+
+	NodeKey() {
+
+	}
+
+	explicit NodeKey(uint64_t value) {
+		this->value = value;
+	}
+
+	static NodeKey root() {
+		return NodeKey(1);
+	}
+
+	// parses a name such as "r0123"
+	static NodeKey fromString(const string& name) {
+		uint64_t value = 1;
+
+		for (size_t i = 1; i < name.size(); i++) {
+			value = (value << 3) | uint64_t(name[i] - '0');
+		}
+
+		return NodeKey(value);
+	}
+
+	int64_t level() const {
+		return (std::bit_width(value) - 1) / 3;
+	}
+
+	// morton code of the node among all nodes of its level
+	uint64_t morton() const {
+		return value ^ (uint64_t(1) << (3 * level()));
+	}
+
+	NodeKey child(int64_t index) const {
+		return NodeKey((value << 3) | uint64_t(index));
+	}
+
+	NodeKey parent() const {
+		return NodeKey(value >> 3);
+	}
+
+	// index of this node within its parent
+	int64_t childIndex() const {
+		return value & 0b111;
+	}
+
+	// the ancestor at <level>, or the node itself if that's its level
+	NodeKey ancestor(int64_t level) const {
+		return NodeKey(value >> (3 * (this->level() - level)));
+	}
+
+	// the child index at <level> along the path from the root to this node
+	int64_t childIndexAt(int64_t level) const {
+		return ancestor(level).childIndex();
+	}
+
+	// e.g. "r0123". Only needed for serialization and messages.
+	string toString() const {
+		const int64_t level = this->level();
+
+		string name(level + 1, 'r');
+
+		for (int64_t i = 1; i <= level; i++) {
+			name[i] = char('0' + childIndexAt(i));
+		}
+
+		return name;
+	}
+
+	bool operator==(const NodeKey& other) const {
+		return value == other.value;
+	}
+
+	bool operator!=(const NodeKey& other) const {
+		return value != other.value;
+	}
+
+	bool operator<(const NodeKey& other) const {
+		return value < other.value;
+	}
+
+};
+
+template<>
+struct std::hash<NodeKey> {
+	size_t operator()(const NodeKey& key) const {
+		return std::hash<uint64_t>()(key.value);
+	}
+};
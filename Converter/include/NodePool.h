@@ -0,0 +1,288 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+using std::mutex;
+using std::lock_guard;
+using std::vector;
+
+// Hands out blocks of <blockSize> bytes, carved from slabs of 64kb.
+// - each thread keeps a small cache of free blocks, so most allocations and frees don't lock.
+// - caches that grow beyond two slabs' worth of blocks, and the caches of threads that exit, go back to the slabs.
+//   Blocks freed on another thread than the one that allocated them are therefore reused by every thread.
+// - slabs whose blocks are all free are returned to the system.
+template<size_t blockSize>
+struct BlockPool {
+
+	static constexpr size_t slabSize = 64 * 1024;
+
+	struct FreeBlock {
+		FreeBlock* next;
+	};
+
+	// at the start of each slab. Slabs are aligned to their size, so a block finds its slab by masking its address.
+	struct Slab {
+		FreeBlock* freeList = nullptr;
+		size_t numFree = 0;
+
+		// slabs with free blocks
+		Slab* prev = nullptr;
+		Slab* next = nullptr;
+	};
+
+	static constexpr size_t headerSize = ((sizeof(Slab) + blockSize - 1) / blockSize) * blockSize;
+	static constexpr size_t blocksPerSlab = (slabSize - headerSize) / blockSize;
+	static constexpr size_t maxCached = 2 * blocksPerSlab;
+
+	static_assert(blockSize >= sizeof(FreeBlock));
+	static_assert(blockSize % alignof(std::max_align_t) == 0);
+	static_assert(blocksPerSlab >= 1);
+
+	struct Shared {
+		mutex mtx;
+		// slabs with at least one free block
+		Slab* partial = nullptr;
+		int64_t numSlabs = 0;
+	};
+
+	// never destroyed, so that blocks can still be freed while static destructors run
+	static Shared& shared() {
+		static Shared* shared = new Shared();
+
+		return *shared;
+	}
+
+	// trivially destructible, so that it stays usable after the thread's CacheFlusher ran
+	struct Cache {
+		FreeBlock* head = nullptr;
+		size_t count = 0;
+		// the thread is exiting, blocks go straight to the slabs
+		bool bypass = false;
+	};
+
+	inline static thread_local Cache cache;
+
+	struct CacheFlusher {
+		~CacheFlusher() {
+			lock_guard<mutex> lock(shared().mtx);
+
+			release(cache.count);
+			cache.bypass = true;
+		}
+	};
+
+	// makes sure the cache of the calling thread is handed back once the thread exits
+	static void registerCache() {
+		thread_local CacheFlusher flusher;
+		(void)flusher;
+	}
+
+	static Slab* slabOf(void* block) {
+		return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(block) & ~uintptr_t(slabSize - 1));
+	}
+
+	// Caller must hold shared().mtx
+	static void link(Slab* slab) {
+		Shared& s = shared();
+
+		slab->prev = nullptr;
+		slab->next = s.partial;
+
+		if (s.partial != nullptr) {
+			s.partial->prev = slab;
+		}
+
+		s.partial = slab;
+	}
+
+	// Caller must hold shared().mtx
+	static void unlink(Slab* slab) {
+		Shared& s = shared();
+
+		if (slab->prev != nullptr) {
+			slab->prev->next = slab->next;
+		} else {
+			s.partial = slab->next;
+		}
+
+		if (slab->next != nullptr) {
+			slab->next->prev = slab->prev;
+		}
+
+		slab->prev = nullptr;
+		slab->next = nullptr;
+	}
+
+	// Caller must hold shared().mtx
+	static Slab* createSlab() {
+		uint8_t* memory = reinterpret_cast<uint8_t*>(::operator new(slabSize, std::align_val_t(slabSize)));
+
+		Slab* slab = new (memory) Slab();
+
+		for (size_t i = 0; i < blocksPerSlab; i++) {
+			FreeBlock* block = reinterpret_cast<FreeBlock*>(memory + headerSize + i * blockSize);
+			block->next = slab->freeList;
+			slab->freeList = block;
+		}
+
+		slab->numFree = blocksPerSlab;
+		shared().numSlabs++;
+
+		link(slab);
+
+		return slab;
+	}
+
+	// Caller must hold shared().mtx
+	static FreeBlock* takeFromSlabs() {
+		Shared& s = shared();
+
+		Slab* slab = s.partial != nullptr ? s.partial : createSlab();
+
+		FreeBlock* block = slab->freeList;
+		slab->freeList = block->next;
+		slab->numFree--;
+
+		if (slab->numFree == 0) {
+			unlink(slab);
+		}
+
+		return block;
+	}
+
+	// Caller must hold shared().mtx
+	static void returnToSlab(FreeBlock* block) {
+		Slab* slab = slabOf(block);
+
+		block->next = slab->freeList;
+		slab->freeList = block;
+		slab->numFree++;
+
+		if (slab->numFree == 1) {
+			link(slab);
+		}
+
+		if (slab->numFree == blocksPerSlab) {
+			unlink(slab);
+
+			slab->~Slab();
+			::operator delete(reinterpret_cast<void*>(slab), std::align_val_t(slabSize));
+			shared().numSlabs--;
+		}
+	}
+
+	// moves <count> blocks from the cache of the calling thread back to their slabs. Caller must hold shared().mtx
+	static void release(size_t count) {
+		for (size_t i = 0; i < count && cache.head != nullptr; i++) {
+			FreeBlock* block = cache.head;
+			cache.head = block->next;
+			cache.count--;
+
+			returnToSlab(block);
+		}
+	}
+
+	static void* allocate() {
+
+		if (cache.head == nullptr) {
+			lock_guard<mutex> lock(shared().mtx);
+
+			if (cache.bypass) {
+				return takeFromSlabs();
+			}
+
+			registerCache();
+
+			for (size_t i = 0; i < blocksPerSlab; i++) {
+				FreeBlock* block = takeFromSlabs();
+				block->next = cache.head;
+				cache.head = block;
+				cache.count++;
+			}
+		}
+
+		FreeBlock* block = cache.head;
+		cache.head = block->next;
+		cache.count--;
+
+		return block;
+	}
+
+	static void deallocate(void* ptr) {
+		FreeBlock* block = reinterpret_cast<FreeBlock*>(ptr);
+
+		if (cache.bypass) {
+			lock_guard<mutex> lock(shared().mtx);
+			returnToSlab(block);
+
+			return;
+		}
+
+		if (cache.head == nullptr) {
+			registerCache();
+		}
+
+		block->next = cache.head;
+		cache.head = block;
+		cache.count++;
+
+		if (cache.count > maxCached) {
+			lock_guard<mutex> lock(shared().mtx);
+			release(blocksPerSlab);
+		}
+	}
+
+};
+
+// Allocator for std::allocate_shared that takes single objects from a BlockPool, e.g. octree nodes
+// together with their reference counts. Saves a call to malloc and free per node, and packs nodes densely.
+template<class T>
+struct PoolAllocator {
+
+	using value_type = T;
+
+	static constexpr size_t alignment = alignof(std::max_align_t);
+	static constexpr size_t blockSize = ((sizeof(T) + alignment - 1) / alignment) * alignment;
+
+	PoolAllocator() noexcept {
+
+	}
+
+	template<class U>
+	PoolAllocator(const PoolAllocator<U>&) noexcept {
+
+	}
+
+	T* allocate(size_t n) {
+		if (n == 1 && alignof(T) <= alignment) {
+			return reinterpret_cast<T*>(BlockPool<blockSize>::allocate());
+		} else {
+			return std::allocator<T>().allocate(n);
+		}
+	}
+
+	void deallocate(T* ptr, size_t n) noexcept {
+		if (n == 1 && alignof(T) <= alignment) {
+			BlockPool<blockSize>::deallocate(ptr);
+		} else {
+			std::allocator<T>().deallocate(ptr, n);
+		}
+	}
+
+	template<class U>
+	bool operator==(const PoolAllocator<U>&) const noexcept {
+		return true;
+	}
+
+	template<class U>
+	bool operator!=(const PoolAllocator<U>&) const noexcept {
+		return false;
+	}
+
+};
@@ -3,6 +3,7 @@
 #include <execution>
 
 #include "Vector3.h"
+#include "converter_utils.h"
 #include "LasLoader/LasLoader.h"
 
 struct ScaleOffset {
@@ -116,6 +117,7 @@ inline vector<Attribute> computeOutputAttributes(const LasHeader& header) {
 	Attribute XYZt("XYZ(t)", 12, 3, 4, AttributeType::FLOAT);
 	Attribute classificationFlags("classification flags", 1, 1, 1, AttributeType::UINT8);
 	Attribute scanAngle("scan angle", 2, 1, 2, AttributeType::INT16);
+	Attribute nir("nir", 2, 1, 2, AttributeType::UINT16);
 
 	vector<Attribute> list;
 
@@ -141,6 +143,18 @@ inline vector<Attribute> computeOutputAttributes(const LasHeader& header) {
 		list = { xyz, intensity, returnNumber, numberOfReturns, classificationFlags, classification, userData, scanAngle, pointSourceId, gpsTime };
 	} else if (format == 7) {
 		list = { xyz, intensity, returnNumber, numberOfReturns, classificationFlags, classification, userData, scanAngle, pointSourceId, gpsTime, rgb };
+	} else if (format == 8) {
+		list = { xyz, intensity, returnNumber, numberOfReturns, classificationFlags, classification, userData, scanAngle, pointSourceId, gpsTime, rgb, nir };
+	} else if (format == 9) {
+		list = { xyz, intensity, returnNumber, numberOfReturns, classificationFlags, classification, userData, scanAngle, pointSourceId, gpsTime,
+			wavePacketDescriptorIndex, byteOffsetToWaveformData, waveformPacketSize, returnPointWaveformLocation,
+			XYZt
+		};
+	} else if (format == 10) {
+		list = { xyz, intensity, returnNumber, numberOfReturns, classificationFlags, classification, userData, scanAngle, pointSourceId, gpsTime, rgb, nir,
+			wavePacketDescriptorIndex, byteOffsetToWaveformData, waveformPacketSize, returnPointWaveformLocation,
+			XYZt
+		};
 	} else {
 		cout << "ERROR: currently unsupported LAS format: " << int(format) << endl;
 
@@ -155,7 +169,6 @@ inline vector<Attribute> computeOutputAttributes(const LasHeader& header) {
 }
 
 inline Attributes computeOutputAttributes(const vector<Source>& sources, vector<string> requestedAttributes) {
-	// TODO: a bit wasteful to iterate over source files and load headers twice
 
 	Vector3 scaleMin = { Infinity, Infinity, Infinity };
 	Vector3 min = { Infinity, Infinity, Infinity };
@@ -167,17 +180,12 @@ inline Attributes computeOutputAttributes(const vector<Source>& sources, vector<
 
 	// compute scale and offset from all sources
 	{
-		mutex mtx;
-		constexpr auto parallel = std::execution::par;
-		for_each(parallel, sources.begin(), sources.end(), [&mtx, &scaleMin, &min, &max, &fullAttributeList, &acceptedAttributeNames](const Source &source) {
-
-			const auto header = loadLasHeader(source.path);
-
-			vector<Attribute> attributes = computeOutputAttributes(header);
+		// headers and per-file attributes were already captured by the SourceCatalog
+		for (const Source& source : sources) {
 
-			mtx.lock();
+			const auto& header = source.header;
 
-			for (auto && attribute : attributes) {
+			for (auto && attribute : source.attributes) {
 				bool alreadyAdded = acceptedAttributeNames.find(attribute.name) != acceptedAttributeNames.end();
 
 				if (!alreadyAdded) {
@@ -197,9 +205,7 @@ inline Attributes computeOutputAttributes(const vector<Source>& sources, vector<
 			max.x = std::max(max.x, header.max.x);
 			max.y = std::max(max.y, header.max.y);
 			max.z = std::max(max.z, header.max.z);
-
-			mtx.unlock();
-			});
+		}
 
 		auto scaleOffset = computeScaleOffset(min, max, scaleMin);
 		scale = scaleOffset.scale;
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+#include "Attributes.h"
+#include "Vector3.h"
+#include "ChunkArena.h"
+#include "unsuck/unsuck.hpp"
+
+using std::shared_ptr;
+using std::string;
+using std::vector;
+using std::deque;
+using std::mutex;
+using std::lock_guard;
+using std::unique_lock;
+using std::condition_variable;
+
+// a chunk that won't receive any more points
+struct SealedChunk {
+	string id;
+
+	// ranges of the chunk within the arena file <file>. Empty if the chunk was kept in memory.
+	string file;
+	vector<ChunkExtent> extents;
+
+	// points of chunks that were kept in memory
+	vector<shared_ptr<Buffer>> buckets;
+
+	int64_t size = 0;
+};
+
+// Hands chunks from the chunker to the indexer while the chunker is still distributing points,
+// so that both phases overlap. The chunker pushes chunks as soon as they are sealed, the indexer pops them.
+struct SealedChunks {
+
+	// layout of the points and cube of all chunks. Known before the first chunk is pushed.
+	Attributes attributes;
+	Vector3 min;
+	Vector3 max;
+
+	bool started = false;
+	bool closed = false;
+
+	mutex mtx;
+	condition_variable cv;
+	deque<SealedChunk> queue;
+
+	void start(const Attributes& attributes, Vector3 min, Vector3 max) {
+		{
+			lock_guard<mutex> lock(mtx);
+
+			this->attributes = attributes;
+			this->min = min;
+			this->max = max;
+			started = true;
+		}
+
+		cv.notify_all();
+	}
+
+	// blocks until the chunker started. Returns false if it closed without starting.
+	bool waitForStart() {
+		unique_lock<mutex> lock(mtx);
+
+		cv.wait(lock, [this]() { return started || closed; });
+
+		return started;
+	}
+
+	void push(SealedChunk chunk) {
+		{
+			lock_guard<mutex> lock(mtx);
+
+			queue.push_back(std::move(chunk));
+		}
+
+		cv.notify_one();
+	}
+
+	// no more chunks will be pushed. <attributes> hold the statistics of all points.
+	void close(const Attributes& attributes) {
+		{
+			lock_guard<mutex> lock(mtx);
+
+			this->attributes = attributes;
+			closed = true;
+		}
+
+		cv.notify_all();
+	}
+
+	// blocks until a chunk is available. Returns false once closed and all chunks were popped.
+	bool pop(SealedChunk& chunk) {
+		unique_lock<mutex> lock(mtx);
+
+		cv.wait(lock, [this]() { return !queue.empty() || closed; });
+
+		if (queue.empty()) {
+			return false;
+		}
+
+		chunk = std::move(queue.front());
+		queue.pop_front();
+
+		return true;
+	}
+
+};
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <execution>
+#include <filesystem>
+
+#include "nlohmann/json.hpp"
+
+#include "converter_utils.h"
+#include "LasLoader/LasLoader.h"
+#include "PotreeConverter.h"
+#include "logger.h"
+
+using json = nlohmann::json;
+
+using std::string;
+using std::vector;
+using std::unordered_map;
+using std::mutex;
+using std::lock_guard;
+
+namespace fs = std::filesystem;
+
+// Opens each input file exactly once and captures everything the converter needs to know
+// about it: header, VLRs, extra-bytes attributes and file size.
+// The result is persisted as a sidecar cache keyed on path, file size and modification time,
+// so that reruns over the same set of tiles don't have to touch the headers again.
+struct SourceCatalog {
+
+	string cachePath = "";
+	unordered_map<string, Source> cached;
+
+	int64_t numLoaded = 0;
+	int64_t numCached = 0;
+
+	SourceCatalog(string cachePath) {
+		this->cachePath = cachePath;
+
+		if (!cachePath.empty() && fs::exists(cachePath)) {
+			readCache();
+		}
+	}
+
+	static int64_t lastWriteTimeOf(const string& path) {
+		return fs::last_write_time(path).time_since_epoch().count();
+	}
+
+	static string toHex(const vector<uint8_t>& data) {
+		constexpr char digits[] = "0123456789abcdef";
+
+		string str(2 * data.size(), '0');
+		for (size_t i = 0; i < data.size(); i++) {
+			str[2 * i + 0] = digits[data[i] >> 4];
+			str[2 * i + 1] = digits[data[i] & 0x0f];
+		}
+
+		return str;
+	}
+
+	static vector<uint8_t> fromHex(const string& str) {
+		const auto value = [](char c) -> uint8_t {
+			return (c >= 'a') ? (c - 'a' + 10) : (c - '0');
+		};
+
+		vector<uint8_t> data(str.size() / 2);
+		for (size_t i = 0; i < data.size(); i++) {
+			data[i] = (value(str[2 * i]) << 4) | value(str[2 * i + 1]);
+		}
+
+		return data;
+	}
+
+	static Source createSource(const string& path, const LasHeader& header, uint64_t filesize, int64_t lastWriteTime) {
+		Source source;
+		source.path = path;
+		source.min = { header.min.x, header.min.y, header.min.z };
+		source.max = { header.max.x, header.max.y, header.max.z };
+		source.numPoints = header.numPoints;
+		source.bytesPerPoint = header.bytesPerPoint;
+		source.filesize = filesize;
+		source.lastWriteTime = lastWriteTime;
+		source.header = header;
+		source.attributes = computeOutputAttributes(header);
+
+		return source;
+	}
+
+	void readCache() {
+
+		try {
+			json js = json::parse(readTextFile(cachePath));
+
+			for (auto& jsSource : js["sources"]) {
+
+				LasHeader header;
+				header.min = { jsSource["min"][0], jsSource["min"][1], jsSource["min"][2] };
+				header.max = { jsSource["max"][0], jsSource["max"][1], jsSource["max"][2] };
+				header.scale = { jsSource["scale"][0], jsSource["scale"][1], jsSource["scale"][2] };
+				header.offset = { jsSource["offset"][0], jsSource["offset"][1], jsSource["offset"][2] };
+				header.numPoints = jsSource["numPoints"];
+				header.pointDataFormat = jsSource["pointDataFormat"];
+				header.bytesPerPoint = jsSource["bytesPerPoint"];
+				header.offsetToPointData = jsSource["offsetToPointData"];
+				header.lazChunkSize = jsSource["lazChunkSize"];
+
+				for (auto& jsVlr : jsSource["vlrs"]) {
+					VLR vlr;
+
+					const string userID = jsVlr["userID"];
+					const string description = jsVlr["description"];
+					memset(vlr.userID, 0, 16);
+					memset(vlr.description, 0, 32);
+					memcpy(vlr.userID, userID.data(), std::min(userID.size(), size_t(16)));
+					memcpy(vlr.description, description.data(), std::min(description.size(), size_t(32)));
+
+					vlr.recordID = jsVlr["recordID"];
+					vlr.data = fromHex(jsVlr["data"]);
+					vlr.recordLengthAfterHeader = vlr.data.size();
+
+					header.vlrs.push_back(vlr);
+				}
+
+				const string path = jsSource["path"];
+				const uint64_t filesize = jsSource["filesize"];
+				const int64_t lastWriteTime = jsSource["lastWriteTime"];
+
+				cached[path] = createSource(path, header, filesize, lastWriteTime);
+			}
+		} catch (const std::exception& e) {
+			logger::WARN("ignoring unreadable source cache " + cachePath + ": " + e.what());
+
+			cached.clear();
+		}
+	}
+
+	void writeCache(const vector<Source>& sources) {
+
+		if (cachePath.empty()) {
+			return;
+		}
+
+		json js;
+		js["sources"] = json::array();
+
+		for (auto& source : sources) {
+			const auto& header = source.header;
+
+			json jsSource;
+			jsSource["path"] = source.path;
+			jsSource["filesize"] = source.filesize;
+			jsSource["lastWriteTime"] = source.lastWriteTime;
+			jsSource["min"] = { header.min.x, header.min.y, header.min.z };
+			jsSource["max"] = { header.max.x, header.max.y, header.max.z };
+			jsSource["scale"] = { header.scale.x, header.scale.y, header.scale.z };
+			jsSource["offset"] = { header.offset.x, header.offset.y, header.offset.z };
+			jsSource["numPoints"] = header.numPoints;
+			jsSource["pointDataFormat"] = header.pointDataFormat;
+			jsSource["bytesPerPoint"] = header.bytesPerPoint;
+			jsSource["offsetToPointData"] = header.offsetToPointData;
+			jsSource["lazChunkSize"] = header.lazChunkSize;
+
+			jsSource["vlrs"] = json::array();
+			for (auto& vlr : header.vlrs) {
+				json jsVlr;
+				jsVlr["userID"] = string(vlr.userID, strnlen(vlr.userID, 16));
+				jsVlr["recordID"] = vlr.recordID;
+				jsVlr["description"] = string(vlr.description, strnlen(vlr.description, 32));
+				jsVlr["data"] = toHex(vlr.data);
+
+				jsSource["vlrs"].push_back(jsVlr);
+			}
+
+			js["sources"].push_back(jsSource);
+		}
+
+		fs::create_directories(fs::path(cachePath).parent_path());
+		writeFile(cachePath, js.dump(1));
+	}
+
+	// returns one source per path, in the order of <paths>. headers are only read for files that aren't in the cache,
+	// or whose size or modification time changed since they were cached.
+	vector<Source> load(const vector<string>& paths) {
+
+		vector<Source> sources(paths.size());
+
+		mutex mtx;
+		constexpr auto parallel = std::execution::par;
+		for_each(parallel, paths.begin(), paths.end(), [this, &mtx, &sources, &paths](const string& path) {
+
+			// each path fills its own slot, so the order doesn't depend on the threads
+			const size_t index = &path - paths.data();
+
+			const uint64_t filesize = fs::file_size(path);
+			const int64_t lastWriteTime = lastWriteTimeOf(path);
+
+			auto it = cached.find(path);
+			const bool isCached = it != cached.end()
+				&& it->second.filesize == filesize
+				&& it->second.lastWriteTime == lastWriteTime;
+
+			if (isCached) {
+				sources[index] = it->second;
+
+				lock_guard<mutex> lock(mtx);
+				numCached++;
+
+				return;
+			}
+
+			const auto header = loadLasHeader(path);
+			sources[index] = createSource(path, header, filesize, lastWriteTime);
+
+			lock_guard<mutex> lock(mtx);
+			numLoaded++;
+		});
+
+		if (numLoaded > 0) {
+			writeCache(sources);
+		}
+
+		return sources;
+	}
+
+};
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <memory>
+#include <cmath>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <algorithm>
+
+#include "converter_utils.h"
+#include "unsuck/Scheduler.hpp"
+
+using std::vector;
+using std::unique_ptr;
+using std::mutex;
+using std::lock_guard;
+
+// Grid of gridSize^3 cells that only stores the regions that are actually used.
+// Cells are addressed by their morton code and grouped into blocks of 32^3 cells.
+// A block is allocated when one of its cells is first written to.
+// Until then, all of its cells have the same value, see fill.
+template<typename T>
+struct SparseGrid {
+
+	// 32^3 cells per block. Since keys are morton codes, each block is a cube of the grid.
+	static constexpr int64_t blockBits = 15;
+	static constexpr int64_t cellsPerBlock = int64_t(1) << blockBits;
+	static constexpr uint64_t cellMask = cellsPerBlock - 1;
+
+	int64_t gridSize = 0;
+	int64_t gridBits = 0;
+
+	vector<unique_ptr<T[]>> blocks;
+	// value of all cells in blocks that aren't allocated
+	vector<T> fill;
+
+	SparseGrid() {
+
+	}
+
+	SparseGrid(int64_t gridSize, T value) {
+		this->gridSize = gridSize;
+		this->gridBits = int64_t(std::log2(gridSize));
+
+		const int64_t numCells = gridSize * gridSize * gridSize;
+		const int64_t numBlocks = std::max(numCells / cellsPerBlock, int64_t(1));
+
+		blocks.resize(numBlocks);
+		fill.resize(numBlocks, value);
+	}
+
+	SparseGrid(SparseGrid&& other) = default;
+	SparseGrid& operator=(SparseGrid&& other) = default;
+
+	// x is the most significant of each 3 bits, so that the octal digits of a key are octree child indices
+	uint64_t key(int64_t x, int64_t y, int64_t z) const {
+		return mortonEncode_magicbits(z, y, x);
+	}
+
+	// key of the cell with the index x + y * gridSize + z * gridSize^2
+	uint64_t keyOfIndex(int64_t index) const {
+		const int64_t mask = gridSize - 1;
+
+		const int64_t x = index & mask;
+		const int64_t y = (index >> gridBits) & mask;
+		const int64_t z = index >> (2 * gridBits);
+
+		return key(x, y, z);
+	}
+
+	T get(uint64_t key) const {
+		const uint64_t blockIndex = key >> blockBits;
+		const T* block = blocks[blockIndex].get();
+
+		return block != nullptr ? block[key & cellMask] : fill[blockIndex];
+	}
+
+	T& at(uint64_t key) {
+		const uint64_t blockIndex = key >> blockBits;
+
+		if (blocks[blockIndex] == nullptr) {
+			allocate(blockIndex);
+		}
+
+		return blocks[blockIndex][key & cellMask];
+	}
+
+	void allocate(int64_t blockIndex) {
+		blocks[blockIndex].reset(new T[cellsPerBlock]);
+
+		std::fill(blocks[blockIndex].get(), blocks[blockIndex].get() + cellsPerBlock, fill[blockIndex]);
+	}
+
+	int64_t numAllocatedBlocks() const {
+		int64_t count = 0;
+
+		for (const auto& block : blocks) {
+			count += block != nullptr ? 1 : 0;
+		}
+
+		return count;
+	}
+
+	int64_t memory() const {
+		return numAllocatedBlocks() * cellsPerBlock * sizeof(T) + blocks.size() * (sizeof(unique_ptr<T[]>) + sizeof(T));
+	}
+
+};
+
+// One SparseGrid per thread, so that threads can count without synchronizing.
+// reduce() sums them up into a single grid once all threads are done.
+template<typename T>
+struct ThreadLocalGrids {
+
+	int64_t gridSize = 0;
+
+	mutex mtx;
+	std::unordered_map<std::thread::id, unique_ptr<SparseGrid<T>>> grids;
+
+	ThreadLocalGrids(int64_t gridSize) {
+		this->gridSize = gridSize;
+	}
+
+	// grid of the calling thread
+	SparseGrid<T>& local() {
+		lock_guard<mutex> lock(mtx);
+
+		auto& grid = grids[std::this_thread::get_id()];
+		if (grid == nullptr) {
+			grid = std::make_unique<SparseGrid<T>>(gridSize, T(0));
+		}
+
+		return *grid;
+	}
+
+	// Sums all thread grids, block by block in parallel. Blocks that only a single thread
+	// touched are moved instead of copied. The thread grids are consumed.
+	SparseGrid<T> reduce() {
+
+		SparseGrid<T> result(gridSize, T(0));
+
+		vector<SparseGrid<T>*> sources;
+		for (auto& [id, grid] : grids) {
+			sources.push_back(grid.get());
+		}
+
+		parallelFor(0, result.blocks.size(), 1, [&result, &sources](int64_t blockIndex) {
+
+			for (auto source : sources) {
+				auto& block = source->blocks[blockIndex];
+
+				if (block == nullptr) {
+					continue;
+				}
+
+				auto& target = result.blocks[blockIndex];
+
+				if (target == nullptr) {
+					target = std::move(block);
+				} else {
+					for (int64_t i = 0; i < SparseGrid<T>::cellsPerBlock; i++) {
+						target[i] += block[i];
+					}
+
+					block = nullptr;
+				}
+			}
+
+		});
+
+		grids.clear();
+
+		return result;
+	}
+
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+using std::vector;
+
+// Set of integer XYZ coordinates. Keys are stored packed in 12 bytes, in an open-addressed table
+// with linear probing. Inserting doesn't allocate, unless the table has to grow beyond what was reserved.
+struct XYZHashSet {
+
+	struct Key {
+		int32_t x;
+		int32_t y;
+		int32_t z;
+	};
+
+	// marks free slots. The key itself is tracked by <containsEmptyKey>.
+	static constexpr int32_t EMPTY = std::numeric_limits<int32_t>::min();
+
+	vector<Key> slots;
+	uint64_t mask = 0;
+	int64_t count = 0;
+	bool containsEmptyKey = false;
+
+	XYZHashSet() {
+
+	}
+
+	XYZHashSet(int64_t numKeys) {
+		reserve(numKeys);
+	}
+
+	static uint64_t hash(int32_t x, int32_t y, int32_t z) {
+		uint64_t h = (uint64_t(uint32_t(x)) | (uint64_t(uint32_t(y)) << 32)) * 0x9E3779B97F4A7C15ull;
+		h ^= uint64_t(uint32_t(z)) * 0xC2B2AE3D27D4EB4Full;
+		h ^= h >> 29;
+		h *= 0xBF58476D1CE4E5B9ull;
+		h ^= h >> 32;
+
+		return h;
+	}
+
+	int64_t size() const {
+		return count;
+	}
+
+	// bytes of the table
+	int64_t memory() const {
+		return int64_t(slots.size() * sizeof(Key));
+	}
+
+	// makes room for <numKeys> keys at a load factor of at most 0.5
+	void reserve(int64_t numKeys) {
+		uint64_t capacity = 16;
+		while (capacity < 2 * uint64_t(numKeys)) {
+			capacity *= 2;
+		}
+
+		if (capacity <= slots.size()) {
+			return;
+		}
+
+		vector<Key> previous = std::move(slots);
+
+		slots.assign(capacity, { EMPTY, EMPTY, EMPTY });
+		mask = capacity - 1;
+
+		for (const Key& key : previous) {
+			if (!isEmpty(key)) {
+				place(key);
+			}
+		}
+	}
+
+	// removes all keys but keeps the memory
+	void clear() {
+		std::fill(slots.begin(), slots.end(), Key{ EMPTY, EMPTY, EMPTY });
+		count = 0;
+		containsEmptyKey = false;
+	}
+
+	// returns true if the key wasn't in the set yet
+	bool insert(int32_t x, int32_t y, int32_t z) {
+
+		if (x == EMPTY && y == EMPTY && z == EMPTY) {
+			const bool inserted = !containsEmptyKey;
+			containsEmptyKey = true;
+			count += inserted ? 1 : 0;
+
+			return inserted;
+		}
+
+		if (2 * (count + 1) > int64_t(slots.size())) {
+			reserve(count + 1);
+		}
+
+		uint64_t index = hash(x, y, z) & mask;
+
+		while (true) {
+			Key& slot = slots[index];
+
+			if (isEmpty(slot)) {
+				slot = { x, y, z };
+				count++;
+
+				return true;
+			} else if (slot.x == x && slot.y == y && slot.z == z) {
+				return false;
+			}
+
+			index = (index + 1) & mask;
+		}
+	}
+
+private:
+
+	static bool isEmpty(const Key& key) {
+		return key.x == EMPTY && key.y == EMPTY && key.z == EMPTY;
+	}
+
+	void place(const Key& key) {
+		uint64_t index = hash(key.x, key.y, key.z) & mask;
+
+		while (!isEmpty(slots[index])) {
+			index = (index + 1) & mask;
+		}
+
+		slots[index] = key;
+	}
+
+};
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 
 #include "Vector3.h"
 #include "Attributes.h"
@@ -10,12 +11,16 @@
 
 using std::string;
 using std::vector;
+using std::shared_ptr;
 
 class Source;
 class State;
+struct Options;
+struct SealedChunks;
 
 namespace chunker_countsort_laszip {
 
-	void doChunking(const vector<Source>& sources, const string &targetDir, Vector3 min, Vector3 max, State& state, Attributes& outputAttributes);
+	// if <sealedChunks> is given, chunks are pushed to it as soon as they are complete
+	void doChunking(const Options& options, const vector<Source>& sources, const string &targetDir, Vector3 min, Vector3 max, State& state, Attributes& outputAttributes, shared_ptr<SealedChunks> sealedChunks = nullptr);
 
 }
\ No newline at end of file
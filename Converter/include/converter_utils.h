@@ -11,9 +11,10 @@
 #include <atomic>
 #include <map>
 
-//#include "LasLoader/LasLoader.h"
+#include "LasLoader/LasLoader.h"
 #include "unsuck/unsuck.hpp"
 #include "Vector3.h"
+#include "Attributes.h"
 
 using std::ios;
 using std::thread;
@@ -42,29 +43,55 @@ struct LASPointF2 {
 struct Source {
 	string path;
 	uint64_t filesize;
+	int64_t lastWriteTime = 0;
 
 	uint64_t numPoints = 0;
 	int bytesPerPoint = 0;
 	Vector3 min;
 	Vector3 max;
+
+	// header and per-file attribute layout, loaded once by the SourceCatalog
+	LasHeader header;
+	vector<Attribute> attributes;
 };
 
+// Progress and statistics of the conversion. The monitor reads it while the chunker and indexer update it,
+// and both of them run at the same time if chunks are indexed while they are created.
+// name and values are guarded by mtx, use the methods below.
 struct State {
 	string name = "";
 	atomic_int64_t pointsTotal = 0;
 	atomic_int64_t pointsProcessed = 0;
 	atomic_int64_t bytesProcessed = 0;
-	double duration = 0.0;
+	std::atomic<double> duration = 0.0;
 	std::map<string, string> values;
 
 	int numPasses = 3;
-	int currentPass = 0; // starts with index 1! interval: [1,  numPasses]
+	std::atomic_int currentPass = 0; // starts with index 1! interval: [1,  numPasses]
 
 	mutex mtx;
 
 	double progress() {
 		return double(pointsProcessed) / double(pointsTotal);
 	}
+
+	void setName(const string& name) {
+		lock_guard<mutex> lock(mtx);
+
+		this->name = name;
+	}
+
+	string getName() {
+		lock_guard<mutex> lock(mtx);
+
+		return name;
+	}
+
+	void setValue(const string& key, const string& value) {
+		lock_guard<mutex> lock(mtx);
+
+		values[key] = value;
+	}
 };
 
 
@@ -103,6 +130,23 @@ inline uint64_t mortonEncode_magicbits(unsigned int x, unsigned int y, unsigned
 	return answer;
 }
 
+// inverse of splitBy3, gathers every third bit
+inline uint32_t compactBy3(uint64_t x) {
+	x = x & 0x1249249249249249;
+	x = (x ^ (x >> 2)) & 0x10c30c30c30c30c3;
+	x = (x ^ (x >> 4)) & 0x100f00f00f00f00f;
+	x = (x ^ (x >> 8)) & 0x1f0000ff0000ff;
+	x = (x ^ (x >> 16)) & 0x1f00000000ffff;
+	x = (x ^ (x >> 32)) & 0x1fffff;
+	return uint32_t(x);
+}
+
+inline void mortonDecode_magicbits(uint64_t code, uint32_t& x, uint32_t& y, uint32_t& z) {
+	x = compactBy3(code);
+	y = compactBy3(code >> 1);
+	z = compactBy3(code >> 2);
+}
+
 inline BoundingBox childBoundingBoxOf(Vector3 min, Vector3 max, int index) {
 	BoundingBox box;
 	const auto size = max - min;
@@ -152,5 +196,15 @@ struct Options {
 	bool keepChunks = false;
 	bool noChunking = false;
 	bool noIndexing = false;
+	bool noOverlap = false;
+
+	string sourceCache = "";
+	string decodeOnce = "auto"; // "memory", "disk", "off"
+	double countSample = 1.0;
+	string ioBackend = "auto"; // "uring", "threads"
+	int64_t ioQueueDepth = 64;
+	// chunks are kept in memory if they fit into this many MB. -1: a quarter of the available memory
+	int64_t memoryBudget = -1;
+	string dedup = "off"; // "exact", or the spacing of the grid that positions are snapped to
 
 };
\ No newline at end of file
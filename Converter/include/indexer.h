@@ -23,6 +23,9 @@
 #include "unsuck/unsuck.hpp"
 #include "unsuck/TaskPool.hpp"
 #include "structures.h"
+#include "ChunkArena.h"
+#include "AsyncIO.h"
+#include "SealedChunks.h"
 
 using json = nlohmann::json;
 
@@ -55,6 +58,71 @@ namespace indexer{
 
 		string file;
 		string id;
+
+		// ranges of the chunk within <file>. empty if the whole file belongs to the chunk.
+		vector<ChunkExtent> extents;
+
+		// points of chunks that were kept in memory by the chunker. <file> is empty in that case.
+		vector<shared_ptr<Buffer>> buckets;
+		int64_t bucketsSize = 0;
+
+		bool inMemory() {
+			return file.empty();
+		}
+
+		int64_t size() {
+			if (inMemory()) {
+				return bucketsSize;
+			}
+
+			if (extents.empty()) {
+				return fs::file_size(file);
+			}
+
+			int64_t sum = 0;
+			for (const auto& extent : extents) {
+				sum += extent.size;
+			}
+
+			return sum;
+		}
+
+		// in-memory chunks release their buckets, so read() can only be called once for them.
+		shared_ptr<Buffer> read() {
+			if (inMemory()) {
+				shared_ptr<Buffer> buffer = nullptr;
+
+				if (buckets.size() == 1) {
+					buffer = buckets[0];
+				} else {
+					buffer = make_shared<Buffer>(bucketsSize);
+
+					int64_t offset = 0;
+					for (const auto& bucket : buckets) {
+						memcpy(buffer->data_u8 + offset, bucket->data, bucket->size);
+						offset += bucket->size;
+					}
+				}
+
+				buckets.clear();
+
+				return buffer;
+			}
+
+			if (extents.empty()) {
+				return readBinaryFile(file);
+			}
+
+			auto buffer = make_shared<Buffer>(size());
+
+			int64_t offset = 0;
+			for (const auto& extent : extents) {
+				readBinaryFile(file, extent.offset, extent.size, buffer->data_u8 + offset);
+				offset += extent.size;
+			}
+
+			return buffer;
+		}
 	};
 
 	struct Chunks {
@@ -75,22 +143,39 @@ namespace indexer{
 
 	struct Indexer;
 
+	// Collects node data in large buffers, which are written to octree.bin through an AsyncIOBackend.
+	// Buffers come back to a pool once their write completed.
 	struct Writer {
 
+		// a range of octree.bin that is assembled in memory
+		struct OctreeBuffer {
+			shared_ptr<Buffer> buffer = nullptr;
+			// location of the first byte of <buffer> in octree.bin
+			int64_t fileOffset = 0;
+			// bytes handed out to nodes, and bytes that nodes finished copying
+			int64_t reserved = 0;
+			int64_t copied = 0;
+			// no more nodes are added, written once all reserved bytes are copied
+			bool sealed = false;
+		};
+
 		Indexer* indexer = nullptr;
 		int64_t capacity = 16 * 1024 * 1024;
+		static constexpr int64_t numPooledBuffers = 8;
 
 		// copy node data here first
-		shared_ptr<Buffer> activeBuffer = nullptr;
+		shared_ptr<OctreeBuffer> activeBuffer = nullptr;
 
-		// backlog of buffers that reached capacity and are ready to be written to disk
-		deque<shared_ptr<Buffer>> backlog;
+		// buffers of <capacity> bytes that can be reused
+		vector<shared_ptr<Buffer>> freeBuffers;
+
+		// bytes that are sealed or being written
+		atomic_int64_t backlogBytes = 0;
 
-		bool closeRequested = false;
 		bool closed = false;
-		std::condition_variable cvClose;
 
-		fstream fsOctree;
+		shared_ptr<AsyncIOBackend> io = nullptr;
+		shared_ptr<PositionalFile> octreeFile = nullptr;
 
 		mutex mtx;
 
@@ -98,7 +183,9 @@ namespace indexer{
 
 		void writeAndUnload(Node* node);
 
-		void launchWriterThread();
+		shared_ptr<Buffer> acquireBuffer(int64_t size);
+
+		void submit(shared_ptr<OctreeBuffer> octreeBuffer);
 
 		void closeAndWait();
 
@@ -109,7 +196,7 @@ namespace indexer{
 	struct HierarchyFlusher{
 
 		struct HNode{
-			string name;
+			NodeKey key;
 			int64_t byteOffset = 0;
 			int64_t byteSize = 0;
 			int64_t numPoints = 0;
@@ -136,7 +223,7 @@ namespace indexer{
 			lock_guard<mutex> lock(mtx);
 
 			HNode hnode = {
-				.name       = node->name,
+				.key        = node->key,
 				.byteOffset = node->byteOffset,
 				.byteSize   = node->byteSize,
 				.numPoints  = node->numPoints,
@@ -163,10 +250,11 @@ namespace indexer{
 
 			for(auto node : nodes){
 
+				const int64_t level = node.key.level();
 
-				string key = node.name.substr(0, hierarchyStepSize + 1);
-				if(node.name.size() <= hierarchyStepSize + 1){
-					key = "r";
+				string key = "r";
+				if(level > hierarchyStepSize){
+					key = node.key.ancestor(hierarchyStepSize).toString();
 				}
 
 				if(groups.find(key) == groups.end()){
@@ -176,8 +264,8 @@ namespace indexer{
 				groups[key].push_back(node);
 
 				// add batch roots to batches (in addition to root batch)
-				if(node.name.size() == hierarchyStepSize + 1){
-					groups[node.name].push_back(node);
+				if(level == hierarchyStepSize){
+					groups[node.key.toString()].push_back(node);
 				}
 			}
 
@@ -191,9 +279,10 @@ namespace indexer{
 				for(int i = 0; i < groupedNodes.size(); i++){
 					auto node = groupedNodes[i];
 
-					auto name = node.name.c_str();
+					const string nodeName = node.key.toString();
+					auto name = nodeName.c_str();
 					memset(buffer.data_u8 + 48 * i, ' ', 31);
-					memcpy(buffer.data_u8 + 48 * i, name, node.name.size());
+					memcpy(buffer.data_u8 + 48 * i, name, nodeName.size());
 					buffer.set<uint32_t>(node.numPoints,  48 * i + 31);
 					buffer.set<uint64_t>(node.byteOffset, 48 * i + 35);
 					buffer.set<uint32_t>(node.byteSize,   48 * i + 43);
@@ -223,7 +312,7 @@ namespace indexer{
 	};
 
 	struct HierarchyChunk {
-		string name = "";
+		NodeKey key;
 		vector<Node*> nodes;
 	};
 
@@ -234,20 +323,21 @@ namespace indexer{
 	};
 
 	struct CRNode{
-		string name = "";
+		NodeKey key;
 		Node* node;
-		vector<shared_ptr<CRNode>> children;
+		std::array<shared_ptr<CRNode>, 8> children;
 		vector<FlushedChunkRoot> fcrs;
 		int numPoints = 0;
 
 		CRNode(){
-			children.resize(8, nullptr);
+
 		}
 
-		void traverse(function<void(CRNode*)> callback) {
+		template<class Callback>
+		void traverse(Callback&& callback) {
 			callback(this);
 
-			for (auto child : children) {
+			for (auto& child : children) {
 
 				if (child != nullptr) {
 					child->traverse(callback);
@@ -256,8 +346,9 @@ namespace indexer{
 			}
 		}
 
-		void traversePost(function<void(CRNode*)> callback) {
-			for (auto child : children) {
+		template<class Callback>
+		void traversePost(Callback&& callback) {
+			for (auto& child : children) {
 
 				if (child != nullptr) {
 					child->traversePost(callback);
@@ -310,9 +401,10 @@ namespace indexer{
 		fstream fChunkRoots;
 		vector<FlushedChunkRoot> flushedChunkRoots;
 
-		Indexer(string targetDir) {
+		Indexer(string targetDir, Options options) {
 
 			this->targetDir = targetDir;
+			this->options = options;
 
 			writer = make_shared<Writer>(this);
 			hierarchyFlusher = make_shared<HierarchyFlusher>(targetDir + "/.hierarchyChunks");
@@ -353,7 +445,9 @@ namespace indexer{
 		string do_grouping() const override { return "\3"; }
 	};
 
-	void doIndexing(string targetDir, State& state, Options& options, Sampler& sampler);
+	// if <sealedChunks> is given, chunks are taken from there while the chunker is still running,
+	// instead of from the chunks directory
+	void doIndexing(string targetDir, State& state, Options& options, Sampler& sampler, shared_ptr<SealedChunks> sealedChunks = nullptr);
 
 
 }
\ No newline at end of file
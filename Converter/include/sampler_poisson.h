@@ -1,14 +1,112 @@
 #pragma once
 
-#include <execution>
 
 #include "structures.h"
 #include "Attributes.h"
+#include "XYZHashSet.h"
+#include "DistanceKernels.h"
+#include "unsuck/Scheduler.hpp"
 #include "PotreeConverter.h"
 
 
 struct SamplerPoisson : public Sampler {
 
+	// Accepted points, hashed into cells with the size of the spacing. Points that are closer than
+	// the spacing to a candidate can only be in the 27 cells around the candidate's cell.
+	// A cell holds at most 8 points that are at least the spacing apart, one in each of its octants,
+	// so the points of a cell fit into one PointBlock8.
+	struct AcceptedGrid {
+
+		struct Slot {
+			int32_t x;
+			int32_t y;
+			int32_t z;
+			int32_t blockIndex; // -1 if unused
+		};
+
+		vector<Slot> slots;
+		uint64_t mask = 0;
+
+		vector<PointBlock8> blocks;
+		vector<int8_t> counts;
+
+		// removes all points, and makes room for <maxCells> cells. Keeps the memory of previous nodes.
+		void reset(int64_t maxCells) {
+			uint64_t capacity = 16;
+			while (capacity < 2 * uint64_t(maxCells)) {
+				capacity *= 2;
+			}
+
+			slots.assign(capacity, { 0, 0, 0, -1 });
+			mask = capacity - 1;
+
+			blocks.clear();
+			counts.clear();
+		}
+
+		// index of the cell's block, or -1 if the cell is empty
+		int64_t find(int32_t x, int32_t y, int32_t z) const {
+			uint64_t index = XYZHashSet::hash(x, y, z) & mask;
+
+			while (true) {
+				const Slot& slot = slots[index];
+
+				if (slot.blockIndex < 0) {
+					return -1;
+				} else if (slot.x == x && slot.y == y && slot.z == z) {
+					return slot.blockIndex;
+				}
+
+				index = (index + 1) & mask;
+			}
+		}
+
+		// returns false if the cell is full, which can only happen due to rounding errors
+		bool insert(int32_t x, int32_t y, int32_t z, double px, double py, double pz) {
+			uint64_t index = XYZHashSet::hash(x, y, z) & mask;
+
+			while (slots[index].blockIndex >= 0) {
+				const Slot& slot = slots[index];
+
+				if (slot.x == x && slot.y == y && slot.z == z) {
+					break;
+				}
+
+				index = (index + 1) & mask;
+			}
+
+			Slot& slot = slots[index];
+
+			if (slot.blockIndex < 0) {
+				constexpr double inf = std::numeric_limits<double>::infinity();
+
+				PointBlock8 block;
+				std::fill(block.x, block.x + 8, inf);
+				std::fill(block.y, block.y + 8, inf);
+				std::fill(block.z, block.z + 8, inf);
+
+				slot = { x, y, z, int32_t(blocks.size()) };
+				blocks.push_back(block);
+				counts.push_back(0);
+			}
+
+			PointBlock8& block = blocks[slot.blockIndex];
+			int8_t& count = counts[slot.blockIndex];
+
+			if (count == 8) {
+				return false;
+			}
+
+			block.x[count] = px;
+			block.y[count] = py;
+			block.z[count] = pz;
+			count++;
+
+			return true;
+		}
+
+	};
+
 	// subsample a local octree from bottom up
 	void sample(Node* node, Attributes attributes, double baseSpacing,
 		function<void(Node*)> onNodeCompleted,
@@ -19,19 +117,8 @@ struct SamplerPoisson : public Sampler {
 			double x;
 			double y;
 			double z;
+			// index among all points of the children, see PointFlags
 			int32_t pointIndex;
-			int32_t childIndex;
-		};
-
-		function<void(Node*, function<void(Node*)>)> traversePost = [&traversePost](Node* node, function<void(Node*)> callback) {
-			for (auto child : node->children) {
-
-				if (child != nullptr && !child->sampled) {
-					traversePost(child.get(), callback);
-				}
-			}
-
-			callback(node);
 		};
 
 		const int64_t bytesPerPoint = attributes.bytes;
@@ -60,7 +147,7 @@ struct SamplerPoisson : public Sampler {
 			// =================================================================
 			//
 			// first, check for each point whether it's accepted or rejected
-			// save result in an array with one element for each point
+			// save result in a flag for each point
 
 			int64_t numPointsInChildren = 0;
 			for (auto child : node->children) {
@@ -74,23 +161,13 @@ struct SamplerPoisson : public Sampler {
 			vector<Point> points;
 			points.reserve(numPointsInChildren);
 
-			vector<vector<int8_t>> acceptedChildPointFlags;
-			vector<int64_t> numRejectedPerChild(8, 0);
 			int64_t numAccepted = 0;
 
-			for (int32_t childIndex = 0; childIndex < 8; childIndex++) {
-				auto child = node->children[childIndex];
-
+			for (auto& child : node->children) {
 				if (child == nullptr) {
-					acceptedChildPointFlags.push_back({});
-					numRejectedPerChild.push_back({});
-
 					continue;
 				}
 
-				vector<int8_t> acceptedFlags(child->numPoints, 0);
-				acceptedChildPointFlags.push_back(acceptedFlags);
-
 				for (int64_t i = 0; i < child->numPoints; i++) {
 					const int64_t pointOffset = i * attributes.bytes;
 					const int32_t* xyz = reinterpret_cast<int32_t*>(child->points->data_u8 + pointOffset);
@@ -99,79 +176,23 @@ struct SamplerPoisson : public Sampler {
 					const double y = (xyz[1] * scale.y) + offset.y;
 					const double z = (xyz[2] * scale.z) + offset.z;
 
-					Point point = { x, y, z, i & 0xFFFF'FFFF, childIndex };
+					Point point = { x, y, z, int32_t(points.size()) };
 
 					points.push_back(point);
 				}
 
 			}
 
-			const unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
-
-			thread_local vector<Point> dbgAccepted(1'000'000);
-			int64_t dbgNumAccepted = 0;
 			const double spacing = baseSpacing / pow(2.0, node->level());
 			const double squaredSpacing = spacing * spacing;
 
-			const auto squaredDistance = [](Point& a, Point& b) {
-				const double dx = a.x - b.x;
-				const double dy = a.y - b.y;
-				const double dz = a.z - b.z;
-
-				const double dd = dx * dx + dy * dy + dz * dz;
-
-				return dd;
-			};
-
 			const auto center = (node->min + node->max) * 0.5;
 
-			const auto checkAccept = [&dbgNumAccepted, spacing, squaredSpacing, &squaredDistance, center /*, &numDistanceChecks*/](Point candidate) {
-
-				const auto cx = candidate.x - center.x;
-				const auto cy = candidate.y - center.y;
-				const auto cz = candidate.z - center.z;
-				const auto cdd = cx * cx + cy * cy + cz * cz;
-				const auto cd = sqrt(cdd);
-				const auto limit = (cd - spacing);
-				const auto limitSquared = limit * limit;
-
-				int64_t j = 0;
-				for (int64_t i = dbgNumAccepted - 1; i >= 0; i--) {
-
-					auto& point = dbgAccepted[i];
-
-					// check distance to center
-					const auto px = point.x - center.x;
-					const auto py = point.y - center.y;
-					const auto pz = point.z - center.z;
-					const auto pdd = px * px + py * py + pz * pz;
-
-					// stop when differences to center between candidate and accepted exceeds the spacing
-					// any other previously accepted point will be even closer to the center.
-					if (pdd < limitSquared) {
-						return true;
-					}
-
-					const double dd = squaredDistance(point, candidate);
-
-					if (dd < squaredSpacing) {
-						return false;
-					}
-
-					j++;
-
-					// also put a limit at x distance checks
-					if (j > 10'000) {
-						return true;
-					}
-				}
-
-				return true;
-
-			};
-
-			constexpr auto parallel = std::execution::par_unseq;
-			std::sort(parallel, points.begin(), points.end(), [center](Point a, Point b) -> bool {
+			// candidates are visited from the center outwards, which decides which of two close points is kept.
+			// The grid below would allow a cell-major order without sorting, but that would keep other points
+			// than before and change the output, so the O(n log n) sort stays.
+			// runs on the workers of the indexer's pool, rather than on threads of its own
+			parallelSort(points.begin(), points.end(), [center](const Point& a, const Point& b) -> bool {
 
 				const auto ax = a.x - center.x;
 				const auto ay = a.y - center.y;
@@ -187,70 +208,54 @@ struct SamplerPoisson : public Sampler {
 				return add < bdd;
 			});
 
-			for (Point point : points) {
+			static const AnyCloserKernel anyCloser = anyCloserKernel(detectSimdLevel());
 
-				const bool isAccepted = checkAccept(point);
+			// there can't be more occupied cells than points, or than cells in the node
+			const double cellsPerAxis = std::ceil(std::max({ size.x, size.y, size.z }) / spacing) + 1.0;
+			const int64_t maxCells = std::min(double(numPointsInChildren), cellsPerAxis * cellsPerAxis * cellsPerAxis);
 
-				if (isAccepted) {
-					dbgAccepted[dbgNumAccepted] = point;
-					dbgNumAccepted++;
-					numAccepted++;
-				} else {
-					numRejectedPerChild[point.childIndex]++;
-				}
+			thread_local AcceptedGrid grid;
+			grid.reset(maxCells);
 
-				acceptedChildPointFlags[point.childIndex][point.pointIndex] = isAccepted ? 1 : 0;
+			PointFlags& acceptedFlags = threadFlags();
+			acceptedFlags.reset(numPointsInChildren);
 
-			}
+			for (Point point : points) {
 
-			auto accepted = make_shared<Buffer>(numAccepted * attributes.bytes);
-			for (int64_t childIndex = 0; childIndex < 8; childIndex++) {
-				auto child = node->children[childIndex];
+				const int32_t cx = int32_t(std::floor((point.x - min.x) / spacing));
+				const int32_t cy = int32_t(std::floor((point.y - min.y) / spacing));
+				const int32_t cz = int32_t(std::floor((point.z - min.z) / spacing));
 
-				if (child == nullptr) {
-					continue;
-				}
+				const PointBlock8* neighbours[27];
+				int64_t numNeighbours = 0;
 
-				auto numRejected = numRejectedPerChild[childIndex];
-				auto& acceptedFlags = acceptedChildPointFlags[childIndex];
-				auto rejected = make_shared<Buffer>(numRejected * attributes.bytes);
+				for (int32_t dz = -1; dz <= 1; dz++) {
+				for (int32_t dy = -1; dy <= 1; dy++) {
+				for (int32_t dx = -1; dx <= 1; dx++) {
+					const int64_t blockIndex = grid.find(cx + dx, cy + dy, cz + dz);
 
-				for (int64_t i = 0; i < child->numPoints; i++) {
-					auto isAccepted = acceptedFlags[i];
-					int64_t pointOffset = i * attributes.bytes;
-
-					if (isAccepted) {
-						accepted->write(child->points->data_u8 + pointOffset, attributes.bytes);
-						// rejected->write(child->points->data_u8 + pointOffset, attributes.bytes);
-					} else {
-						rejected->write(child->points->data_u8 + pointOffset, attributes.bytes);
+					if (blockIndex >= 0) {
+						neighbours[numNeighbours] = &grid.blocks[blockIndex];
+						numNeighbours++;
 					}
 				}
+				}
+				}
+
+				bool isAccepted = !anyCloser(neighbours, numNeighbours, point.x, point.y, point.z, squaredSpacing);
+
+				if (isAccepted) {
+					isAccepted = grid.insert(cx, cy, cz, point.x, point.y, point.z);
+				}
 
-				if (numRejected == 0 && child->isLeaf()) {
-					onNodeDiscarded(child.get());
-
-					node->children[childIndex] = nullptr;
-				} if (numRejected > 0) {
-					child->points = rejected;
-					child->numPoints = numRejected;
-
-					onNodeCompleted(child.get());
-				} else if(numRejected == 0) {
-					// the parent has taken all points from this child,
-					// so make this child an empty inner node.
-					// Otherwise, the hierarchy file will claim that
-					// this node has points but because it doesn't have any,
-					// decompressing the nonexistent point buffer fails
-					// https://github.com/potree/potree/issues/1125
-					child->points = nullptr;
-					child->numPoints = 0;
-					onNodeCompleted(child.get());
+				if (isAccepted) {
+					acceptedFlags.set(point.pointIndex);
+					numAccepted++;
 				}
+
 			}
 
-			node->points = accepted;
-			node->numPoints = numAccepted;
+			acceptIntoParent(node, acceptedFlags, numAccepted, attributes.bytes, onNodeCompleted, onNodeDiscarded);
 
 			return true;
 		});
@@ -1,9 +1,9 @@
 #pragma once
 
-#include <execution>
 
 #include "structures.h"
 #include "Attributes.h"
+#include "unsuck/Scheduler.hpp"
 
 
 
@@ -15,42 +15,9 @@ struct SamplerPoissonAverage : public Sampler {
 		function<void(Node*)> onNodeDiscarded
 	) override {
 
-		struct Point {
-			double x;
-			double y;
-			double z;
-			int32_t pointIndex;
-			int32_t childIndex;
-
-			int64_t r = 0;
-			int64_t g = 0;
-			int64_t b = 0;
-			int64_t w = 0;
-
-			int64_t mainIndex = 0;
-			bool accepted = false;
-		};
-
-		function<void(Node*, function<void(Node*)>)> traversePost = [&traversePost](Node* node, function<void(Node*)> callback) {
-			for (auto child : node->children) {
-
-				if (child != nullptr && !child->sampled) {
-					traversePost(child.get(), callback);
-				}
-			}
-
-			callback(node);
-		};
-
-		const int bytesPerPoint = attributes.bytes;
-		const Vector3 scale = attributes.posScale;
-		const Vector3 offset = attributes.posOffset;
-
-		traversePost(node, [bytesPerPoint, baseSpacing, scale, offset, &onNodeCompleted, &attributes](Node* node) {
+		traversePost(node, [baseSpacing, &onNodeCompleted, &attributes](Node* node) {
 			node->sampled = true;
 
-			const int64_t numPoints = node->numPoints;
-
 			const auto max = node->max;
 			const auto min = node->min;
 			const auto size = max - min;
@@ -69,10 +36,10 @@ struct SamplerPoissonAverage : public Sampler {
 			// =================================================================
 			//
 			// first, check for each point whether it's accepted or rejected
-			// save result in an array with one element for each point
+			// then, average the colors of all points around each accepted point
 
-			int numPointsInChildren = 0;
-			for (auto child : node->children) {
+			int64_t numPointsInChildren = 0;
+			for (auto& child : node->children) {
 				if (child == nullptr) {
 					continue;
 				}
@@ -80,228 +47,238 @@ struct SamplerPoissonAverage : public Sampler {
 				numPointsInChildren += child->numPoints;
 			}
 
-			vector<Point> points;
-			points.reserve(numPointsInChildren);
-
-			vector<vector<int8_t>> acceptedChildPointFlags;
-			vector<int64_t> numRejectedPerChild(8, 0);
-			int64_t numAccepted = 0;
-
-			for (int childIndex = 0; childIndex < 8; childIndex++) {
-				auto child = node->children[childIndex];
-
-				if (child == nullptr) {
-					acceptedChildPointFlags.push_back({});
-					numRejectedPerChild.push_back({});
-
-					continue;
-				}
-
-				const bool childIsLeaf = child->isLeaf();
+			const int64_t n = numPointsInChildren;
+			const int offsetRGB = attributes.getOffset("rgb");
 
-				const int offsetRGB = attributes.getOffset("rgb");
-
-				vector<int8_t> acceptedFlags(child->numPoints, 0);
-				acceptedChildPointFlags.push_back(acceptedFlags);
-
-				for (int i = 0; i < child->numPoints; i++) {
-					const int64_t pointOffset = i * attributes.bytes;
-					const int32_t* xyz = reinterpret_cast<int32_t*>(child->points->data_u8 + pointOffset);
-
-					const double x = (xyz[0] * scale.x) + offset.x;
-					const double y = (xyz[1] * scale.y) + offset.y;
-					const double z = (xyz[2] * scale.z) + offset.z;
-
-					Point point = { x, y, z, i, childIndex };
-
-					const size_t offsetPoint = i * attributes.bytes;
-					point.r = reinterpret_cast<uint16_t*>(child->points->data_u8 + offsetPoint + offsetRGB)[0];
-					point.g = reinterpret_cast<uint16_t*>(child->points->data_u8 + offsetPoint + offsetRGB)[1];
-					point.b = reinterpret_cast<uint16_t*>(child->points->data_u8 + offsetPoint + offsetRGB)[2];
-					point.w = 1;
-
-					point.mainIndex = points.size();
-
-					points.push_back(point);
-				}
-
-				child->colors = {};
-
-			}
-
-			const unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
 			const double spacing = baseSpacing / pow(2.0, node->level());
 			const double squaredSpacing = spacing * spacing;
 
-			auto squaredDistance = [](Point& a, Point& b) {
-				const double dx = a.x - b.x;
-				const double dy = a.y - b.y;
-				const double dz = a.z - b.z;
-
-				const double dd = dx * dx + dy * dy + dz * dz;
-
-				return dd;
-			};
-
 			const auto center = (node->min + node->max) * 0.5;
 
-			constexpr double acceptGridSize = 16;
-			vector<vector<Point>> gridAccepted(acceptGridSize * acceptGridSize * acceptGridSize);
+			// Cells are at least as large as the spacing, so that the neighbourhood of a point spans at most 2 cells per axis,
+			// and the grid has about one cell for every 4 points.
+			const int64_t gridSize = std::clamp(int64_t(std::cbrt(double(n) / 4.0)), int64_t(1), std::max(int64_t(1), int64_t(size.x / spacing)));
+			const int64_t numCells = gridSize * gridSize * gridSize;
+			const double dGridSize = double(gridSize);
 
-			const auto checkAccept = [spacing, squaredSpacing, &squaredDistance, center, min, max, size, &gridAccepted, acceptGridSize](Point candidate) {
+			const auto toCell = [min, size, dGridSize](double x, double y, double z) -> int64_t {
+				const int64_t ix = std::clamp(dGridSize * (x - min.x) / size.x, 0.0, dGridSize - 1.0);
+				const int64_t iy = std::clamp(dGridSize * (y - min.y) / size.y, 0.0, dGridSize - 1.0);
+				const int64_t iz = std::clamp(dGridSize * (z - min.z) / size.z, 0.0, dGridSize - 1.0);
 
-				const double dx = acceptGridSize * (candidate.x - min.x) / size.x;
-				const double dy = acceptGridSize * (candidate.y - min.y) / size.y;
-				const double dz = acceptGridSize * (candidate.z - min.z) / size.z;
+				return ix + iy * int64_t(dGridSize) + iz * int64_t(dGridSize) * int64_t(dGridSize);
+			};
 
-				const double dx_min = acceptGridSize * (candidate.x - spacing - min.x) / size.x;
-				const double dy_min = acceptGridSize * (candidate.y - spacing - min.y) / size.y;
-				const double dz_min = acceptGridSize * (candidate.z - spacing - min.z) / size.z;
+			// calls f(cellIndex) for the cells that points within the spacing of (x, y, z) may be in, until f returns false
+			const auto forEachCellAround = [min, size, dGridSize, spacing](double x, double y, double z, auto f) {
+				const int64_t gridSize = dGridSize;
 
-				const double dx_max = acceptGridSize * (candidate.x + spacing - min.x) / size.x;
-				const double dy_max = acceptGridSize * (candidate.y + spacing - min.y) / size.y;
-				const double dz_max = acceptGridSize * (candidate.z + spacing - min.z) / size.z;
+				const int64_t x_min = std::clamp(dGridSize * (x - spacing - min.x) / size.x, 0.0, dGridSize - 1.0);
+				const int64_t y_min = std::clamp(dGridSize * (y - spacing - min.y) / size.y, 0.0, dGridSize - 1.0);
+				const int64_t z_min = std::clamp(dGridSize * (z - spacing - min.z) / size.z, 0.0, dGridSize - 1.0);
 
-				const int ix = std::max(std::min(dx, acceptGridSize - 1.0), 0.0);
-				const int iy = std::max(std::min(dy, acceptGridSize - 1.0), 0.0);
-				const int iz = std::max(std::min(dz, acceptGridSize - 1.0), 0.0);
+				const int64_t x_max = std::clamp(dGridSize * (x + spacing - min.x) / size.x, 0.0, dGridSize - 1.0);
+				const int64_t y_max = std::clamp(dGridSize * (y + spacing - min.y) / size.y, 0.0, dGridSize - 1.0);
+				const int64_t z_max = std::clamp(dGridSize * (z + spacing - min.z) / size.z, 0.0, dGridSize - 1.0);
 
-				const int x_min = std::max(std::min(dx_min, acceptGridSize - 1.0), 0.0);
-				const int y_min = std::max(std::min(dy_min, acceptGridSize - 1.0), 0.0);
-				const int z_min = std::max(std::min(dz_min, acceptGridSize - 1.0), 0.0);
+				for (int64_t cz = z_min; cz <= z_max; cz++) {
+				for (int64_t cy = y_min; cy <= y_max; cy++) {
+				for (int64_t cx = x_min; cx <= x_max; cx++) {
+					if (!f(cx + cy * gridSize + cz * gridSize * gridSize)) {
+						return;
+					}
+				}
+				}
+				}
+			};
 
-				const int x_max = std::max(std::min(dx_max, acceptGridSize - 1.0), 0.0);
-				const int y_max = std::max(std::min(dy_max, acceptGridSize - 1.0), 0.0);
-				const int z_max = std::max(std::min(dz_max, acceptGridSize - 1.0), 0.0);
+			const auto forEachChildPoint = [node, &attributes, scale, offset](auto f) {
+				int64_t index = 0;
 
-				for (int x = x_min; x <= x_max; x++) {
-				for (int y = y_min; y <= y_max; y++) {
-				for (int z = z_min; z <= z_max; z++) {
-					const int index = x + y * acceptGridSize + z * acceptGridSize * acceptGridSize;
+				for (auto& child : node->children) {
+					if (child == nullptr) {
+						continue;
+					}
 
-					const auto& list = gridAccepted[index];
+					for (int64_t i = 0; i < child->numPoints; i++) {
+						uint8_t* point = child->points->data_u8 + i * attributes.bytes;
+						const int32_t* xyz = reinterpret_cast<int32_t*>(point);
 
-					for (auto point : list) {
-						const double dd = squaredDistance(point, candidate);
+						const double x = (xyz[0] * scale.x) + offset.x;
+						const double y = (xyz[1] * scale.y) + offset.y;
+						const double z = (xyz[2] * scale.z) + offset.z;
 
-						if (dd < squaredSpacing) {
-							return false;
-						}
-					}
+						f(index, x, y, z, point);
 
+						index++;
+					}
 				}
-				}
-				}
-
-				const int indexCurr = ix + iy * acceptGridSize + iz * acceptGridSize * acceptGridSize;
-				gridAccepted[indexCurr].push_back(candidate);
+			};
 
-				return true;
+			// The points of the children in a flat grid, in CSR layout: the points of cell c are the
+			// slots [cellOffsets[c], cellOffsets[c + 1]). First count the points per cell, then fill the slots.
+			vector<int32_t> cellOffsets(numCells + 1, 0);
+			vector<int32_t> cellOfPoint(n);
 
-			};
+			forEachChildPoint([&](int64_t index, double x, double y, double z, uint8_t*) {
+				const int64_t cell = toCell(x, y, z);
 
-			constexpr auto parallel = std::execution::par_unseq;
-			std::sort(parallel, points.begin(), points.end(), [center](Point a, Point b) -> bool {
+				cellOfPoint[index] = cell;
+				cellOffsets[cell + 1]++;
+			});
 
-				const auto ax = a.x - center.x;
-				const auto ay = a.y - center.y;
-				const auto az = a.z - center.z;
-				const auto add = ax * ax + ay * ay + az * az;
+			for (int64_t i = 0; i < numCells; i++) {
+				cellOffsets[i + 1] += cellOffsets[i];
+			}
 
-				const auto bx = b.x - center.x;
-				const auto by = b.y - center.y;
-				const auto bz = b.z - center.z;
-				const auto bdd = bx * bx + by * by + bz * bz;
+			// slot data in SoA layout
+			vector<double> slotX(n);
+			vector<double> slotY(n);
+			vector<double> slotZ(n);
+			vector<uint16_t> slotRGB(3 * n);
+			vector<int32_t> slotPoint(n);
+
+			{
+				vector<int32_t> fillPos(cellOffsets.begin(), cellOffsets.end() - 1);
+
+				forEachChildPoint([&](int64_t index, double x, double y, double z, uint8_t* point) {
+					const int64_t slot = fillPos[cellOfPoint[index]]++;
+					const uint16_t* rgb = reinterpret_cast<uint16_t*>(point + offsetRGB);
+
+					slotX[slot] = x;
+					slotY[slot] = y;
+					slotZ[slot] = z;
+					slotRGB[3 * slot + 0] = rgb[0];
+					slotRGB[3 * slot + 1] = rgb[1];
+					slotRGB[3 * slot + 2] = rgb[2];
+					slotPoint[slot] = index;
+				});
+			}
 
-				// sort by distance to center
-				return add < bdd;
-			});
-			vector<int32_t> mainToSortMapping(points.size());
-			for (int i = 0; i < points.size(); i++) {
-				mainToSortMapping[points[i].mainIndex] = i;
+			for (auto& child : node->children) {
+				if (child != nullptr) {
+					child->colors = {};
+				}
 			}
 
+			// candidates are visited from the center outwards
+			struct Candidate {
+				double squaredDistance;
+				int32_t slot;
+			};
 
-			for (const Point& point : points) {
+			vector<Candidate> candidates(n);
+			for (int64_t slot = 0; slot < n; slot++) {
+				const double dx = slotX[slot] - center.x;
+				const double dy = slotY[slot] - center.y;
+				const double dz = slotZ[slot] - center.z;
 
-				const bool isAccepted = checkAccept(point);
+				candidates[slot] = { dx * dx + dy * dy + dz * dz, int32_t(slot) };
+			}
 
-				if (isAccepted) {
-					numAccepted++;
+			// runs on the workers of the indexer's pool, rather than on threads of its own
+			parallelSort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) -> bool {
+				if (a.squaredDistance != b.squaredDistance) {
+					return a.squaredDistance < b.squaredDistance;
 				} else {
-					numRejectedPerChild[point.childIndex]++;
+					return a.slot < b.slot;
 				}
+			});
 
-				acceptedChildPointFlags[point.childIndex][point.pointIndex] = isAccepted ? 1 : 0;
-
-			}
+			// accepted points of a cell go to the start of the cell's range of slots
+			vector<int32_t> numAcceptedInCell(numCells, 0);
+			vector<double> acceptedX(n);
+			vector<double> acceptedY(n);
+			vector<double> acceptedZ(n);
 
-			{// compute average color
-				const int offsetRGB = attributes.getOffset("rgb");
+			vector<int32_t> acceptedSlots;
+			// index into acceptedSlots, or -1 if rejected
+			vector<int32_t> acceptedIndexOfPoint(n, -1);
 
-				const auto addCandidateToAverage = [node](Point& candidate, Point& average) {
-					average.r = average.r + candidate.r;
-					average.g = average.g + candidate.g;
-					average.b = average.b + candidate.b;
-					average.w = average.w + candidate.w;
+			for (const Candidate& candidate : candidates) {
+				const int64_t slot = candidate.slot;
+				const double x = slotX[slot];
+				const double y = slotY[slot];
+				const double z = slotZ[slot];
 
-				};
+				bool isAccepted = true;
 
+				forEachCellAround(x, y, z, [&](int64_t cell) {
+					const int64_t start = cellOffsets[cell];
+					const int64_t end = start + numAcceptedInCell[cell];
 
-				for (Point& candidate : points) {
-					const double dx = acceptGridSize * (candidate.x - min.x) / size.x;
-					const double dy = acceptGridSize * (candidate.y - min.y) / size.y;
-					const double dz = acceptGridSize * (candidate.z - min.z) / size.z;
+					for (int64_t i = start; i < end; i++) {
+						const double dx = acceptedX[i] - x;
+						const double dy = acceptedY[i] - y;
+						const double dz = acceptedZ[i] - z;
 
-					const double dx_min = acceptGridSize * (candidate.x - spacing - min.x) / size.x;
-					const double dy_min = acceptGridSize * (candidate.y - spacing - min.y) / size.y;
-					const double dz_min = acceptGridSize * (candidate.z - spacing - min.z) / size.z;
+						if (dx * dx + dy * dy + dz * dz < squaredSpacing) {
+							isAccepted = false;
 
-					const double dx_max = acceptGridSize * (candidate.x + spacing - min.x) / size.x;
-					const double dy_max = acceptGridSize * (candidate.y + spacing - min.y) / size.y;
-					const double dz_max = acceptGridSize * (candidate.z + spacing - min.z) / size.z;
+							return false;
+						}
+					}
 
-					const int ix = std::max(std::min(dx, acceptGridSize - 1.0), 0.0);
-					const int iy = std::max(std::min(dy, acceptGridSize - 1.0), 0.0);
-					const int iz = std::max(std::min(dz, acceptGridSize - 1.0), 0.0);
+					return true;
+				});
 
-					const int x_min = std::max(std::min(dx_min, acceptGridSize - 1.0), 0.0);
-					const int y_min = std::max(std::min(dy_min, acceptGridSize - 1.0), 0.0);
-					const int z_min = std::max(std::min(dz_min, acceptGridSize - 1.0), 0.0);
+				if (isAccepted) {
+					const int64_t pointIndex = slotPoint[slot];
+					const int64_t cell = cellOfPoint[pointIndex];
+					const int64_t target = cellOffsets[cell] + numAcceptedInCell[cell];
 
-					const int x_max = std::max(std::min(dx_max, acceptGridSize - 1.0), 0.0);
-					const int y_max = std::max(std::min(dy_max, acceptGridSize - 1.0), 0.0);
-					const int z_max = std::max(std::min(dz_max, acceptGridSize - 1.0), 0.0);
+					acceptedX[target] = x;
+					acceptedY[target] = y;
+					acceptedZ[target] = z;
+					numAcceptedInCell[cell]++;
 
-					for (int x = x_min; x <= x_max; x++) {
-						for (int y = y_min; y <= y_max; y++) {
-							for (int z = z_min; z <= z_max; z++) {
-								const int index = x + y * acceptGridSize + z * acceptGridSize * acceptGridSize;
+					acceptedIndexOfPoint[pointIndex] = acceptedSlots.size();
+					acceptedSlots.push_back(slot);
+				}
+			}
 
-								auto& list = gridAccepted[index];
+			const int64_t numAccepted = acceptedSlots.size();
 
-								for (auto& point : list) {
-									const double dd = squaredDistance(point, candidate);
+			// compute average color
+			// Each accepted point gathers the colors of all points within the spacing, including its own.
+			// Accepted points are processed in parallel and each one only writes its own sum.
+			vector<CumulativeColor> colorSums(numAccepted);
 
-									if (dd < squaredSpacing) {
+			parallelFor(0, numAccepted, 1024, [&](int64_t i) {
+				const int64_t slot = acceptedSlots[i];
+				const double x = slotX[slot];
+				const double y = slotY[slot];
+				const double z = slotZ[slot];
 
-										addCandidateToAverage(candidate, points[mainToSortMapping[point.mainIndex]]);
+				CumulativeColor sum;
 
-									}
-								}
+				forEachCellAround(x, y, z, [&](int64_t cell) {
+					for (int64_t j = cellOffsets[cell]; j < cellOffsets[cell + 1]; j++) {
+						const double dx = slotX[j] - x;
+						const double dy = slotY[j] - y;
+						const double dz = slotZ[j] - z;
 
-							}
+						if (dx * dx + dy * dy + dz * dz < squaredSpacing) {
+							sum.r += slotRGB[3 * j + 0];
+							sum.g += slotRGB[3 * j + 1];
+							sum.b += slotRGB[3 * j + 2];
+							sum.w += 1;
 						}
 					}
-				}
-			}
 
-			auto accepted = make_shared<Buffer>(numAccepted * attributes.bytes);
+					return true;
+				});
+
+				colorSums[i] = sum;
+			});
+
+			// accepted points are gathered into the parent, but also stay in their child
+			auto accepted = BufferPool::instance().acquire(numAccepted * attributes.bytes);
 			vector<CumulativeColor> averagedColors;
 			averagedColors.reserve(numAccepted);
 
-			int offsetRGB = attributes.getOffset("rgb");
-			size_t j = 0;
+			int64_t numGathered = 0;
+			int64_t j = 0;
 			for (int childIndex = 0; childIndex < 8; childIndex++) {
 				auto child = node->children[childIndex];
 
@@ -309,34 +286,26 @@ struct SamplerPoissonAverage : public Sampler {
 					continue;
 				}
 
-				const auto numRejected = numRejectedPerChild[childIndex];
-				auto& acceptedFlags = acceptedChildPointFlags[childIndex];
-				auto rejected = make_shared<Buffer>(child->numPoints * attributes.bytes);
+				int64_t numRejected = 0;
 
-				for (int i = 0; i < child->numPoints; i++) {
-					auto isAccepted = acceptedFlags[i];
+				for (int64_t i = 0; i < child->numPoints; i++) {
+					const int64_t acceptedIndex = acceptedIndexOfPoint[j];
 					int64_t pointOffset = i * attributes.bytes;
 
-					const Point& p = points[mainToSortMapping[j]];
+					if (acceptedIndex >= 0) {
+						const CumulativeColor& color = colorSums[acceptedIndex];
 
-					uint16_t* rgbTarget = reinterpret_cast<uint16_t*>(child->points->data_u8 + i * attributes.bytes + offsetRGB);
-					rgbTarget[0] = p.r / p.w;
-					rgbTarget[1] = p.g / p.w;
-					rgbTarget[2] = p.b / p.w;
+						uint16_t* rgbTarget = reinterpret_cast<uint16_t*>(child->points->data_u8 + pointOffset + offsetRGB);
+						rgbTarget[0] = color.r / color.w;
+						rgbTarget[1] = color.g / color.w;
+						rgbTarget[2] = color.b / color.w;
 
-					if (isAccepted) {
-						accepted->write(child->points->data_u8 + pointOffset, attributes.bytes);
+						memcpy(accepted->data_u8 + numGathered * attributes.bytes, child->points->data_u8 + pointOffset, attributes.bytes);
+						numGathered++;
 
-						CumulativeColor color;
-						color.r = p.r;
-						color.g = p.g;
-						color.b = p.b;
-						color.w = p.w;
 						averagedColors.push_back(color);
-
-						rejected->write(child->points->data_u8 + pointOffset, attributes.bytes);
 					} else {
-						rejected->write(child->points->data_u8 + pointOffset, attributes.bytes);
+						numRejected++;
 					}
 
 					j++;
@@ -345,8 +314,6 @@ struct SamplerPoissonAverage : public Sampler {
 				if (numRejected == 0) {
 					node->children[childIndex] = nullptr;
 				} if (numRejected > 0) {
-					child->points = rejected;
-
 					onNodeCompleted(child.get());
 				}
 			}
@@ -360,4 +327,3 @@ struct SamplerPoissonAverage : public Sampler {
 	}
 
 };
-
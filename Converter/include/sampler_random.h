@@ -10,6 +10,34 @@
 
 struct SamplerRandom : public Sampler {
 
+	// One bit per cell of a 128^3 grid, 256kb instead of the 16mb of a grid of 64 bit counters.
+	// Remembers the cells it set, so that clearing it costs as much as the node's accepted points.
+	struct OccupancyGrid {
+
+		static constexpr int64_t numCells = 128 * 128 * 128;
+
+		vector<uint64_t> bits = vector<uint64_t>(numCells / 64, 0);
+		vector<uint32_t> occupied;
+
+		bool isOccupied(int64_t cellIndex) const {
+			return (bits[cellIndex >> 6] & (uint64_t(1) << (cellIndex & 63))) != 0;
+		}
+
+		void occupy(int64_t cellIndex) {
+			bits[cellIndex >> 6] |= uint64_t(1) << (cellIndex & 63);
+			occupied.push_back(uint32_t(cellIndex));
+		}
+
+		void clear() {
+			for (uint32_t cellIndex : occupied) {
+				bits[cellIndex >> 6] = 0;
+			}
+
+			occupied.clear();
+		}
+
+	};
+
 	// subsample a local octree from bottom up
 	void sample(Node* node, Attributes attributes, double baseSpacing,
 		function<void(Node*)> onNodeCompleted,
@@ -25,17 +53,6 @@ struct SamplerRandom : public Sampler {
 			int32_t childIndex;
 		};
 
-		function<void(Node*, function<void(Node*)>)> traversePost = [&traversePost](Node* node, function<void(Node*)> callback) {
-			for (auto child : node->children) {
-
-				if (child != nullptr && !child->sampled) {
-					traversePost(child.get(), callback);
-				}
-			}
-
-			callback(node);
-		};
-
 		const int bytesPerPoint = attributes.bytes;
 		const Vector3 scale = attributes.posScale;
 		const Vector3 offset = attributes.posOffset;
@@ -46,9 +63,7 @@ struct SamplerRandom : public Sampler {
 			const int64_t numPoints = node->numPoints;
 
 			constexpr int64_t gridSize = 128;
-			thread_local vector<int64_t> grid(gridSize* gridSize* gridSize, -1);
-			thread_local int64_t iteration = 0;
-			iteration++;
+			thread_local OccupancyGrid grid;
 
 			const auto max = node->max;
 			const auto min = node->min;
@@ -88,34 +103,22 @@ struct SamplerRandom : public Sampler {
 
 			const bool isLeaf = node->isLeaf();
 			if (isLeaf) {
-				// shuffle?
-
-				//
-				// a not particularly efficient approach to shuffling:
-				//
-
-				vector<int> indices(node->numPoints);
-				for (int i = 0; i < node->numPoints; i++) {
-					indices[i] = i;
-				}
+				// shuffle the points in place (Fisher-Yates)
 
 				const unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
+				std::default_random_engine random(seed);
 
-				shuffle(indices.begin(), indices.end(), std::default_random_engine(seed));
+				uint8_t* data = node->points->data_u8;
+				const int64_t bytesPerPoint = attributes.bytes;
 
-				auto buffer = make_shared<Buffer>(node->points->size);
-
-				for (int i = 0; i < node->numPoints; i++) {
-
-					const int64_t sourceOffset = i * attributes.bytes;
-					const int64_t targetOffset = indices[i] * attributes.bytes;
-
-					memcpy(buffer->data_u8 + targetOffset, node->points->data_u8 + sourceOffset, attributes.bytes);
+				for (int64_t i = node->numPoints - 1; i > 0; i--) {
+					const int64_t j = std::uniform_int_distribution<int64_t>(0, i)(random);
 
+					if (i != j) {
+						std::swap_ranges(data + i * bytesPerPoint, data + (i + 1) * bytesPerPoint, data + j * bytesPerPoint);
+					}
 				}
 
-				node->points = buffer;
-
 
 				return false;
 			}
@@ -125,24 +128,25 @@ struct SamplerRandom : public Sampler {
 			// =================================================================
 			//
 			// first, check for each point whether it's accepted or rejected
-			// save result in an array with one element for each point
+			// save result in a flag for each point
 
-			vector<vector<int8_t>> acceptedChildPointFlags;
-			vector<int64_t> numRejectedPerChild;
-			int64_t numAccepted = 0;
-			for (int childIndex = 0; childIndex < 8; childIndex++) {
-				auto child = node->children[childIndex];
+			int64_t numPointsInChildren = 0;
+			for (auto& child : node->children) {
+				if (child != nullptr) {
+					numPointsInChildren += child->numPoints;
+				}
+			}
 
-				if (child == nullptr) {
-					acceptedChildPointFlags.push_back({});
-					numRejectedPerChild.push_back({});
+			PointFlags& acceptedFlags = threadFlags();
+			acceptedFlags.reset(numPointsInChildren);
 
+			int64_t numAccepted = 0;
+			int64_t pointIndex = 0;
+			for (auto& child : node->children) {
+				if (child == nullptr) {
 					continue;
 				}
 
-				vector<int8_t> acceptedFlags(child->numPoints, 0);
-				int64_t numRejected = 0;
-
 				for (int i = 0; i < child->numPoints; i++) {
 
 					const int64_t pointOffset = i * attributes.bytes;
@@ -154,78 +158,30 @@ struct SamplerRandom : public Sampler {
 
 					const CellIndex cellIndex = toCellIndex({ x, y, z });
 
-					auto& gridValue = grid[cellIndex.index];
-
 					static double all = sqrt(3.0);
 
 					bool isAccepted;
 					if (child->numPoints < 100) {
 						isAccepted = true;
-					} else if (cellIndex.distance < 0.7 * all && gridValue < iteration) {
+					} else if (cellIndex.distance < 0.7 * all && !grid.isOccupied(cellIndex.index)) {
 						isAccepted = true;
 					} else {
 						isAccepted = false;
 					}
 
 					if (isAccepted) {
-						gridValue = iteration;
+						grid.occupy(cellIndex.index);
+						acceptedFlags.set(pointIndex);
 						numAccepted++;
-					} else {
-						numRejected++;
 					}
 
-					acceptedFlags[i] = isAccepted ? 1 : 0;
+					pointIndex++;
 				}
-
-				acceptedChildPointFlags.push_back(acceptedFlags);
-				numRejectedPerChild.push_back(numRejected);
 			}
 
-			auto accepted = make_shared<Buffer>(numAccepted * attributes.bytes);
-			for (int childIndex = 0; childIndex < 8; childIndex++) {
-				auto child = node->children[childIndex];
-
-				if (child == nullptr) continue;
-
-				auto numRejected = numRejectedPerChild[childIndex];
-				auto& acceptedFlags = acceptedChildPointFlags[childIndex];
-				auto rejected = make_shared<Buffer>(numRejected * attributes.bytes);
-
-				for (int i = 0; i < child->numPoints; i++) {
-					const auto isAccepted = acceptedFlags[i];
-					int64_t pointOffset = i * attributes.bytes;
-
-					if (isAccepted) {
-						accepted->write(child->points->data_u8 + pointOffset, attributes.bytes);
-					} else {
-						rejected->write(child->points->data_u8 + pointOffset, attributes.bytes);
-					}
-				}
-
-				if (numRejected == 0 && child->isLeaf()) {
-					onNodeDiscarded(child.get());
-
-					node->children[childIndex] = nullptr;
-				} if (numRejected > 0) {
-					child->points = rejected;
-					child->numPoints = numRejected;
-
-					onNodeCompleted(child.get());
-				} else if(numRejected == 0) {
-					// the parent has taken all points from this child,
-					// so make this child an empty inner node.
-					// Otherwise, the hierarchy file will claim that
-					// this node has points but because it doesn't have any,
-					// decompressing the nonexistent point buffer fails
-					// https://github.com/potree/potree/issues/1125
-					child->points = nullptr;
-					child->numPoints = 0;
-					onNodeCompleted(child.get());
-				}
-			}
+			grid.clear();
 
-			node->points = accepted;
-			node->numPoints = numAccepted;
+			acceptIntoParent(node, acceptedFlags, numAccepted, attributes.bytes, onNodeCompleted, onNodeDiscarded);
 
 			return true;
 		});
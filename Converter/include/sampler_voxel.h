@@ -0,0 +1,186 @@
+#pragma once
+
+#include "structures.h"
+#include "Attributes.h"
+
+
+// Keeps one point per voxel of the node's spacing, the one closest to the voxel's center.
+// Works on the integer coordinates of the points, without sorting, in a single pass over the points
+// of the children. Faster than the poisson samplers, at the cost of a more regular pattern.
+struct SamplerVoxel : public Sampler {
+
+	// voxels are addressed by 21 bits per axis
+	static constexpr int64_t maxVoxelsPerAxis = int64_t(1) << 21;
+
+	// Open-addressed table from voxel key to the point that represents the voxel so far.
+	struct VoxelTable {
+
+		static constexpr uint64_t EMPTY = ~uint64_t(0);
+
+		struct Slot {
+			uint64_t key;
+			int64_t squaredDistance;
+			// index among all points of the children, see PointFlags
+			int64_t pointIndex;
+		};
+
+		vector<Slot> slots;
+		uint64_t mask = 0;
+
+		// removes all voxels and makes room for <numKeys> of them. Keeps the memory of previous nodes.
+		void reset(int64_t numKeys) {
+			uint64_t capacity = 16;
+			while (capacity < 2 * uint64_t(numKeys)) {
+				capacity *= 2;
+			}
+
+			slots.assign(capacity, { EMPTY, 0, 0 });
+			mask = capacity - 1;
+		}
+
+		static uint64_t hash(uint64_t key) {
+			key ^= key >> 33;
+			key *= 0xFF51AFD7ED558CCDull;
+			key ^= key >> 33;
+
+			return key;
+		}
+
+		// makes the point the voxel's representative if it's the first or closest point so far
+		void insert(uint64_t key, int64_t squaredDistance, int64_t pointIndex) {
+			uint64_t index = hash(key) & mask;
+
+			while (true) {
+				Slot& slot = slots[index];
+
+				if (slot.key == EMPTY) {
+					slot = { key, squaredDistance, pointIndex };
+
+					return;
+				} else if (slot.key == key) {
+					if (squaredDistance < slot.squaredDistance) {
+						slot = { key, squaredDistance, pointIndex };
+					}
+
+					return;
+				}
+
+				index = (index + 1) & mask;
+			}
+		}
+
+	};
+
+	// subsample a local octree from bottom up
+	void sample(Node* node, Attributes attributes, double baseSpacing,
+		function<void(Node*)> onNodeCompleted,
+		function<void(Node*)> onNodeDiscarded
+	) override {
+
+		traversePost(node, [baseSpacing, &onNodeCompleted, &onNodeDiscarded, attributes](Node* node) {
+			node->sampled = true;
+
+			const auto scale = attributes.posScale;
+			const auto offset = attributes.posOffset;
+
+			const bool isLeaf = node->isLeaf();
+
+			if (isLeaf) {
+				return false;
+			}
+
+			// =================================================================
+			// SAMPLING
+			// =================================================================
+			//
+			// first, find the representative of each voxel
+			// then, flag the accepted points
+
+			int64_t numPointsInChildren = 0;
+			for (auto& child : node->children) {
+				if (child == nullptr) {
+					continue;
+				}
+
+				numPointsInChildren += child->numPoints;
+			}
+
+			const double spacing = baseSpacing / pow(2.0, node->level());
+
+			// node bounds and voxel size in the integer coordinates of the points
+			const int64_t minX = std::floor((node->min.x - offset.x) / scale.x);
+			const int64_t minY = std::floor((node->min.y - offset.y) / scale.y);
+			const int64_t minZ = std::floor((node->min.z - offset.z) / scale.z);
+
+			const int64_t sizeX = std::ceil((node->max.x - offset.x) / scale.x) - minX + 1;
+			const int64_t sizeY = std::ceil((node->max.y - offset.y) / scale.y) - minY + 1;
+			const int64_t sizeZ = std::ceil((node->max.z - offset.z) / scale.z) - minZ + 1;
+
+			const auto voxelSizeOf = [](double spacing, double scale, int64_t size) {
+				int64_t voxelSize = std::max(int64_t(1), int64_t(spacing / scale));
+
+				// coarser voxels if the spacing is so fine that keys wouldn't fit into 21 bits per axis
+				voxelSize = std::max(voxelSize, (size + maxVoxelsPerAxis - 1) / maxVoxelsPerAxis);
+
+				return voxelSize;
+			};
+
+			const int64_t voxelSizeX = voxelSizeOf(spacing, scale.x, sizeX);
+			const int64_t voxelSizeY = voxelSizeOf(spacing, scale.y, sizeY);
+			const int64_t voxelSizeZ = voxelSizeOf(spacing, scale.z, sizeZ);
+
+			thread_local VoxelTable table;
+			table.reset(numPointsInChildren);
+
+			int64_t pointIndex = 0;
+			for (auto& child : node->children) {
+				if (child == nullptr) {
+					continue;
+				}
+
+				for (int64_t i = 0; i < child->numPoints; i++) {
+					const int64_t pointOffset = i * attributes.bytes;
+					const int32_t* xyz = reinterpret_cast<int32_t*>(child->points->data_u8 + pointOffset);
+
+					const int64_t x = xyz[0] - minX;
+					const int64_t y = xyz[1] - minY;
+					const int64_t z = xyz[2] - minZ;
+
+					// points may lie marginally outside of the node due to rounding
+					const int64_t vx = std::clamp(x / voxelSizeX, int64_t(0), maxVoxelsPerAxis - 1);
+					const int64_t vy = std::clamp(y / voxelSizeY, int64_t(0), maxVoxelsPerAxis - 1);
+					const int64_t vz = std::clamp(z / voxelSizeZ, int64_t(0), maxVoxelsPerAxis - 1);
+
+					// twice the distance to the voxel center, to stay in integers
+					const int64_t dx = 2 * (x - vx * voxelSizeX) - voxelSizeX;
+					const int64_t dy = 2 * (y - vy * voxelSizeY) - voxelSizeY;
+					const int64_t dz = 2 * (z - vz * voxelSizeZ) - voxelSizeZ;
+
+					const uint64_t key = uint64_t(vx) | (uint64_t(vy) << 21) | (uint64_t(vz) << 42);
+
+					table.insert(key, dx * dx + dy * dy + dz * dz, pointIndex);
+
+					pointIndex++;
+				}
+			}
+
+			PointFlags& acceptedFlags = threadFlags();
+			acceptedFlags.reset(numPointsInChildren);
+
+			int64_t numAccepted = 0;
+			for (const auto& slot : table.slots) {
+				if (slot.key == VoxelTable::EMPTY) {
+					continue;
+				}
+
+				acceptedFlags.set(slot.pointIndex);
+				numAccepted++;
+			}
+
+			acceptIntoParent(node, acceptedFlags, numAccepted, attributes.bytes, onNodeCompleted, onNodeDiscarded);
+
+			return true;
+		});
+	}
+
+};
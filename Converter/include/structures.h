@@ -7,10 +7,16 @@
 #include <string>
 #include <functional>
 #include <mutex>
+#include <array>
+#include <cstring>
 
 #include "Vector3.h"
 #include "unsuck/unsuck.hpp"
 #include "Attributes.h"
+#include "NodeKey.h"
+#include "NodePool.h"
+#include "BufferPool.h"
+#include "unsuck/Scheduler.hpp"
 
 using std::vector;
 using std::shared_ptr;
@@ -24,11 +30,19 @@ struct CumulativeColor {
 	int64_t w = 0;
 };
 
+struct Node;
+
+// octree nodes are allocated from a pool, together with their reference count
+template<class... Args>
+shared_ptr<Node> makeNode(Args&&... args) {
+	return std::allocate_shared<Node>(PoolAllocator<Node>(), std::forward<Args>(args)...);
+}
+
 struct Node {
 
-	vector<shared_ptr<Node>> children;
+	std::array<shared_ptr<Node>, 8> children;
 
-	string name;
+	NodeKey key;
 	shared_ptr<Buffer> points;
 	vector<CumulativeColor> colors;
 	Vector3 min;
@@ -46,36 +60,38 @@ struct Node {
 
 	}
 
-	Node(string name, Vector3 min, Vector3 max) {
-		this->name = name;
+	Node(NodeKey key, Vector3 min, Vector3 max) {
+		this->key = key;
 		this->min = min;
 		this->max = max;
+	}
 
-		children.resize(8, nullptr);
+	int64_t level() const {
+		return key.level();
 	}
 
-	int64_t level() {
-		return name.size() - 1;
+	// e.g. "r0123"
+	string name() const {
+		return key.toString();
 	}
 
 	void addDescendant(shared_ptr<Node> descendant) {
 		static mutex mtx;
 		lock_guard<mutex> lock(mtx);
 
-		const int descendantLevel = descendant->name.size() - 1;
+		const int64_t descendantLevel = descendant->level();
 
 		Node* current = this;
 
-		for (int level = 1; level < descendantLevel; level++) {
-			const int index = descendant->name[level] - '0';
+		for (int64_t level = 1; level < descendantLevel; level++) {
+			const int64_t index = descendant->key.childIndexAt(level);
 
 			if (current->children[index] != nullptr) {
 				current = current->children[index].get();
 			} else {
-				string childName = current->name + to_string(index);
 				auto box = childBoundingBoxOf(current->min, current->max, index);
 
-				auto child = make_shared<Node>(childName, box.min, box.max);
+				auto child = makeNode(current->key.child(index), box.min, box.max);
 
 				current->children[index] = child;
 
@@ -83,14 +99,15 @@ struct Node {
 			}
 		}
 
-		const auto index = descendant->name[descendantLevel] - '0';
+		const auto index = descendant->key.childIndex();
 		current->children[index] = descendant;
 	}
 
-	void traverse(function<void(Node*)> callback) {
+	template<class Callback>
+	void traverse(Callback&& callback) {
 		callback(this);
 
-		for (auto child : children) {
+		for (auto& child : children) {
 
 			if (child != nullptr) {
 				child->traverse(callback);
@@ -99,8 +116,9 @@ struct Node {
 		}
 	}
 
-	void traversePost(function<void(Node*)> callback) {
-		for (auto child : children) {
+	template<class Callback>
+	void traversePost(Callback&& callback) {
+		for (auto& child : children) {
 
 			if (child != nullptr) {
 				child->traversePost(callback);
@@ -112,7 +130,7 @@ struct Node {
 
 	bool isLeaf() {
 
-		for (auto child : children) {
+		for (auto& child : children) {
 			if (child != nullptr) {
 				return false;
 			}
@@ -122,14 +140,12 @@ struct Node {
 		return true;
 	}
 
-	Node* find(string name){
+	Node* find(NodeKey key){
 
 		Node* current = this;
 
-		const int depth = name.size() - 1;
-
-		for(int level = 1; level <= depth; level++){
-			const int index = name.at(level) - '0';
+		for(int64_t level = this->level() + 1; level <= key.level(); level++){
+			const int64_t index = key.childIndexAt(level);
 
 			current = current->children[index].get();
 		}
@@ -139,6 +155,27 @@ struct Node {
 
 };
 
+// One bit per point, e.g. whether each point of a node's children is accepted into the node.
+// Points are numbered in the order of the children and their points.
+struct PointFlags {
+
+	vector<uint64_t> bits;
+
+	// clears the flags of <numPoints> points. Keeps the memory.
+	void reset(int64_t numPoints) {
+		bits.assign((numPoints + 63) / 64, 0);
+	}
+
+	void set(int64_t index) {
+		bits[index >> 6] |= uint64_t(1) << (index & 63);
+	}
+
+	bool get(int64_t index) const {
+		return (bits[index >> 6] & (uint64_t(1) << (index & 63))) != 0;
+	}
+
+};
+
 struct Sampler {
 
 
@@ -151,4 +188,121 @@ struct Sampler {
 		function<void(Node*)> callbackNodeDiscarded
 	) = 0;
 
+	// Calls <callback> for all nodes that aren't sampled yet, children before their parent.
+	// Sibling subtrees are independent, so they are sampled concurrently on the scheduler of the calling worker.
+	// A node's callback runs once all of its children are done.
+	template<class Callback>
+	static void traversePost(Node* node, const Callback& callback) {
+
+		TaskGroup group(Scheduler::current());
+
+		for (auto& child : node->children) {
+
+			if (child == nullptr || child->sampled) {
+				continue;
+			}
+
+			if (child->isLeaf()) {
+				// nothing to sample in leaves, not worth a job
+				traversePost(child.get(), callback);
+			} else {
+				group.run([child, &callback]() {
+					traversePost(child.get(), callback);
+				});
+			}
+		}
+
+		group.wait();
+
+		callback(node);
+	}
+
+	// Flags of the calling thread, reused from node to node.
+	// Don't wait for other jobs while using them: the thread may sample another node in the meantime.
+	static PointFlags& threadFlags() {
+		thread_local PointFlags flags;
+
+		return flags;
+	}
+
+	// Moves the points of <node>'s children that are flagged in <accepted> into <node>. They're gathered into a pooled buffer.
+	// The rejected points stay in their child, in their original order, compacted in place.
+	// Children that are left without points are discarded if they're leaves, and kept as empty inner nodes otherwise.
+	static void acceptIntoParent(Node* node, const PointFlags& accepted, int64_t numAccepted, int64_t bytesPerPoint,
+		const function<void(Node*)>& onNodeCompleted,
+		const function<void(Node*)>& onNodeDiscarded
+	) {
+
+		auto buffer = BufferPool::instance().acquire(numAccepted * bytesPerPoint);
+
+		std::array<int64_t, 8> numRejectedPerChild = {};
+		int64_t numGathered = 0;
+		int64_t flagIndex = 0;
+
+		for (int64_t childIndex = 0; childIndex < 8; childIndex++) {
+			auto& child = node->children[childIndex];
+
+			if (child == nullptr) {
+				continue;
+			}
+
+			int64_t numRejected = 0;
+
+			for (int64_t i = 0; i < child->numPoints; i++) {
+				uint8_t* point = child->points->data_u8 + i * bytesPerPoint;
+
+				if (accepted.get(flagIndex)) {
+					memcpy(buffer->data_u8 + numGathered * bytesPerPoint, point, bytesPerPoint);
+					numGathered++;
+				} else {
+					if (numRejected != i) {
+						memcpy(child->points->data_u8 + numRejected * bytesPerPoint, point, bytesPerPoint);
+					}
+
+					numRejected++;
+				}
+
+				flagIndex++;
+			}
+
+			numRejectedPerChild[childIndex] = numRejected;
+		}
+
+		// the callbacks may wait for other jobs, so they're called once the flags aren't needed anymore
+		for (int64_t childIndex = 0; childIndex < 8; childIndex++) {
+			auto child = node->children[childIndex];
+
+			if (child == nullptr) {
+				continue;
+			}
+
+			const int64_t numRejected = numRejectedPerChild[childIndex];
+
+			if (numRejected == 0 && child->isLeaf()) {
+				onNodeDiscarded(child.get());
+
+				node->children[childIndex] = nullptr;
+			} else if (numRejected > 0) {
+				child->points->size = numRejected * bytesPerPoint;
+				child->numPoints = numRejected;
+
+				onNodeCompleted(child.get());
+			} else {
+				// the parent has taken all points from this child,
+				// so make this child an empty inner node.
+				// Otherwise, the hierarchy file will claim that
+				// this node has points but because it doesn't have any,
+				// decompressing the nonexistent point buffer fails
+				// https://github.com/potree/potree/issues/1125
+				child->points = nullptr;
+				child->numPoints = 0;
+
+				onNodeCompleted(child.get());
+			}
+		}
+
+		node->points = buffer;
+		node->numPoints = numAccepted;
+	}
+
 };
\ No newline at end of file
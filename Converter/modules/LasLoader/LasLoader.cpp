@@ -70,6 +70,45 @@ LasTypeInfo lasTypeInfo(int typeID) {
 }
 
 
+// laszip consumes the "laszip encoded" VLR and doesn't expose it, so the chunk size is parsed from the raw
+// header and VLRs, i.e. the first <offsetToPointData> bytes of the file.
+int64_t parseLazChunkSize(vector<uint8_t>& header) {
+
+	constexpr int64_t minHeaderSize = 227;
+	constexpr int64_t vlrHeaderSize = 54;
+	constexpr uint16_t laszipRecordID = 22204;
+	constexpr uint32_t variableChunkSize = 0xFFFF'FFFF;
+
+	const int64_t size = header.size();
+
+	if (size < minHeaderSize) {
+		return -1;
+	}
+
+	const uint16_t headerSize = read<uint16_t>(header, 94);
+	const uint32_t numVlrs = read<uint32_t>(header, 100);
+
+	int64_t vlrOffset = headerSize;
+	for (uint32_t i = 0; i < numVlrs && vlrOffset + vlrHeaderSize <= size; i++) {
+		const char* userIDData = reinterpret_cast<const char*>(header.data() + vlrOffset + 2);
+		const string userID(userIDData, strnlen(userIDData, 16));
+		const uint16_t recordID = read<uint16_t>(header, vlrOffset + 18);
+		const uint16_t recordLength = read<uint16_t>(header, vlrOffset + 20);
+
+		const int64_t dataOffset = vlrOffset + vlrHeaderSize;
+
+		if (userID == "laszip encoded" && recordID == laszipRecordID && recordLength >= 16 && dataOffset + recordLength <= size) {
+			const uint32_t chunkSize = read<uint32_t>(header, dataOffset + 12);
+
+			return chunkSize == variableChunkSize ? -1 : int64_t(chunkSize);
+		}
+
+		vlrOffset = dataOffset + recordLength;
+	}
+
+	return -1;
+}
+
 LasHeader loadLasHeader(string path) {
 	laszip_POINTER laszip_reader;
 	laszip_header* header;
@@ -104,6 +143,18 @@ LasHeader loadLasHeader(string path) {
 	result.numPoints = std::max(header->extended_number_of_point_records, uint64_t(header->number_of_point_records));
 
 	result.pointDataFormat = header->point_data_format;
+	result.bytesPerPoint = header->point_data_record_length;
+	result.offsetToPointData = header->offset_to_point_data;
+
+	if (iEndsWith(path, ".laz")) {
+		// header and VLRs in one read
+		vector<uint8_t> headerBytes(header->offset_to_point_data);
+		readBinaryFile(path, 0, headerBytes.size(), headerBytes.data());
+
+		result.lazChunkSize = parseLazChunkSize(headerBytes);
+	} else {
+		result.lazChunkSize = 0;
+	}
 
 	const int numVlrs = header->number_of_variable_length_records;
 	for (int i = 0; i < numVlrs; i++) {
@@ -111,6 +162,8 @@ LasHeader loadLasHeader(string path) {
 
 		VLR vlr;
 
+		memcpy(vlr.userID, laszip_vlr.user_id, 16);
+		memcpy(vlr.description, laszip_vlr.description, 32);
 		vlr.recordID = laszip_vlr.record_id;
 		vlr.recordLengthAfterHeader = laszip_vlr.record_length_after_header;
 		vlr.data.resize(vlr.recordLengthAfterHeader);
@@ -127,4 +180,4 @@ LasHeader loadLasHeader(string path) {
 	laszip_destroy(laszip_reader);
 
 	return result;
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -29,6 +29,12 @@ struct LasHeader {
 	int64_t numPoints = 0;
 
 	int pointDataFormat = -1;
+	int bytesPerPoint = 0;
+	int64_t offsetToPointData = 0;
+
+	// points per compressed chunk of *.laz files.
+	// 0 for uncompressed files, -1 if chunks are variable-sized.
+	int64_t lazChunkSize = 0;
 
 	vector<VLR> vlrs;
 };
@@ -0,0 +1,150 @@
+
+#include <cmath>
+
+#include "LasLoader/LasReader.h"
+#include "logger.h"
+
+
+LasReader::LasReader(string path, const LasHeader& header) {
+	this->path = path;
+	this->header = header;
+
+	const int format = header.pointDataFormat;
+	const int recordSize = lasRecordSize(format);
+
+	if (recordSize < 0 || header.bytesPerPoint < recordSize) {
+		return;
+	}
+
+	auto file = make_shared<MappedFile>(path);
+
+	if (!file->isOpen() || file->size < 227) {
+		return;
+	}
+
+	// compare against the header as laszip reported it. They differ for files that laszip
+	// converts on the fly, e.g. LAS 1.4 points stored in compatibility mode.
+	const uint8_t* raw = file->data;
+	uint32_t offsetToPointData = 0;
+	uint16_t recordLength = 0;
+	memcpy(&offsetToPointData, raw + 96, 4);
+	memcpy(&recordLength, raw + 105, 2);
+	// the upper two bits flag compressed files
+	const uint8_t rawFormat = raw[104] & 0b0011'1111;
+
+	const bool matchesHeader = offsetToPointData == header.offsetToPointData
+		&& rawFormat == format
+		&& recordLength == header.bytesPerPoint;
+
+	const int64_t requiredSize = header.offsetToPointData + header.numPoints * header.bytesPerPoint;
+
+	if (!matchesHeader) {
+		logger::WARN("header of " + path + " differs from the one reported by laszip, falling back to laszip");
+
+		return;
+	} else if (file->size < requiredSize) {
+		logger::WARN("file " + path + " is smaller than its header claims, falling back to laszip");
+
+		return;
+	}
+
+	this->file = file;
+	this->points = file->data + header.offsetToPointData;
+	this->stride = header.bytesPerPoint;
+	this->numPoints = header.numPoints;
+}
+
+void transformPositions(
+	const uint8_t* records, int64_t stride, int64_t count,
+	Vector3 sourceScale, Vector3 sourceOffset,
+	Vector3 targetScale, Vector3 targetOffset,
+	int32_t* X, int32_t* Y, int32_t* Z
+) {
+
+	// X, Y and Z are the first 12 bytes of every point record format
+	for (int64_t i = 0; i < count; i++) {
+		const uint8_t* record = records + i * stride;
+
+		memcpy(&X[i], record + 0, 4);
+		memcpy(&Y[i], record + 4, 4);
+		memcpy(&Z[i], record + 8, 4);
+	}
+
+	const auto transform = [count](int32_t* values, double sourceScale, double sourceOffset, double targetScale, double targetOffset) {
+
+		const double steps = (sourceOffset - targetOffset) / targetScale;
+		const bool isIntegerShift = sourceScale == targetScale && std::round(steps) == steps;
+
+		if (isIntegerShift) {
+			const int32_t shift = int32_t(steps);
+
+			for (int64_t i = 0; i < count; i++) {
+				values[i] = values[i] + shift;
+			}
+		} else {
+			for (int64_t i = 0; i < count; i++) {
+				const double value = double(values[i]) * sourceScale + sourceOffset;
+
+				values[i] = int32_t((value - targetOffset) / targetScale);
+			}
+		}
+	};
+
+	transform(X, sourceScale.x, sourceOffset.x, targetScale.x, targetOffset.x);
+	transform(Y, sourceScale.y, sourceOffset.y, targetScale.y, targetOffset.y);
+	transform(Z, sourceScale.z, sourceOffset.z, targetScale.z, targetOffset.z);
+}
+
+int64_t computeGridIndices(
+	const int32_t* X, const int32_t* Y, const int32_t* Z, int64_t count,
+	Vector3 scale, Vector3 offset,
+	Vector3 min, double cubeSize, int64_t gridSize,
+	int64_t* indices
+) {
+
+	const double dGridSize = double(gridSize);
+
+	// same arithmetic as the per-point path, so that both agree on the cell of every point
+	const auto toUnit = [scale, offset, min, cubeSize](const int32_t* X, const int32_t* Y, const int32_t* Z, int64_t i) {
+		const double ux = (double(X[i]) * scale.x + offset.x - min.x) / cubeSize;
+		const double uy = (double(Y[i]) * scale.y + offset.y - min.y) / cubeSize;
+		const double uz = (double(Z[i]) * scale.z + offset.z - min.z) / cubeSize;
+
+		return Vector3(ux, uy, uz);
+	};
+
+	int64_t numOutside = 0;
+
+	for (int64_t i = 0; i < count; i++) {
+		const Vector3 u = toUnit(X, Y, Z, i);
+
+		const bool inBox = u.x >= 0.0 && u.y >= 0.0 && u.z >= 0.0
+			&& u.x <= 1.0 && u.y <= 1.0 && u.z <= 1.0;
+
+		numOutside += inBox ? 0 : 1;
+
+		const int64_t ix = int64_t(std::clamp(dGridSize * u.x, 0.0, dGridSize - 1.0));
+		const int64_t iy = int64_t(std::clamp(dGridSize * u.y, 0.0, dGridSize - 1.0));
+		const int64_t iz = int64_t(std::clamp(dGridSize * u.z, 0.0, dGridSize - 1.0));
+
+		indices[i] = ix + iy * gridSize + iz * gridSize * gridSize;
+	}
+
+	if (numOutside == 0) {
+		return -1;
+	}
+
+	// rare error path, find the offending point
+	for (int64_t i = 0; i < count; i++) {
+		const Vector3 u = toUnit(X, Y, Z, i);
+
+		const bool inBox = u.x >= 0.0 && u.y >= 0.0 && u.z >= 0.0
+			&& u.x <= 1.0 && u.y <= 1.0 && u.z <= 1.0;
+
+		if (!inBox) {
+			return i;
+		}
+	}
+
+	return -1;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+
+#include "unsuck/unsuck.hpp"
+#include "Vector3.h"
+#include "LasLoader/LasLoader.h"
+#include "LasLoader/LasRecords.h"
+
+using std::shared_ptr;
+
+// Reads uncompressed *.las files through a memory mapping.
+// Point records are fixed-size and stored contiguously at offsetToPointData,
+// so they can be decoded in bulk without going through laszip for every point.
+struct LasReader {
+
+	string path;
+	LasHeader header;
+	shared_ptr<MappedFile> file = nullptr;
+
+	const uint8_t* points = nullptr;
+	int64_t stride = 0;
+	int64_t numPoints = 0;
+
+	LasReader(string path, const LasHeader& header);
+
+	// false if the file couldn't be mapped, or if the on-disk header doesn't match the given header.
+	// callers should fall back to laszip in that case.
+	bool isValid() {
+		return points != nullptr;
+	}
+
+	const uint8_t* record(int64_t index) {
+		return points + index * stride;
+	}
+
+	// compressed files need laszip
+	static bool canRead(const string& path) {
+		return !iEndsWith(path, ".laz");
+	}
+
+};
+
+// Transforms the integer coordinates of <count> records, starting at <records>, from the scale/offset of the
+// source file to the scale/offset of the output. Results are written to the X, Y, Z arrays.
+// If both scales are identical and the offsets differ by a whole number of steps, the conversion stays in the integer domain.
+void transformPositions(
+	const uint8_t* records, int64_t stride, int64_t count,
+	Vector3 sourceScale, Vector3 sourceOffset,
+	Vector3 targetScale, Vector3 targetOffset,
+	int32_t* X, int32_t* Y, int32_t* Z);
+
+// Computes the index of the cell in a gridSize³ grid over the cube [min, min + cubeSize] for each of the <count>
+// positions, given in integer coordinates with the specified scale and offset.
+// Returns the index of the first point outside the cube, or -1 if all points are inside.
+int64_t computeGridIndices(
+	const int32_t* X, const int32_t* Y, const int32_t* Z, int64_t count,
+	Vector3 scale, Vector3 offset,
+	Vector3 min, double cubeSize, int64_t gridSize,
+	int64_t* indices);
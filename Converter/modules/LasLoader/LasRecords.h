@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+
+// On-disk layouts of the standard LAS point data record formats 0 to 10.
+// Extra bytes, if any, follow directly after the standard part of a record.
+
+#pragma pack(push, 1)
+
+struct LasWavePacket {
+	uint8_t descriptorIndex;
+	uint64_t byteOffsetToWaveformData;
+	uint32_t waveformPacketSize;
+	float returnPointWaveformLocation;
+	float xt;
+	float yt;
+	float zt;
+};
+
+// formats 0 to 5
+struct LasRecord0 {
+	int32_t X;
+	int32_t Y;
+	int32_t Z;
+	uint16_t intensity;
+	uint8_t returnBits;         // return number: 3, number of returns: 3, scan direction: 1, edge of flight line: 1
+	uint8_t classificationBits; // classification: 5, synthetic: 1, key-point: 1, withheld: 1
+	int8_t scanAngleRank;
+	uint8_t userData;
+	uint16_t pointSourceID;
+};
+
+struct LasRecord1 : LasRecord0 {
+	double gpsTime;
+};
+
+struct LasRecord2 : LasRecord0 {
+	uint16_t rgb[3];
+};
+
+struct LasRecord3 : LasRecord1 {
+	uint16_t rgb[3];
+};
+
+struct LasRecord4 : LasRecord1 {
+	LasWavePacket wavePacket;
+};
+
+struct LasRecord5 : LasRecord3 {
+	LasWavePacket wavePacket;
+};
+
+// formats 6 to 10
+struct LasRecord6 {
+	int32_t X;
+	int32_t Y;
+	int32_t Z;
+	uint16_t intensity;
+	uint8_t returnBits;         // return number: 4, number of returns: 4
+	uint8_t flagBits;           // classification flags: 4, scanner channel: 2, scan direction: 1, edge of flight line: 1
+	uint8_t classification;
+	uint8_t userData;
+	int16_t scanAngle;
+	uint16_t pointSourceID;
+	double gpsTime;
+};
+
+struct LasRecord7 : LasRecord6 {
+	uint16_t rgb[3];
+};
+
+struct LasRecord8 : LasRecord7 {
+	uint16_t nir;
+};
+
+struct LasRecord9 : LasRecord6 {
+	LasWavePacket wavePacket;
+};
+
+struct LasRecord10 : LasRecord8 {
+	LasWavePacket wavePacket;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(LasWavePacket) == 29);
+static_assert(sizeof(LasRecord0) == 20);
+static_assert(sizeof(LasRecord1) == 28);
+static_assert(sizeof(LasRecord2) == 26);
+static_assert(sizeof(LasRecord3) == 34);
+static_assert(sizeof(LasRecord4) == 57);
+static_assert(sizeof(LasRecord5) == 63);
+static_assert(sizeof(LasRecord6) == 30);
+static_assert(sizeof(LasRecord7) == 36);
+static_assert(sizeof(LasRecord8) == 38);
+static_assert(sizeof(LasRecord9) == 59);
+static_assert(sizeof(LasRecord10) == 67);
+
+// size of the standard part of a record, without extra bytes. -1 for unknown formats.
+inline int lasRecordSize(int format) {
+	switch (format) {
+		case 0: return sizeof(LasRecord0);
+		case 1: return sizeof(LasRecord1);
+		case 2: return sizeof(LasRecord2);
+		case 3: return sizeof(LasRecord3);
+		case 4: return sizeof(LasRecord4);
+		case 5: return sizeof(LasRecord5);
+		case 6: return sizeof(LasRecord6);
+		case 7: return sizeof(LasRecord7);
+		case 8: return sizeof(LasRecord8);
+		case 9: return sizeof(LasRecord9);
+		case 10: return sizeof(LasRecord10);
+		default: return -1;
+	}
+}
+
+inline bool isExtendedLasFormat(int format) {
+	return format >= 6;
+}
+
+// byte offsets of the optional fields within a record, -1 if the format doesn't have them
+struct LasRecordLayout {
+	int gpsTime = -1;
+	int rgb = -1;
+	int nir = -1;
+	int wavePacket = -1;
+};
+
+constexpr LasRecordLayout lasRecordLayout(int format) {
+	switch (format) {
+		case 0: return { -1, -1, -1, -1 };
+		case 1: return { sizeof(LasRecord0), -1, -1, -1 };
+		case 2: return { -1, sizeof(LasRecord0), -1, -1 };
+		case 3: return { sizeof(LasRecord0), sizeof(LasRecord1), -1, -1 };
+		case 4: return { sizeof(LasRecord0), -1, -1, sizeof(LasRecord1) };
+		case 5: return { sizeof(LasRecord0), sizeof(LasRecord1), -1, sizeof(LasRecord3) };
+		case 6: return { sizeof(LasRecord6) - 8, -1, -1, -1 };
+		case 7: return { sizeof(LasRecord6) - 8, sizeof(LasRecord6), -1, -1 };
+		case 8: return { sizeof(LasRecord6) - 8, sizeof(LasRecord6), sizeof(LasRecord7), -1 };
+		case 9: return { sizeof(LasRecord6) - 8, -1, -1, sizeof(LasRecord6) };
+		case 10: return { sizeof(LasRecord6) - 8, sizeof(LasRecord6), sizeof(LasRecord7), sizeof(LasRecord8) };
+		default: return { -1, -1, -1, -1 };
+	}
+}
@@ -0,0 +1,423 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <future>
+#include <algorithm>
+#include <type_traits>
+
+using std::thread;
+using std::atomic;
+using std::mutex;
+using std::vector;
+using std::deque;
+using std::function;
+using std::lock_guard;
+using std::unique_lock;
+using std::condition_variable;
+using std::unique_ptr;
+using std::make_unique;
+using std::shared_ptr;
+using std::make_shared;
+
+// Work-stealing scheduler.
+// - jobs spawned from a worker go to that worker's deque. The owner takes the newest job, idle workers steal the oldest.
+// - jobs injected from outside are queued by priority and taken by workers that have nothing local to do or to steal.
+// - idle workers block on a condition variable; they never sleep for a fixed amount of time.
+// - TaskGroup::wait() called from a worker runs other spawned jobs while it waits, so nested parallelism
+//   neither blocks workers nor starts additional threads.
+// - global() is shared by all TaskPools of the process, so that phases that run at the same time,
+//   e.g. chunking and indexing, split the cores between them instead of each starting a thread per core.
+class Scheduler {
+public:
+
+	struct WorkerQueue {
+		mutex mtx;
+		deque<function<void()>> jobs;
+	};
+
+	vector<unique_ptr<WorkerQueue>> queues;
+	vector<thread> threads;
+
+	// injected jobs and their priorities, in descending order of priority
+	mutex mtx_injected;
+	deque<function<void()>> injected;
+	deque<double> priorities;
+
+	// queued jobs, may be briefly larger than the actual number while a job is being queued
+	atomic<int64_t> numSpawned = 0;
+	atomic<int64_t> numInjected = 0;
+
+	mutex mtx_sleep;
+	condition_variable cv_sleep;
+	bool stopping = false;
+
+	inline static thread_local Scheduler* currentScheduler = nullptr;
+	inline static thread_local int64_t currentWorker = -1;
+
+	Scheduler(size_t numThreads) {
+		numThreads = std::max(numThreads, size_t(1));
+
+		for (size_t i = 0; i < numThreads; i++) {
+			queues.push_back(make_unique<WorkerQueue>());
+		}
+
+		for (size_t i = 0; i < numThreads; i++) {
+			threads.emplace_back([this, i]() {
+				currentScheduler = this;
+				currentWorker = i;
+
+				workerLoop(i);
+			});
+		}
+	}
+
+	~Scheduler() {
+		stop();
+	}
+
+	Scheduler(const Scheduler&) = delete;
+	Scheduler& operator=(const Scheduler&) = delete;
+
+	size_t numThreads() {
+		return queues.size();
+	}
+
+	// the scheduler of the calling worker thread, or nullptr if not called from a worker
+	static Scheduler* current() {
+		return currentScheduler;
+	}
+
+	// process-wide scheduler with one worker per hardware thread, started on first use
+	static Scheduler& global() {
+		static Scheduler scheduler(std::thread::hardware_concurrency());
+
+		return scheduler;
+	}
+
+	// index of the calling thread among the workers of this scheduler, or -1
+	int64_t workerIndex() {
+		return currentScheduler == this ? currentWorker : -1;
+	}
+
+	// runs <job> on some worker. From a worker, <job> is queued locally so that nested work stays close
+	// to the job that spawned it. From other threads, this is the same as inject(job, 0.0).
+	void spawn(function<void()> job) {
+		const int64_t index = workerIndex();
+
+		if (index < 0) {
+			inject(std::move(job), 0.0);
+			return;
+		}
+
+		numSpawned++;
+
+		{
+			auto& queue = *queues[index];
+			lock_guard<mutex> lock(queue.mtx);
+
+			queue.jobs.push_back(std::move(job));
+		}
+
+		wake();
+	}
+
+	// Queues <job> with <priority>. Jobs with higher priority start first, jobs of equal priority in the order
+	// they were injected. Workers prefer spawned jobs, which belong to jobs that already started.
+	void inject(function<void()> job, double priority) {
+		numInjected++;
+
+		{
+			lock_guard<mutex> lock(mtx_injected);
+
+			const auto it = std::upper_bound(priorities.begin(), priorities.end(), priority, std::greater<double>());
+			const auto index = it - priorities.begin();
+
+			priorities.insert(it, priority);
+			injected.insert(injected.begin() + index, std::move(job));
+		}
+
+		wake();
+	}
+
+	// runs <f> on some worker and returns a future of its result.
+	// Don't wait for the future from within a worker, use a TaskGroup for that instead.
+	template<class F>
+	auto submit(F&& f, double priority = 0.0) -> std::future<std::invoke_result_t<F>> {
+		using Result = std::invoke_result_t<F>;
+
+		auto task = make_shared<std::packaged_task<Result()>>(std::forward<F>(f));
+		auto future = task->get_future();
+
+		inject([task]() { (*task)(); }, priority);
+
+		return future;
+	}
+
+	// blocks until <isDone> returns true. Workers run spawned jobs in the meantime.
+	// <isDone> must only change before a call to wakeAll().
+	void waitUntil(function<bool()> isDone) {
+		const int64_t index = workerIndex();
+
+		while (!isDone()) {
+
+			if (index >= 0) {
+				function<void()> job;
+
+				if (takeSpawned(index, job)) {
+					job();
+					continue;
+				}
+			}
+
+			unique_lock<mutex> lock(mtx_sleep);
+
+			cv_sleep.wait(lock, [this, &isDone, index]() {
+				return isDone() || (index >= 0 && numSpawned > 0);
+			});
+		}
+	}
+
+	void wakeAll() {
+		{
+			lock_guard<mutex> lock(mtx_sleep);
+		}
+
+		cv_sleep.notify_all();
+	}
+
+	// finishes all queued jobs and joins the workers
+	void stop() {
+		{
+			lock_guard<mutex> lock(mtx_sleep);
+
+			if (stopping) {
+				return;
+			}
+
+			stopping = true;
+		}
+
+		cv_sleep.notify_all();
+
+		for (thread& t : threads) {
+			t.join();
+		}
+
+		threads.clear();
+	}
+
+private:
+
+	void wake() {
+		{
+			lock_guard<mutex> lock(mtx_sleep);
+		}
+
+		// waiters might wait for spawned jobs, or for something else, so wake all of them
+		cv_sleep.notify_all();
+	}
+
+	// own jobs newest first, then the oldest jobs of other workers
+	bool takeSpawned(int64_t index, function<void()>& job) {
+
+		if (numSpawned <= 0) {
+			return false;
+		}
+
+		const int64_t n = queues.size();
+
+		for (int64_t i = 0; i < n; i++) {
+			auto& queue = *queues[(index + i) % n];
+			lock_guard<mutex> lock(queue.mtx);
+
+			if (queue.jobs.empty()) {
+				continue;
+			}
+
+			if (i == 0) {
+				job = std::move(queue.jobs.back());
+				queue.jobs.pop_back();
+			} else {
+				job = std::move(queue.jobs.front());
+				queue.jobs.pop_front();
+			}
+
+			numSpawned--;
+
+			return true;
+		}
+
+		return false;
+	}
+
+	bool takeInjected(function<void()>& job) {
+
+		if (numInjected <= 0) {
+			return false;
+		}
+
+		lock_guard<mutex> lock(mtx_injected);
+
+		if (injected.empty()) {
+			return false;
+		}
+
+		job = std::move(injected.front());
+		injected.pop_front();
+		priorities.pop_front();
+
+		numInjected--;
+
+		return true;
+	}
+
+	void workerLoop(int64_t index) {
+
+		while (true) {
+
+			function<void()> job;
+
+			if (takeSpawned(index, job) || takeInjected(job)) {
+				job();
+				continue;
+			}
+
+			unique_lock<mutex> lock(mtx_sleep);
+
+			cv_sleep.wait(lock, [this]() {
+				return numSpawned > 0 || numInjected > 0 || stopping;
+			});
+
+			if (stopping && numSpawned <= 0 && numInjected <= 0) {
+				break;
+			}
+		}
+
+	}
+
+};
+
+// A set of jobs that can be waited for. Jobs may run further groups, e.g. recursively.
+// Without a scheduler, jobs run right away on the calling thread.
+class TaskGroup {
+public:
+
+	Scheduler* scheduler = nullptr;
+	atomic<int64_t> numPending = 0;
+
+	TaskGroup(Scheduler& scheduler) {
+		this->scheduler = &scheduler;
+	}
+
+	TaskGroup(Scheduler* scheduler) {
+		this->scheduler = scheduler;
+	}
+
+	~TaskGroup() {
+		wait();
+	}
+
+	void run(function<void()> job) {
+
+		if (scheduler == nullptr) {
+			job();
+
+			return;
+		}
+
+		numPending++;
+
+		// the group may be gone right after numPending reaches 0, so don't touch <this> after that
+		scheduler->spawn([this, scheduler = this->scheduler, job = std::move(job)]() {
+			job();
+
+			if (--numPending == 0) {
+				scheduler->wakeAll();
+			}
+		});
+	}
+
+	void wait() {
+
+		if (scheduler == nullptr) {
+			return;
+		}
+
+		scheduler->waitUntil([this]() {
+			return numPending == 0;
+		});
+	}
+
+};
+
+// Calls <f(i)> for i in [begin, end), in blocks of <grainSize>, on the scheduler of the calling worker,
+// or on Scheduler::global() if not called from a worker.
+template<class F>
+void parallelFor(int64_t begin, int64_t end, int64_t grainSize, F f) {
+	Scheduler* scheduler = Scheduler::current();
+
+	if (scheduler == nullptr) {
+		scheduler = &Scheduler::global();
+	}
+
+	if (scheduler->numThreads() == 1 || end - begin <= grainSize) {
+		for (int64_t i = begin; i < end; i++) {
+			f(i);
+		}
+
+		return;
+	}
+
+	TaskGroup group(*scheduler);
+
+	for (int64_t blockStart = begin; blockStart < end; blockStart += grainSize) {
+		const int64_t blockEnd = std::min(blockStart + grainSize, end);
+
+		group.run([blockStart, blockEnd, &f]() {
+			for (int64_t i = blockStart; i < blockEnd; i++) {
+				f(i);
+			}
+		});
+	}
+
+	group.wait();
+}
+
+// Merge sort that splits the range into jobs of the calling worker's scheduler, see parallelFor.
+template<class It, class Compare>
+void parallelSort(It first, It last, Compare compare, int64_t grainSize = 32'768) {
+	Scheduler* scheduler = Scheduler::current();
+
+	if (scheduler == nullptr) {
+		scheduler = &Scheduler::global();
+	}
+
+	const int64_t n = last - first;
+
+	if (scheduler->numThreads() == 1 || n <= grainSize) {
+		std::sort(first, last, compare);
+
+		return;
+	}
+
+	const It mid = first + n / 2;
+
+	TaskGroup group(*scheduler);
+
+	group.run([first, mid, &compare, grainSize]() {
+		parallelSort(first, mid, compare, grainSize);
+	});
+
+	parallelSort(mid, last, compare, grainSize);
+
+	group.wait();
+
+	std::inplace_merge(first, mid, last, compare);
+}
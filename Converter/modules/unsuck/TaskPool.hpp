@@ -1,139 +1,150 @@
-
 #pragma once
 
-#include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
-#include <deque>
-#include <vector>
+#include <memory>
 #include <functional>
-#include <atomic>
+#include <deque>
+#include <algorithm>
+
+#include "Scheduler.hpp"
 
 //using namespace std;
 
-using std::thread;
 using std::atomic;
 using std::mutex;
-using std::vector;
-using std::deque;
 using std::function;
 using std::lock_guard;
+using std::unique_lock;
+using std::condition_variable;
+using std::shared_ptr;
+using std::deque;
 
-// might be better off using https://github.com/progschj/ThreadPool
+// Processes tasks of one kind on the workers of Scheduler::global(), which all pools share.
+// At most <numThreads> tasks of a pool run at the same time, fewer if other pools keep the workers busy.
+// The processor may use TaskGroup, parallelFor or parallelSort for nested parallelism,
+// which runs on the same workers instead of on additional threads.
 template<class Task>
 class TaskPool {
 public:
 	size_t numThreads = 0;
-	deque<shared_ptr<Task>> tasks;
 	using TaskProcessorType = function<void(shared_ptr<Task>)>;
 	TaskProcessorType processor;
 
-	vector<thread> threads;
-
-	atomic<bool> isClosed = false;
-	atomic<int> busyThreads = 0;
+	Scheduler& scheduler;
 
-	mutex mtx_task;
-
-	TaskPool(size_t numThreads, TaskProcessorType processor) {
-		this->numThreads = numThreads;
-		this->processor = processor;
+	// tasks that were added and are not processed yet. Guarded by mtx_done, like everything below.
+	int64_t numUnfinished = 0;
 
-		for (int i = 0; i < numThreads; i++) {
+	// tasks that no worker took yet, and their priorities, in descending order of priority
+	deque<shared_ptr<Task>> pending;
+	deque<double> priorities;
 
-			threads.emplace_back([this]() {
+	// jobs on the scheduler that take tasks from <pending>
+	size_t numRunners = 0;
 
-				while (true) {
+	bool isClosed = false;
 
-					shared_ptr<Task> task = nullptr;
+	mutex mtx_done;
+	condition_variable cv_done;
 
-					{ // retrieve task or leave thread if done
-						lock_guard<mutex> lock(mtx_task);
+	TaskPool(size_t numThreads, TaskProcessorType processor)
+		: scheduler(Scheduler::global()) {
+		this->numThreads = std::max(numThreads, size_t(1));
+		this->processor = processor;
+	}
 
-						const bool allDone = tasks.size() == 0 && isClosed;
-						const bool waitingForWork = tasks.size() == 0 && !allDone;
-						const bool workAvailable = tasks.size() > 0;
+	~TaskPool() {
+		this->close();
+	}
 
-						if (allDone) {
-							break;
-						} else if (workAvailable) {
-							task = tasks.front();
-							tasks.pop_front();
+	void addTask(shared_ptr<Task> t) {
+		addTask(t, 0.0);
+	}
 
-							if (task != nullptr) {
-								busyThreads++;
-							}
-						}
+	// tasks with higher priority are processed first. Tasks with the same priority in the order they were added.
+	void addTask(shared_ptr<Task> t, double priority) {
+		bool startRunner = false;
 
+		{
+			lock_guard<mutex> lock(mtx_done);
 
-					}
+			const auto it = std::upper_bound(priorities.begin(), priorities.end(), priority, std::greater<double>());
+			const auto index = it - priorities.begin();
 
-					if (task != nullptr) {
-						this->processor(task);
-						busyThreads--;
-					}
+			priorities.insert(it, priority);
+			pending.insert(pending.begin() + index, t);
 
-					std::this_thread::sleep_for(std::chrono::milliseconds(10));
-				}
+			numUnfinished++;
 
-			});
+			if (numRunners < numThreads) {
+				numRunners++;
+				startRunner = true;
+			}
 		}
 
+		if (startRunner) {
+			scheduler.inject([this]() {
+				run();
+			}, priority);
+		}
 	}
 
-	~TaskPool() {
-		this->close();
-	}
-
-	void addTask(shared_ptr<Task> t) {
-		lock_guard<mutex> lock(mtx_task);
-
-		tasks.push_back(t);
-	}
-
+	// processes all remaining tasks. The workers keep running for other pools.
 	void close() {
-		if (isClosed) {
-			return;
-		}
+		{
+			lock_guard<mutex> lock(mtx_done);
 
-		isClosed = true;
+			if (isClosed) {
+				return;
+			}
 
-		for (thread& t : threads) {
-			t.join();
+			isClosed = true;
 		}
+
+		waitTillEmpty();
 	}
 
 	bool isWorkDone() {
+		lock_guard<mutex> lock(mtx_done);
 
-		lock_guard<mutex> lock(mtx_task);
-
-		bool noTasksLeft = tasks.size() == 0;
-		bool noTasksInProcess = busyThreads == 0;
-
-		return noTasksLeft && noTasksInProcess;
+		return numUnfinished == 0;
 	}
 
+	// blocks until all tasks that were added so far are processed, and no job of the pool runs anymore
 	void waitTillEmpty() {
+		unique_lock<mutex> lock(mtx_done);
 
-		while (true) {
+		cv_done.wait(lock, [this]() {
+			return numUnfinished == 0 && numRunners == 0;
+		});
+	}
 
-			size_t size = 0;
+private:
 
-			{
-				lock_guard<mutex> lock(mtx_task);
+	// Takes tasks until none are left. The pool may be destroyed as soon as the last runner
+	// released mtx_done, so nothing is touched after that.
+	void run() {
+		unique_lock<mutex> lock(mtx_done);
 
-				size = tasks.size();
-			}
+		while (!pending.empty()) {
+			shared_ptr<Task> task = pending.front();
+			pending.pop_front();
+			priorities.pop_front();
 
-			if (size == 0) {
-				return;
-			} else {
-				std::this_thread::sleep_for(std::chrono::milliseconds(10));
-			}
+			lock.unlock();
+			processor(task);
+			lock.lock();
 
+			numUnfinished--;
 		}
 
+		numRunners--;
+
+		if (numRunners == 0) {
+			cv_done.notify_all();
+		}
 	}
 
 };
-
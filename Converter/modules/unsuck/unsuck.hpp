@@ -68,6 +68,65 @@ CpuData getCpuData();
 
 void launchMemoryChecker(double checkInterval);
 
+// read-only memory mapping of an entire file
+struct MappedFile {
+
+	uint8_t* data = nullptr;
+	int64_t size = 0;
+
+	// platform specific handles
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+
+	MappedFile(string path);
+
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool isOpen() {
+		return data != nullptr;
+	}
+
+};
+
+// File for positional reads and writes, i.e. pread/pwrite.
+// Safe to use from multiple threads as long as they access disjoint ranges.
+struct PositionalFile {
+
+	string path = "";
+
+	// platform specific handle
+	void* handle = nullptr;
+
+	// opens or creates the file for reading and writing. existing content is discarded if <truncate> is set.
+	PositionalFile(string path, bool truncate);
+
+	~PositionalFile();
+
+	PositionalFile(const PositionalFile&) = delete;
+	PositionalFile& operator=(const PositionalFile&) = delete;
+
+	bool isOpen() {
+		return handle != nullptr;
+	}
+
+	void write(const void* data, int64_t size, int64_t offset);
+
+	void read(void* data, int64_t size, int64_t offset);
+
+	// allocates disk space for the first <size> bytes, so that later writes don't have to grow the file
+	void reserve(int64_t size);
+
+	// file descriptor on linux, HANDLE on windows
+	intptr_t nativeHandle();
+
+	// blocks until all written data reached the device
+	void flush();
+
+};
+
 class punct_facet : public std::numpunct<char> {
 protected:
 	char do_decimal_point() const override { return '.'; };
@@ -104,10 +163,22 @@ struct Buffer {
 	int64_t size = 0;
 	int64_t pos = 0;
 
+	// set for slices. keeps the memory of the buffer that is sliced alive.
+	shared_ptr<Buffer> parent = nullptr;
+
 	Buffer() {
 
 	}
 
+	// a view of <size> bytes of <parent>, starting at <offset>. Doesn't copy or allocate.
+	Buffer(shared_ptr<Buffer> parent, int64_t offset, int64_t size) {
+		this->parent = parent;
+
+		setData(parent->data_u8 + offset);
+
+		this->size = size;
+	}
+
 	Buffer(int64_t size) {
 		data = malloc(size);
 
@@ -137,6 +208,20 @@ struct Buffer {
 			exit(4312);
 		}
 
+		setData(data);
+
+		this->size = size;
+	}
+
+	~Buffer() {
+		if (parent == nullptr) {
+			free(data);
+		}
+	}
+
+	void setData(void* data) {
+		this->data = data;
+
 		data_u8 = reinterpret_cast<uint8_t*>(data);
 		data_u16 = reinterpret_cast<uint16_t*>(data);
 		data_u32 = reinterpret_cast<uint32_t*>(data);
@@ -148,12 +233,6 @@ struct Buffer {
 		data_f32 = reinterpret_cast<float*>(data);
 		data_f64 = reinterpret_cast<double*>(data);
 		data_char = reinterpret_cast<char*>(data);
-
-		this->size = size;
-	}
-
-	~Buffer() {
-		free(data);
 	}
 
 	template<class T>
@@ -64,6 +64,124 @@ void launchMemoryChecker(double checkInterval) {
 }
 #endif // _DEBUG
 
+MappedFile::MappedFile(string path) {
+
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE) {
+		return;
+	}
+
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(file, &fileSize);
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+	if (mapping == nullptr) {
+		CloseHandle(file);
+		return;
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+	if (view == nullptr) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return;
+	}
+
+	this->data = reinterpret_cast<uint8_t*>(view);
+	this->size = fileSize.QuadPart;
+	this->fileHandle = file;
+	this->mappingHandle = mapping;
+}
+
+MappedFile::~MappedFile() {
+	if (data != nullptr) {
+		UnmapViewOfFile(data);
+		CloseHandle(mappingHandle);
+		CloseHandle(fileHandle);
+	}
+}
+
+PositionalFile::PositionalFile(string path, bool truncate) {
+	this->path = path;
+
+	const DWORD disposition = truncate ? CREATE_ALWAYS : OPEN_ALWAYS;
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, disposition, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE) {
+		return;
+	}
+
+	this->handle = file;
+}
+
+PositionalFile::~PositionalFile() {
+	if (handle != nullptr) {
+		CloseHandle(handle);
+	}
+}
+
+void PositionalFile::write(const void* data, int64_t size, int64_t offset) {
+
+	const uint8_t* source = reinterpret_cast<const uint8_t*>(data);
+
+	while (size > 0) {
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = DWORD(offset & 0xFFFF'FFFF);
+		overlapped.OffsetHigh = DWORD(offset >> 32);
+
+		const DWORD chunk = DWORD(std::min(size, int64_t(1) << 30));
+		DWORD written = 0;
+		if (!WriteFile(handle, source, chunk, &written, &overlapped) || written == 0) {
+			cout << "ERROR: failed to write to " << path << endl;
+			exit(123);
+		}
+
+		source += written;
+		offset += written;
+		size -= written;
+	}
+}
+
+void PositionalFile::read(void* data, int64_t size, int64_t offset) {
+
+	uint8_t* target = reinterpret_cast<uint8_t*>(data);
+
+	while (size > 0) {
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = DWORD(offset & 0xFFFF'FFFF);
+		overlapped.OffsetHigh = DWORD(offset >> 32);
+
+		const DWORD chunk = DWORD(std::min(size, int64_t(1) << 30));
+		DWORD numRead = 0;
+		if (!ReadFile(handle, target, chunk, &numRead, &overlapped) || numRead == 0) {
+			cout << "ERROR: failed to read from " << path << endl;
+			exit(123);
+		}
+
+		target += numRead;
+		offset += numRead;
+		size -= numRead;
+	}
+}
+
+intptr_t PositionalFile::nativeHandle() {
+	return reinterpret_cast<intptr_t>(handle);
+}
+
+void PositionalFile::reserve(int64_t size) {
+	FILE_ALLOCATION_INFO info = {};
+	info.AllocationSize.QuadPart = size;
+
+	SetFileInformationByHandle(handle, FileAllocationInfo, &info, sizeof(info));
+}
+
+void PositionalFile::flush() {
+	FlushFileBuffers(handle);
+}
+
 static ULARGE_INTEGER lastCPU, lastSysCPU, lastUserCPU;
 static int numProcessors;
 static HANDLE self;
@@ -121,6 +239,11 @@ CpuData getCpuData() {
 
 #include "sys/types.h"
 #include "sys/sysinfo.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+#include "fcntl.h"
+#include "unistd.h"
+#include "errno.h"
 
 #include "stdlib.h"
 #include "stdio.h"
@@ -247,6 +370,125 @@ void launchMemoryChecker(double checkInterval) {
 }
 #endif // _DEBUG
 
+MappedFile::MappedFile(string path) {
+
+	const int fd = open(path.c_str(), O_RDONLY);
+
+	if (fd < 0) {
+		return;
+	}
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+		close(fd);
+		return;
+	}
+
+	void* mapped = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	// the mapping stays valid after the descriptor is closed
+	close(fd);
+
+	if (mapped == MAP_FAILED) {
+		return;
+	}
+
+	posix_madvise(mapped, fileStat.st_size, POSIX_MADV_SEQUENTIAL);
+
+	this->data = reinterpret_cast<uint8_t*>(mapped);
+	this->size = fileStat.st_size;
+}
+
+MappedFile::~MappedFile() {
+	if (data != nullptr) {
+		munmap(data, size);
+	}
+}
+
+PositionalFile::PositionalFile(string path, bool truncate) {
+	this->path = path;
+
+	const int flags = O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0);
+	const int fd = open(path.c_str(), flags, 0644);
+
+	if (fd < 0) {
+		return;
+	}
+
+	// the descriptor is stored in the handle, offset by one so that descriptor 0 isn't mistaken for a closed file
+	this->handle = reinterpret_cast<void*>(intptr_t(fd) + 1);
+}
+
+static int descriptorOf(void* handle) {
+	return int(reinterpret_cast<intptr_t>(handle) - 1);
+}
+
+PositionalFile::~PositionalFile() {
+	if (handle != nullptr) {
+		close(descriptorOf(handle));
+	}
+}
+
+void PositionalFile::write(const void* data, int64_t size, int64_t offset) {
+
+	const uint8_t* source = reinterpret_cast<const uint8_t*>(data);
+	const int fd = descriptorOf(handle);
+
+	while (size > 0) {
+		const ssize_t written = pwrite(fd, source, size, offset);
+
+		if (written <= 0) {
+			cout << "ERROR: failed to write to " << path << ": " << strerror(errno) << endl;
+			exit(123);
+		}
+
+		source += written;
+		offset += written;
+		size -= written;
+	}
+}
+
+void PositionalFile::read(void* data, int64_t size, int64_t offset) {
+
+	uint8_t* target = reinterpret_cast<uint8_t*>(data);
+	const int fd = descriptorOf(handle);
+
+	while (size > 0) {
+		const ssize_t numRead = pread(fd, target, size, offset);
+
+		if (numRead <= 0) {
+			cout << "ERROR: failed to read from " << path << ": " << strerror(errno) << endl;
+			exit(123);
+		}
+
+		target += numRead;
+		offset += numRead;
+		size -= numRead;
+	}
+}
+
+intptr_t PositionalFile::nativeHandle() {
+	return descriptorOf(handle);
+}
+
+void PositionalFile::reserve(int64_t size) {
+	const int fd = descriptorOf(handle);
+
+	// not all file systems support fallocate. Growing the file still avoids size updates on every write.
+	if (posix_fallocate(fd, 0, size) != 0) {
+		struct stat fileStat;
+		fstat(fd, &fileStat);
+
+		if (fileStat.st_size < size) {
+			ftruncate(fd, size);
+		}
+	}
+}
+
+void PositionalFile::flush() {
+	fdatasync(descriptorOf(handle));
+}
+
 static int numProcessors;
 static bool initialized = false;
 static unsigned long long lastTotalUser, lastTotalUserLow, lastTotalSys, lastTotalIdle;
@@ -306,4 +548,4 @@ CpuData getCpuData() {
 }
 
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -0,0 +1,466 @@
+#include <thread>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <unordered_map>
+#include <atomic>
+
+#include "AsyncIO.h"
+#include "logger.h"
+
+using std::thread;
+using std::mutex;
+using std::lock_guard;
+using std::unique_lock;
+using std::condition_variable;
+using std::deque;
+using std::unordered_map;
+using std::make_shared;
+
+// Portable fallback. A pool of threads that issue blocking positional writes.
+struct ThreadPoolBackend : public AsyncIOBackend {
+
+	int64_t queueDepth = 0;
+
+	mutex mtx;
+	condition_variable cv_work;
+	condition_variable cv_done;
+	deque<AsyncWrite> queue;
+	// queued and currently written
+	int64_t numPending = 0;
+	bool closeRequested = false;
+
+	vector<thread> threads;
+
+	ThreadPoolBackend(int64_t queueDepth) {
+		this->queueDepth = queueDepth;
+
+		const int64_t numThreads = std::clamp(queueDepth, int64_t(1), int64_t(getCpuData().numProcessors));
+
+		for (int64_t i = 0; i < numThreads; i++) {
+			threads.emplace_back([this]() {
+				run();
+			});
+		}
+	}
+
+	~ThreadPoolBackend() {
+		{
+			lock_guard<mutex> lock(mtx);
+			closeRequested = true;
+		}
+
+		cv_work.notify_all();
+
+		for (auto& t : threads) {
+			t.join();
+		}
+	}
+
+	string name() override {
+		return "threads";
+	}
+
+	void run() {
+		while (true) {
+			AsyncWrite write;
+
+			{
+				unique_lock<mutex> lock(mtx);
+
+				cv_work.wait(lock, [this]() {
+					return !queue.empty() || closeRequested;
+				});
+
+				if (queue.empty()) {
+					return;
+				}
+
+				write = queue.front();
+				queue.pop_front();
+			}
+
+			write.file->write(write.buffer->data, write.size, write.offset);
+
+			if (write.onComplete) {
+				write.onComplete(write.buffer);
+			}
+
+			{
+				lock_guard<mutex> lock(mtx);
+				numPending--;
+			}
+
+			cv_done.notify_all();
+		}
+	}
+
+	void submit(AsyncWrite write) override {
+		{
+			unique_lock<mutex> lock(mtx);
+
+			cv_done.wait(lock, [this]() {
+				return numPending < queueDepth;
+			});
+
+			queue.push_back(write);
+			numPending++;
+		}
+
+		cv_work.notify_one();
+	}
+
+	void drain() override {
+		unique_lock<mutex> lock(mtx);
+
+		cv_done.wait(lock, [this]() {
+			return numPending == 0;
+		});
+	}
+
+};
+
+#if defined(__linux__)
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+// Talks to io_uring through the raw system calls, so that no additional library is required.
+// Writes are submitted by the calling threads, a dedicated thread reaps the completions.
+struct UringBackend : public AsyncIOBackend {
+
+	// user_data of the request that wakes up the completion thread for shutdown
+	static constexpr uint64_t wakeupTag = ~uint64_t(0);
+
+	int64_t queueDepth = 0;
+	int ringFd = -1;
+
+	// submission queue
+	void* sqRing = nullptr;
+	size_t sqRingSize = 0;
+	std::atomic<uint32_t>* sqHead = nullptr;
+	std::atomic<uint32_t>* sqTail = nullptr;
+	uint32_t sqMask = 0;
+	uint32_t* sqArray = nullptr;
+	io_uring_sqe* sqes = nullptr;
+	size_t sqesSize = 0;
+
+	// completion queue
+	void* cqRing = nullptr;
+	size_t cqRingSize = 0;
+	std::atomic<uint32_t>* cqHead = nullptr;
+	std::atomic<uint32_t>* cqTail = nullptr;
+	uint32_t cqMask = 0;
+	io_uring_cqe* cqes = nullptr;
+
+	mutex mtx;
+	condition_variable cv_slots;
+	// writes in flight, indexed by user_data
+	vector<AsyncWrite> slots;
+	vector<int64_t> freeSlots;
+
+	// registered buffer index by buffer address
+	unordered_map<const void*, int64_t> registered;
+
+	thread completionThread;
+
+	static int setup(unsigned entries, io_uring_params* params) {
+		return int(syscall(__NR_io_uring_setup, entries, params));
+	}
+
+	static int enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+		return int(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+	}
+
+	static int registerOp(int fd, unsigned opcode, void* arg, unsigned numArgs) {
+		return int(syscall(__NR_io_uring_register, fd, opcode, arg, numArgs));
+	}
+
+	// IORING_OP_WRITE only exists since linux 5.6, older kernels fail each write with -EINVAL.
+	// Probing was added in the same release, so a kernel that can't be probed can't write either.
+	static bool supportsWrites(int fd) {
+		constexpr unsigned numOps = 256;
+		vector<uint8_t> memory(sizeof(io_uring_probe) + numOps * sizeof(io_uring_probe_op), 0);
+		io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(memory.data());
+
+		if (registerOp(fd, IORING_REGISTER_PROBE, probe, numOps) < 0) {
+			return false;
+		}
+
+		const auto supported = [probe](unsigned opcode) {
+			return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) != 0;
+		};
+
+		return supported(IORING_OP_WRITE) && supported(IORING_OP_WRITE_FIXED) && supported(IORING_OP_NOP);
+	}
+
+	UringBackend(int64_t queueDepth) {
+		this->queueDepth = queueDepth;
+
+		io_uring_params params = {};
+		ringFd = setup(unsigned(queueDepth + 1), &params);
+
+		if (ringFd < 0) {
+			return;
+		}
+
+		if (!supportsWrites(ringFd)) {
+			close(ringFd);
+			ringFd = -1;
+
+			return;
+		}
+
+		sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+		cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+		const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (singleMap) {
+			sqRingSize = std::max(sqRingSize, cqRingSize);
+			cqRingSize = sqRingSize;
+		}
+
+		sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+		cqRing = singleMap ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+		void* mappedSqes = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+
+		if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || mappedSqes == MAP_FAILED) {
+			close(ringFd);
+			ringFd = -1;
+
+			return;
+		}
+
+		uint8_t* sq = reinterpret_cast<uint8_t*>(sqRing);
+		sqHead = reinterpret_cast<std::atomic<uint32_t>*>(sq + params.sq_off.head);
+		sqTail = reinterpret_cast<std::atomic<uint32_t>*>(sq + params.sq_off.tail);
+		sqMask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+		sqArray = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+		sqes = reinterpret_cast<io_uring_sqe*>(mappedSqes);
+
+		uint8_t* cq = reinterpret_cast<uint8_t*>(cqRing);
+		cqHead = reinterpret_cast<std::atomic<uint32_t>*>(cq + params.cq_off.head);
+		cqTail = reinterpret_cast<std::atomic<uint32_t>*>(cq + params.cq_off.tail);
+		cqMask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+		slots.resize(queueDepth);
+		for (int64_t i = queueDepth - 1; i >= 0; i--) {
+			freeSlots.push_back(i);
+		}
+
+		completionThread = thread([this]() {
+			reap();
+		});
+	}
+
+	~UringBackend() {
+		if (ringFd < 0) {
+			return;
+		}
+
+		drain();
+
+		{ // a no-op request with the wakeup tag ends the completion thread
+			lock_guard<mutex> lock(mtx);
+
+			io_uring_sqe sqe = {};
+			sqe.opcode = IORING_OP_NOP;
+			sqe.user_data = wakeupTag;
+
+			push(sqe);
+		}
+
+		completionThread.join();
+
+		munmap(sqes, sqesSize);
+		if (cqRing != sqRing) {
+			munmap(cqRing, cqRingSize);
+		}
+		munmap(sqRing, sqRingSize);
+		close(ringFd);
+	}
+
+	bool isValid() {
+		return ringFd >= 0;
+	}
+
+	string name() override {
+		return "io_uring";
+	}
+
+	void registerBuffers(const vector<shared_ptr<Buffer>>& buffers) override {
+		lock_guard<mutex> lock(mtx);
+
+		if (!registered.empty()) {
+			registerOp(ringFd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+			registered.clear();
+		}
+
+		vector<iovec> iovecs;
+		for (auto& buffer : buffers) {
+			iovecs.push_back({ buffer->data, size_t(buffer->size) });
+		}
+
+		// pinning may fail, e.g. due to RLIMIT_MEMLOCK. Plain writes work regardless.
+		if (registerOp(ringFd, IORING_REGISTER_BUFFERS, iovecs.data(), unsigned(iovecs.size())) == 0) {
+			for (size_t i = 0; i < buffers.size(); i++) {
+				registered[buffers[i]->data] = int64_t(i);
+			}
+		}
+	}
+
+	// adds an entry to the submission queue and submits it. Caller must hold mtx.
+	void push(const io_uring_sqe& sqe) {
+		const uint32_t tail = sqTail->load(std::memory_order_relaxed);
+		const uint32_t index = tail & sqMask;
+
+		sqes[index] = sqe;
+		sqArray[index] = index;
+
+		sqTail->store(tail + 1, std::memory_order_release);
+
+		while (enter(ringFd, 1, 0, 0) < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY)) {
+
+		}
+	}
+
+	// queues the not yet written part of the write in <slot>. Caller must hold mtx.
+	void pushWrite(int64_t slot, int64_t written) {
+		const AsyncWrite& write = slots[slot];
+
+		const uint8_t* data = write.buffer->data_u8 + written;
+		const int64_t size = std::min(write.size - written, int64_t(1) << 30);
+
+		io_uring_sqe sqe = {};
+		sqe.fd = int(write.file->nativeHandle());
+		sqe.off = uint64_t(write.offset + written);
+		sqe.addr = uint64_t(reinterpret_cast<uintptr_t>(data));
+		sqe.len = uint32_t(size);
+		sqe.user_data = (uint64_t(slot) << 40) | uint64_t(written);
+
+		auto it = registered.find(write.buffer->data);
+		if (it != registered.end()) {
+			sqe.opcode = IORING_OP_WRITE_FIXED;
+			sqe.buf_index = uint16_t(it->second);
+		} else {
+			sqe.opcode = IORING_OP_WRITE;
+		}
+
+		push(sqe);
+	}
+
+	void submit(AsyncWrite write) override {
+		unique_lock<mutex> lock(mtx);
+
+		cv_slots.wait(lock, [this]() {
+			return !freeSlots.empty();
+		});
+
+		const int64_t slot = freeSlots.back();
+		freeSlots.pop_back();
+
+		slots[slot] = write;
+
+		pushWrite(slot, 0);
+	}
+
+	void reap() {
+		while (true) {
+
+			if (enter(ringFd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+				logger::ERROR("io_uring_enter failed: " + string(strerror(errno)));
+				exit(123);
+			}
+
+			uint32_t head = cqHead->load(std::memory_order_relaxed);
+			const uint32_t tail = cqTail->load(std::memory_order_acquire);
+
+			while (head != tail) {
+				const io_uring_cqe cqe = cqes[head & cqMask];
+				head++;
+				cqHead->store(head, std::memory_order_release);
+
+				if (cqe.user_data == wakeupTag) {
+					return;
+				}
+
+				const int64_t slot = int64_t(cqe.user_data >> 40);
+				const int64_t previouslyWritten = int64_t(cqe.user_data & ((uint64_t(1) << 40) - 1));
+
+				if (cqe.res <= 0) {
+					logger::ERROR("failed to write to " + slots[slot].file->path + ": " + string(strerror(-cqe.res)));
+					exit(123);
+				}
+
+				const int64_t written = previouslyWritten + cqe.res;
+
+				if (written < slots[slot].size) {
+					// short or split write, queue the remainder
+					lock_guard<mutex> lock(mtx);
+					pushWrite(slot, written);
+
+					continue;
+				}
+
+				AsyncWrite write = slots[slot];
+
+				if (write.onComplete) {
+					write.onComplete(write.buffer);
+				}
+
+				{
+					lock_guard<mutex> lock(mtx);
+
+					slots[slot] = AsyncWrite();
+					freeSlots.push_back(slot);
+				}
+
+				cv_slots.notify_all();
+			}
+		}
+	}
+
+	void drain() override {
+		unique_lock<mutex> lock(mtx);
+
+		cv_slots.wait(lock, [this]() {
+			return int64_t(freeSlots.size()) == queueDepth;
+		});
+	}
+
+};
+
+#endif
+
+shared_ptr<AsyncIOBackend> createAsyncIOBackend(string type, int64_t queueDepth) {
+
+	queueDepth = std::clamp(queueDepth, int64_t(1), int64_t(4096));
+
+#if defined(__linux__)
+	if (type == "uring" || type == "auto") {
+		auto backend = make_shared<UringBackend>(queueDepth);
+
+		if (backend->isValid()) {
+			return backend;
+		}
+
+		if (type == "uring") {
+			logger::WARN("io_uring is not available, falling back to a thread pool for writes");
+		}
+	}
+#else
+	if (type == "uring") {
+		logger::WARN("io_uring is only available on linux, falling back to a thread pool for writes");
+	}
+#endif
+
+	return make_shared<ThreadPoolBackend>(queueDepth);
+}
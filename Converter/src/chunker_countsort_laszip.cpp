@@ -1,10 +1,13 @@
 #include <iostream>
 #include <filesystem>
 #include <unordered_map>
+#include <unordered_set>
 #include <thread>
 #include <mutex>
 #include <memory>
 #include <atomic>
+#include <algorithm>
+#include <limits>
 
 #include "chunker_countsort_laszip.h"
 
@@ -14,10 +17,16 @@
 #include "unsuck/TaskPool.hpp"
 #include "Vector3.h"
 #include "ConcurrentWriter.h"
+#include "AttributeTranscoder.h"
+#include "SparseGrid.h"
+#include "ChunkArena.h"
+#include "SealedChunks.h"
+#include "XYZHashSet.h"
 
 #include "nlohmann/json.hpp"
 #include "laszip/laszip_api.h"
 #include "LasLoader/LasLoader.h"
+#include "LasLoader/LasReader.h"
 #include "PotreeConverter.h"
 #include "logger.h"
 
@@ -26,6 +35,7 @@ using json = nlohmann::json;
 using std::cout;
 using std::endl;
 using std::unordered_map;
+using std::unordered_set;
 using std::thread;
 using std::mutex;
 using std::lock_guard;
@@ -33,6 +43,7 @@ using std::make_shared;
 using std::shared_ptr;
 using std::unique_ptr;
 using std::atomic_int32_t;
+using std::atomic_int64_t;
 
 namespace fs = std::filesystem;
 
@@ -47,6 +58,34 @@ namespace chunker_countsort_laszip {
 	int gridSize = 128;
 	mutex mtx_attributes;
 
+	// fraction of points that the counting pass looks at, see --count-sample
+	double countSample = 1.0;
+	// points per sampled range. rounded up to whole LAZ chunks for compressed files
+	constexpr int64_t sampleRangeSize = 50'000;
+	// sampled counts are estimates, so chunks are planned this much smaller than maxPointsPerChunk
+	constexpr double sampledChunkMargin = 0.25;
+
+	// see --io-backend and --io-queue-depth
+	string ioBackend = "auto";
+	int64_t ioQueueDepth = 64;
+
+	// chunks are handed to the indexer through chunkMemory instead of the arena file, see --memory-budget
+	bool chunksInMemory = false;
+
+	// positions are snapped to a grid of this spacing and one point per cell is kept while distributing, see --dedup.
+	// 0 only merges identical positions, < 0 keeps all points.
+	double dedupCellSize = -1.0;
+	// memory for the positions that chunks received so far. Beyond it, duplicates are only detected within recent batches.
+	constexpr int64_t dedupMaxBytes = 1'024 * 1024 * 1024;
+
+	// receives chunks as soon as they are complete, if the indexer runs concurrently
+	shared_ptr<SealedChunks> sealedChunks = nullptr;
+
+	// paths of sources with points outside the bounding box in their header, found while counting.
+	// Early sealing can't rely on the header box of these sources.
+	mutex mtx_exceedingSources;
+	unordered_set<string> sourcesExceedingHeaderBox;
+
 	struct Point {
 		double x;
 		double y;
@@ -56,18 +95,22 @@ namespace chunker_countsort_laszip {
 	unordered_map<int, vector<vector<Point>>> buckets;
 
 	ConcurrentWriter* writer = nullptr;
+	// holds the points of all chunks, see ChunkArena
+	ChunkArena* arena = nullptr;
 
 	struct Node {
 
 		string id = "";
 		int64_t level = 0;
+		// morton code of the node at its level
+		uint64_t key = 0;
 		int64_t x = 0;
 		int64_t y = 0;
 		int64_t z = 0;
 		int64_t size;
 		int64_t numPoints;
 
-		Node(string id, int numPoints) {
+		Node(string id, int64_t numPoints) {
 			this->id = id;
 			this->numPoints = numPoints;
 		}
@@ -75,56 +118,604 @@ namespace chunker_countsort_laszip {
 
 	vector<Node> nodes;
 
-	string toNodeID(int level, int gridSize, int64_t x, int64_t y, int64_t z) {
+	// the octal digits of a morton key (see SparseGrid::key) are the child indices along the path from the root
+	string toNodeID(int64_t level, uint64_t key) {
 
 		string id = "r";
 
-		int currentGridSize = gridSize;
-		int lx = x;
-		int ly = y;
-		int lz = z;
+		for (int64_t i = level - 1; i >= 0; i--) {
+			const int64_t index = (key >> (3 * i)) & 0b111;
+
+			id = id + to_string(index);
+		}
+
+		return id;
+	}
+
+	// grid contains index of node in nodes, or -1 for cells outside of all nodes
+	struct NodeLUT {
+		int64_t gridSize;
+		SparseGrid<int32_t> grid;
+	};
+
+	// points that laszip had to decompress just to reach the first point of a task
+	atomic_int64_t seekWastedPoints = 0;
+	// same, as it would have been with fixed-size tasks that ignore the compressed chunks
+	atomic_int64_t seekWastedPointsFixedSplit = 0;
+	// compressed sources with variable-sized chunks, which neither of the above can account for
+	atomic_int64_t numVariableChunkSources = 0;
 
-		for (int i = 0; i < level; i++) {
+	constexpr int64_t fixedTaskSize = 1'000'000;
+
+	// An open laszip reader that is kept alive across tasks of the same file.
+	// Each thread owns one session. Tasks that continue where the previous one stopped don't need to seek,
+	// and switching between tasks of the same file doesn't re-parse the header and VLRs.
+	struct LaszipSession {
+
+		string path = "";
+		int64_t lazChunkSize = 0;
+		int64_t nextPoint = 0;
+
+		laszip_POINTER reader = nullptr;
+		laszip_header* header = nullptr;
+		laszip_point* point = nullptr;
+
+		~LaszipSession() {
+			close();
+		}
 
-			int index = 0;
+		void open(const string& path, int64_t lazChunkSize) {
 
-			if (lx >= currentGridSize / 2) {
-				index = index + 0b100;
-				lx = lx - currentGridSize / 2;
+			if (reader != nullptr && this->path == path) {
+				return;
 			}
 
-			if (ly >= currentGridSize / 2) {
-				index = index + 0b010;
-				ly = ly - currentGridSize / 2;
+			close();
+
+			constexpr laszip_BOOL request_reader = 1;
+			laszip_BOOL is_compressed = iEndsWith(path, ".laz") ? 1 : 0;
+
+			laszip_create(&reader);
+			laszip_request_compatibility_mode(reader, request_reader);
+			laszip_open_reader(reader, path.c_str(), &is_compressed);
+			laszip_get_header_pointer(reader, &header);
+			laszip_get_point_pointer(reader, &point);
+
+			this->path = path;
+			this->lazChunkSize = lazChunkSize;
+			this->nextPoint = 0;
+		}
+
+		void close() {
+
+			if (reader == nullptr) {
+				return;
 			}
 
-			if (lz >= currentGridSize / 2) {
-				index = index + 0b001;
-				lz = lz - currentGridSize / 2;
+			laszip_close_reader(reader);
+			laszip_destroy(reader);
+
+			reader = nullptr;
+			header = nullptr;
+			point = nullptr;
+			path = "";
+		}
+
+		void seek(int64_t pointIndex) {
+
+			if (pointIndex == nextPoint) {
+				return;
 			}
 
-			id = id + to_string(index);
-			currentGridSize = currentGridSize / 2;
+			laszip_seek_point(reader, pointIndex);
+			nextPoint = pointIndex;
+
+			if (lazChunkSize > 0) {
+				seekWastedPoints += pointIndex % lazChunkSize;
+			}
 		}
 
-		return id;
+		void readPoint() {
+			laszip_read_point(reader);
+			nextPoint++;
+		}
+
+	};
+
+	// the reader session of the calling thread
+	LaszipSession& threadSession() {
+		thread_local LaszipSession session;
+
+		return session;
+	}
+
+	// positions the reader session of the calling thread at the first point of a task
+	LaszipSession& acquireSession(const string& path, int64_t lazChunkSize, int64_t firstPoint) {
+		auto& session = threadSession();
+
+		session.open(path, lazChunkSize);
+		session.seek(firstPoint);
+
+		return session;
 	}
 
-	template<class T>
-	double asDouble(uint8_t* data) {
-		T value = reinterpret_cast<T*>(data)[0];
+	struct PointRange {
+		int64_t first = 0;
+		int64_t count = 0;
+	};
+
+	// Splits the points of a file into tasks of about <targetSize> points.
+	// Boundaries of compressed files are aligned to LAZ chunks, so that every task starts
+	// exactly at a chunk and seeking doesn't decompress points that belong to another task.
+	vector<PointRange> splitIntoTasks(const LasHeader& header, int64_t targetSize) {
+
+		const int64_t chunkSize = header.lazChunkSize;
 
-		return double(value);
+		int64_t taskSize = targetSize;
+		if (chunkSize > 0) {
+			taskSize = std::max(targetSize / chunkSize, int64_t(1)) * chunkSize;
+		}
+
+		vector<PointRange> ranges;
+		for (int64_t first = 0; first < header.numPoints; first += taskSize) {
+			ranges.push_back({ first, std::min(taskSize, header.numPoints - first) });
+		}
+
+		return ranges;
 	}
 
+	// Adds what fixed-size tasks of <targetSize> points would have cost to seekWastedPointsFixedSplit.
+	// Only for <ranges> that laszip actually decodes, so that both seek-wasted statistics cover the same points.
+	void countFixedSplitWaste(const LasHeader& header, const vector<PointRange>& ranges, int64_t targetSize) {
+
+		const int64_t chunkSize = header.lazChunkSize;
+
+		if (chunkSize <= 0) {
+			return;
+		}
+
+		for (const auto& range : ranges) {
+			// first task boundary of the fixed split within the range. The first task of the file doesn't seek.
+			int64_t first = std::max(((range.first + targetSize - 1) / targetSize) * targetSize, targetSize);
+
+			for (; first < range.first + range.count; first += targetSize) {
+				seekWastedPointsFixedSplit += first % chunkSize;
+			}
+		}
+	}
+
+	// Picks an evenly spaced subset of <ranges> that covers about <fraction> of them, at least one range.
+	vector<PointRange> sampleRanges(const vector<PointRange>& ranges, double fraction) {
+
+		const int64_t step = std::max(int64_t(std::round(1.0 / fraction)), int64_t(1));
+
+		vector<PointRange> sampled;
+		for (int64_t i = step / 2; i < ranges.size(); i += step) {
+			sampled.push_back(ranges[i]);
+		}
+
+		if (sampled.empty() && !ranges.empty()) {
+			sampled.push_back(ranges[ranges.size() / 2]);
+		}
+
+		return sampled;
+	}
+
+	// stores a point decoded by laszip as a raw point record, so that compressed and uncompressed
+	// sources can be transcoded the same way. <record> must hold recordSize bytes.
+	void packLasRecord(const laszip_point* point, int format, uint8_t* record, int64_t recordSize) {
+
+		auto& base = *reinterpret_cast<LasRecord0*>(record);
+
+		base.X = point->X;
+		base.Y = point->Y;
+		base.Z = point->Z;
+		base.intensity = point->intensity;
+
+		if (!isExtendedLasFormat(format)) {
+			base.returnBits = (point->return_number << 0)
+				| (point->number_of_returns << 3)
+				| (point->scan_direction_flag << 6)
+				| (point->edge_of_flight_line << 7);
+			base.classificationBits = (point->classification << 0)
+				| (point->synthetic_flag << 5)
+				| (point->keypoint_flag << 6)
+				| (point->withheld_flag << 7);
+			base.scanAngleRank = point->scan_angle_rank;
+			base.userData = point->user_data;
+			base.pointSourceID = point->point_source_ID;
+		} else {
+			auto& extended = *reinterpret_cast<LasRecord6*>(record);
+
+			extended.returnBits = (point->extended_return_number << 0)
+				| (point->extended_number_of_returns << 4);
+			extended.flagBits = (point->extended_classification_flags << 0)
+				| (point->extended_scanner_channel << 4)
+				| (point->scan_direction_flag << 6)
+				| (point->edge_of_flight_line << 7);
+			extended.classification = point->extended_classification;
+			extended.userData = point->user_data;
+			extended.scanAngle = point->extended_scan_angle;
+			extended.pointSourceID = point->point_source_ID;
+		}
+
+		const auto layout = lasRecordLayout(format);
+
+		if (layout.gpsTime >= 0) {
+			memcpy(record + layout.gpsTime, &point->gps_time, 8);
+		}
+		if (layout.rgb >= 0) {
+			memcpy(record + layout.rgb, point->rgb, 6);
+		}
+		if (layout.nir >= 0) {
+			// laszip stores the near infrared channel after rgb
+			memcpy(record + layout.nir, &point->rgb[3], 2);
+		}
+		if (layout.wavePacket >= 0) {
+			memcpy(record + layout.wavePacket, point->wave_packet, 29);
+		}
+
+		const int64_t standardSize = lasRecordSize(format);
+		const int64_t numExtraBytes = std::min(int64_t(point->num_extra_bytes), recordSize - standardSize);
+		if (numExtraBytes > 0) {
+			memcpy(record + standardSize, point->extra_bytes, numExtraBytes);
+		}
+	}
+
+	// Decodes <numPoints> points, starting at <firstPoint>, into the output layout given by <attributes>.
+	// Uncompressed files are read from their mapping, everything else through the laszip session of the calling thread.
+	// min/max and histograms of <attributes> are extended by the decoded points.
+	void decodePoints(const string& path, int64_t lazChunkSize, LasReader* reader, int64_t firstPoint, int64_t numPoints, Attributes& inputAttributes, Attributes& attributes, uint8_t* data) {
+
+		const int64_t bpp = attributes.bytes;
+		LaszipSession* session = nullptr;
+
+		int format = 0;
+		int64_t recordSize = 0;
+		Vector3 sourceScale;
+		Vector3 sourceOffset;
+
+		if (reader != nullptr) {
+			format = reader->header.pointDataFormat;
+			recordSize = reader->stride;
+			sourceScale = reader->header.scale;
+			sourceOffset = reader->header.offset;
+		} else {
+			session = &acquireSession(path, lazChunkSize, firstPoint);
+
+			const auto* header = session->header;
+			format = header->point_data_format;
+			recordSize = header->point_data_record_length;
+			sourceScale = { header->x_scale_factor, header->y_scale_factor, header->z_scale_factor };
+			sourceOffset = { header->x_offset, header->y_offset, header->z_offset };
+		}
+
+		const auto plan = compileTranscodePlan(format, recordSize, inputAttributes, attributes);
+		auto& aPosition = *attributes.get("position");
+
+		constexpr int64_t subBatchSize = 64 * 1024;
+		thread_local vector<int32_t> X(subBatchSize);
+		thread_local vector<int32_t> Y(subBatchSize);
+		thread_local vector<int32_t> Z(subBatchSize);
+		thread_local vector<uint8_t> packed;
+
+		for (int64_t first = 0; first < numPoints; first += subBatchSize) {
+			const int64_t count = std::min(subBatchSize, numPoints - first);
+
+			const uint8_t* records = nullptr;
+			if (reader != nullptr) {
+				records = reader->record(firstPoint + first);
+			} else {
+				packed.resize(subBatchSize * recordSize);
+
+				for (int64_t i = 0; i < count; i++) {
+					session->readPoint();
+					packLasRecord(session->point, format, packed.data() + i * recordSize, recordSize);
+				}
+
+				records = packed.data();
+			}
+
+			transformPositions(records, recordSize, count,
+				sourceScale, sourceOffset,
+				attributes.posScale, attributes.posOffset,
+				X.data(), Y.data(), Z.data());
+
+			uint8_t* target = data + first * bpp;
+
+			writePositions(X.data(), Y.data(), Z.data(), count, target, bpp);
+			plan.transcode(records, count, target);
+
+			gatherPositionBounds(records, recordSize, count, sourceScale, sourceOffset, aPosition);
+		}
+
+		gatherAttributeStatistics(plan, data, numPoints, attributes);
+	}
+
+	// copy of <attributes> with empty min/max and histograms, to collect statistics of a single batch
+	Attributes withoutStatistics(const Attributes& attributes) {
+		Attributes copy = attributes;
+
+		for (auto& attribute : copy.list) {
+			attribute.min = { Infinity, Infinity, Infinity };
+			attribute.max = { -Infinity, -Infinity, -Infinity };
+
+			if (attribute.name == "classification") {
+				for (int i = 0; i < attribute.histogram.size(); i++) {
+					attribute.histogram[i] = 0;
+				}
+			}
+		}
+
+		return copy;
+	}
+
+	// merge attribute metadata of a batch into global attribute metadata
+	void mergeStatistics(const Attributes& batch, Attributes& global) {
+
+		lock_guard<mutex> lock(mtx_attributes);
+
+		for (int i = 0; i < batch.list.size(); i++) {
+			const Attribute& source = batch.list[i];
+			Attribute& target = global.list[i];
+
+			target.min.x = std::min(target.min.x, source.min.x);
+			target.min.y = std::min(target.min.y, source.min.y);
+			target.min.z = std::min(target.min.z, source.min.z);
+
+			target.max.x = std::max(target.max.x, source.max.x);
+			target.max.y = std::max(target.max.y, source.max.y);
+			target.max.z = std::max(target.max.z, source.max.z);
+
+			for(int j = 0; j < target.histogram.size(); j++){
+				target.histogram[j] = target.histogram[j] + source.histogram[j];
+			}
+		}
+	}
+
+	// Points of compressed sources, decoded and transcoded by the counting pass.
+	// distributePoints takes them from here instead of decompressing the sources a second time.
+	// Batches are either kept in memory, or appended to a temporary file in the chunks directory.
+	struct PointSpill {
+
+		struct Entry {
+			shared_ptr<Buffer> buffer = nullptr;
+			int64_t offset = 0;
+			int64_t size = 0;
+		};
+
+		bool inMemory = true;
+		unique_ptr<PositionalFile> file = nullptr;
+		atomic_int64_t fileSize = 0;
+
+		mutex mtx;
+		unordered_map<int64_t, Entry> entries;
+
+		PointSpill(bool inMemory, string path) {
+			this->inMemory = inMemory;
+
+			if (!inMemory) {
+				file = std::make_unique<PositionalFile>(path, true);
+
+				if (!file->isOpen()) {
+					logger::ERROR("failed to create spill file " + path);
+					exit(123);
+				}
+			}
+		}
+
+		~PointSpill() {
+			if (file != nullptr) {
+				const string path = file->path;
+				file = nullptr;
+
+				fs::remove(path);
+			}
+		}
+
+		void store(int64_t key, shared_ptr<Buffer> buffer) {
+			Entry entry;
+			entry.size = buffer->size;
+
+			if (inMemory) {
+				entry.buffer = buffer;
+			} else {
+				entry.offset = fileSize.fetch_add(buffer->size);
+				file->write(buffer->data, buffer->size, entry.offset);
+			}
+
+			lock_guard<mutex> lock(mtx);
+			entries[key] = entry;
+		}
+
+		// returns the points stored under <key> and removes them from the spill
+		shared_ptr<Buffer> take(int64_t key) {
+			Entry entry;
+
+			{
+				lock_guard<mutex> lock(mtx);
+				entry = entries[key];
+				entries.erase(key);
+			}
+
+			if (inMemory) {
+				return entry.buffer;
+			}
+
+			auto buffer = make_shared<Buffer>(entry.size);
+			file->read(buffer->data, entry.size, entry.offset);
+
+			return buffer;
+		}
 
-	// grid contains index of node in nodes
-	struct NodeLUT {
-		int64_t gridSize;
-		vector<int> grid;
 	};
 
-	vector<std::atomic_int32_t> countPointsInCells(const vector<Source> &sources, Vector3 min, Vector3 max, int64_t gridSize, State& state, const Attributes& outputAttributes) {
+	PointSpill* spill = nullptr;
+
+	// whether points of this source are decoded once and spilled, rather than decoded in both passes
+	bool isSpilled(const shared_ptr<LasReader>& reader) {
+		return spill != nullptr && reader == nullptr;
+	}
+
+	// Chunks are kept in memory and handed to the indexer directly if all points fit into the memory budget.
+	// The chunk files are needed if they are kept, or indexed by a later run.
+	bool keepChunksInMemory(const Options& options, const State& state, const Attributes& outputAttributes) {
+
+		constexpr int64_t MB = 1024 * 1024;
+
+		if (options.memoryBudget == 0 || options.keepChunks || options.noIndexing) {
+			return false;
+		}
+
+		int64_t memoryBudget = options.memoryBudget * MB;
+		if (options.memoryBudget < 0) {
+			const auto memory = getMemoryData();
+			memoryBudget = int64_t(memory.physical_total - memory.physical_used) / 4;
+		}
+
+		const int64_t chunkBytes = state.pointsTotal * outputAttributes.bytes;
+
+		if (chunkBytes > memoryBudget) {
+			return false;
+		}
+
+		const string msg = "keeping chunks in memory, " + formatNumber(double(chunkBytes) / double(MB), 1)
+			+ "MB of " + formatNumber(double(memoryBudget) / double(MB), 1) + "MB budget";
+		cout << msg << endl;
+		logger::INFO(msg);
+
+		return true;
+	}
+
+	// "off", "exact", or the spacing of the grid that positions are snapped to. See --dedup
+	double parseDedup(const Options& options) {
+
+		if (options.dedup == "off") {
+			return -1.0;
+		} else if (options.dedup == "exact" || options.dedup.empty()) {
+			return 0.0;
+		}
+
+		char* end = nullptr;
+		const double cellSize = std::strtod(options.dedup.c_str(), &end);
+
+		if (end == options.dedup.c_str() || *end != '\0' || cellSize < 0.0) {
+			logger::WARN("unknown value for --dedup: \"" + options.dedup + "\", duplicates are kept");
+
+			return -1.0;
+		}
+
+		return cellSize;
+	}
+
+	// Decides whether compressed sources are decoded once during counting and kept for distributePoints.
+	// "memory" if the decoded points fit comfortably into free memory, otherwise "disk" if writing and reading
+	// back the decoded points is faster than decompressing the sources again, and "off" if it isn't.
+	string chooseSpillMode(const Options& options, const vector<Source>& sources, Attributes& outputAttributes, const string& targetDir) {
+
+		constexpr double MB = 1024.0 * 1024.0;
+
+		int64_t numLazPoints = 0;
+		const Source* benchmarkSource = nullptr;
+		for (const auto& source : sources) {
+			if (!LasReader::canRead(source.path)) {
+				numLazPoints += source.numPoints;
+				benchmarkSource = benchmarkSource == nullptr ? &source : benchmarkSource;
+			}
+		}
+
+		if (numLazPoints == 0) {
+			return "off";
+		}
+
+		if (countSample < 1.0) {
+			// the counting pass only decodes a small part of the points, there is little to keep
+			return "off";
+		}
+
+		if (options.decodeOnce == "memory" || options.decodeOnce == "disk" || options.decodeOnce == "off") {
+			return options.decodeOnce;
+		} else if (options.decodeOnce != "auto") {
+			logger::WARN("unknown value for --decode-once: \"" + options.decodeOnce + "\", using \"auto\"");
+		}
+
+		const int64_t spillBytes = numLazPoints * outputAttributes.bytes;
+		const auto memory = getMemoryData();
+		const int64_t memoryBudget = int64_t(memory.physical_total - memory.physical_used) / 4;
+
+		if (spillBytes <= memoryBudget) {
+			const string msg = "decode-once: memory, " + formatNumber(double(spillBytes) / MB, 1) + "MB of decoded points";
+			cout << msg << endl;
+			logger::INFO(msg);
+
+			return "memory";
+		}
+
+		double decodeRate = 0.0;
+		{ // bytes of decoded output per second, over all chunker threads
+			const int64_t numPoints = std::min(int64_t(benchmarkSource->numPoints), int64_t(100'000));
+			vector<uint8_t> data(numPoints * outputAttributes.bytes, 0);
+			Attributes inputAttributes(benchmarkSource->attributes);
+			Attributes attributes = withoutStatistics(outputAttributes);
+
+			const auto tStart = now();
+			decodePoints(benchmarkSource->path, benchmarkSource->header.lazChunkSize, nullptr, 0, numPoints, inputAttributes, attributes, data.data());
+			const double duration = std::max(now() - tStart, 0.000'001);
+
+			// the calling thread doesn't decode anything else, don't keep the file open
+			threadSession().close();
+
+			decodeRate = double(data.size()) * double(numChunkerThreads) / duration;
+		}
+
+		double diskRate = 0.0;
+		{ // bytes per second written to the chunks directory
+			const string path = targetDir + "/chunks/.spill_benchmark.bin";
+			const int64_t blockSize = 4 * 1024 * 1024;
+			const int64_t numBlocks = 16;
+
+			// incompressible, so that file systems that compress or deduplicate zeros don't skip the writes
+			vector<uint64_t> block(blockSize / sizeof(uint64_t));
+			uint64_t seed = 0x9E3779B97F4A7C15ull;
+			for (auto& value : block) {
+				seed ^= seed << 13;
+				seed ^= seed >> 7;
+				seed ^= seed << 17;
+				value = seed;
+			}
+
+			double duration = 0.0;
+			{
+				PositionalFile file(path, true);
+
+				// the timing ends once the data reached the device (fdatasync / FlushFileBuffers), not the page cache
+				const auto tStart = now();
+				for (int64_t i = 0; i < numBlocks; i++) {
+					file.write(block.data(), blockSize, i * blockSize);
+				}
+				file.flush();
+				duration = std::max(now() - tStart, 0.000'001);
+			}
+			fs::remove(path);
+
+			diskRate = double(blockSize * numBlocks) / duration;
+		}
+
+		// spilled points are written during counting and read during distribute
+		const string mode = (diskRate / 2.0) > decodeRate ? "disk" : "off";
+
+		stringstream ss;
+		ss << "decode-once: " << mode
+			<< ", laz decode " << formatNumber(decodeRate / MB, 1) << "MB/s"
+			<< ", disk " << formatNumber(diskRate / MB, 1) << "MB/s"
+			<< ", " << formatNumber(double(spillBytes) / MB, 1) << "MB of decoded points";
+		cout << ss.str() << endl;
+		logger::INFO(ss.str());
+
+		return mode;
+	}
+
+	SparseGrid<int32_t> countPointsInCells(const vector<Source> &sources, Vector3 min, Vector3 max, int64_t gridSize, State& state, Attributes& outputAttributes) {
 
 		cout << endl;
 		cout << "=======================================" << endl;
@@ -133,7 +724,8 @@ namespace chunker_countsort_laszip {
 
 		const auto tStart = now();
 
-		vector<std::atomic_int32_t> grid(gridSize * gridSize * gridSize);
+		// every thread counts into its own grid, they are summed up once all points are counted
+		ThreadLocalGrids<int32_t> grids(gridSize);
 
 		struct Task{
 			string path;
@@ -147,14 +739,22 @@ namespace chunker_countsort_laszip {
 			Vector3 offset;
 			Vector3 min;
 			Vector3 max;
+			int64_t lazChunkSize = 0;
+			shared_ptr<LasReader> reader = nullptr;
+			Attributes inputAttributes;
+			int64_t spillKey = -1;
+			// number of points that each counted point stands for
+			double weight = 1.0;
+			// bounding box in the header of the source
+			Vector3 sourceMin;
+			Vector3 sourceMax;
 		};
 
-		const auto processor = [gridSize, &grid, tStart, &state, &outputAttributes](shared_ptr<Task> task){
+		const auto processor = [gridSize, &grids, tStart, &state, &outputAttributes](shared_ptr<Task> task){
+			auto& grid = grids.local();
+
 			const string path = task->path;
-			const int64_t start = task->firstByte;
-			const int64_t numBytes = task->numBytes;
 			const int64_t numToRead = task->numPoints;
-			const int64_t bpp = task->bpp;
 			Vector3 min = task->min;
 			Vector3 max = task->max;
 
@@ -165,97 +765,189 @@ namespace chunker_countsort_laszip {
 
 			logger::INFO(ss.str());
 
-			thread_local unique_ptr<void, void(*)(void*)> buffer(nullptr, free);
-			thread_local int64_t bufferSize = -1;
+			const double cubeSize = (max - min).max();
+			const Vector3 size = { cubeSize, cubeSize, cubeSize };
+			max = min + cubeSize;
 
-			{ // sanity checks
-				if(numBytes < 0){
-					logger::ERROR("invalid malloc size: " + formatNumber(numBytes));
+			const double dGridSize = double(gridSize);
+
+			const auto posScale = outputAttributes.posScale;
+			const auto posOffset = outputAttributes.posOffset;
+
+			const auto reportPointOutsideBox = [&min, &max, &path](Vector3 point) {
+				stringstream ss;
+				ss << "encountered point outside bounding box." << endl;
+				ss << "box.min: " << min.toString() << endl;
+				ss << "box.max: " << max.toString() << endl;
+				ss << "point: " << point.toString() << endl;
+				ss << "file: " << path << endl;
+				ss << "PotreeConverter requires a valid bounding box to operate." << endl;
+				ss << "Please try to repair the bounding box, e.g. using lasinfo with the -repair_bb argument." << endl;
+				logger::ERROR(ss.str());
+
+				exit(123);
+			};
+
+			// Adds a point to a cell. Sampled points count <weight> times, carrying the fractional
+			// part over to the next point so that the counts add up to the number of represented points.
+			const double weight = task->weight;
+			double carry = 0.0;
+			const auto addToCell = [&grid, weight, &carry](int64_t index) {
+				auto& cell = grid.at(grid.keyOfIndex(index));
+
+				if (weight == 1.0) {
+					cell++;
+				} else {
+					carry += weight;
+					const int32_t count = int32_t(carry);
+					carry -= count;
+
+					cell += count;
 				}
-			}
+			};
 
-			if (bufferSize < numBytes){
-				buffer.reset(malloc(numBytes));
-				bufferSize = numBytes;
-			}
+			// integer bounds of the counted points, in the output scale/offset
+			int32_t minX = std::numeric_limits<int32_t>::max(), maxX = std::numeric_limits<int32_t>::min();
+			int32_t minY = std::numeric_limits<int32_t>::max(), maxY = std::numeric_limits<int32_t>::min();
+			int32_t minZ = std::numeric_limits<int32_t>::max(), maxZ = std::numeric_limits<int32_t>::min();
 
-			laszip_POINTER laszip_reader;
-			{
-				laszip_BOOL is_compressed = iEndsWith(path, ".laz") ? 1 : 0;
-				constexpr laszip_BOOL request_reader = 1;
+			const auto extendBounds = [&](int32_t X, int32_t Y, int32_t Z) {
+				minX = std::min(minX, X); maxX = std::max(maxX, X);
+				minY = std::min(minY, Y); maxY = std::max(maxY, Y);
+				minZ = std::min(minZ, Z); maxZ = std::max(maxZ, Z);
+			};
 
-				laszip_create(&laszip_reader);
-				laszip_request_compatibility_mode(laszip_reader, request_reader);
-				laszip_open_reader(laszip_reader, path.c_str(), &is_compressed);
-				laszip_seek_point(laszip_reader, task->firstPoint);
-			}
+			// counts points whose integer coordinates, in the output scale/offset, are stored in <records>
+			const auto countRecords = [&](const uint8_t* records, int64_t stride, int64_t count, Vector3 sourceScale, Vector3 sourceOffset) {
+				constexpr int64_t subBatchSize = 64 * 1024;
 
-			const double cubeSize = (max - min).max();
-			const Vector3 size = { cubeSize, cubeSize, cubeSize };
-			max = min + cubeSize;
+				thread_local vector<int32_t> X(subBatchSize);
+				thread_local vector<int32_t> Y(subBatchSize);
+				thread_local vector<int32_t> Z(subBatchSize);
+				thread_local vector<int64_t> indices(subBatchSize);
 
-			const double dGridSize = double(gridSize);
+				for (int64_t first = 0; first < count; first += subBatchSize) {
+					const int64_t subCount = std::min(subBatchSize, count - first);
 
-			double coordinates[3];
+					transformPositions(records + first * stride, stride, subCount,
+						sourceScale, sourceOffset,
+						posScale, posOffset,
+						X.data(), Y.data(), Z.data());
 
-			const auto posScale = outputAttributes.posScale;
-			const auto posOffset = outputAttributes.posOffset;
+					const int64_t outside = computeGridIndices(
+						X.data(), Y.data(), Z.data(), subCount,
+						posScale, posOffset,
+						min, cubeSize, gridSize,
+						indices.data());
+
+					if (outside >= 0) {
+						const double x = double(X[outside]) * posScale.x + posOffset.x;
+						const double y = double(Y[outside]) * posScale.y + posOffset.y;
+						const double z = double(Z[outside]) * posScale.z + posOffset.z;
 
-			for (int i = 0; i < numToRead; i++) {
-				const int64_t pointOffset = i * bpp;
-
-				laszip_read_point(laszip_reader);
-				laszip_get_coordinates(laszip_reader, coordinates);
-
-				{
-					// transfer las integer coordinates to new scale/offset/box values
-					const double x = coordinates[0];
-					const double y = coordinates[1];
-					const double z = coordinates[2];
-
-					const int32_t X = int32_t((x - posOffset.x) / posScale.x);
-					const int32_t Y = int32_t((y - posOffset.y) / posScale.y);
-					const int32_t Z = int32_t((z - posOffset.z) / posScale.z);
-
-					const double ux = (double(X) * posScale.x + posOffset.x - min.x) / size.x;
-					const double uy = (double(Y) * posScale.y + posOffset.y - min.y) / size.y;
-					const double uz = (double(Z) * posScale.z + posOffset.z - min.z) / size.z;
-
-					bool inBox = ux >= 0.0 && uy >= 0.0 && uz >= 0.0;
-					inBox = inBox && ux <= 1.0 && uy <= 1.0 && uz <= 1.0;
-
-					if (!inBox) {
-						stringstream ss;
-						ss << "encountered point outside bounding box." << endl;
-						ss << "box.min: " << min.toString() << endl;
-						ss << "box.max: " << max.toString() << endl;
-						ss << "point: " << Vector3(x, y, z).toString() << endl;
-						ss << "file: " << path << endl;
-						ss << "PotreeConverter requires a valid bounding box to operate." << endl;
-						ss << "Please try to repair the bounding box, e.g. using lasinfo with the -repair_bb argument." << endl;
-						logger::ERROR(ss.str());
-
-						exit(123);
+						reportPointOutsideBox({ x, y, z });
 					}
 
-					const int64_t ix = int64_t(std::min(dGridSize * ux, dGridSize - 1.0));
-					const int64_t iy = int64_t(std::min(dGridSize * uy, dGridSize - 1.0));
-					const int64_t iz = int64_t(std::min(dGridSize * uz, dGridSize - 1.0));
+					for (int64_t i = 0; i < subCount; i++) {
+						addToCell(indices[i]);
+						extendBounds(X[i], Y[i], Z[i]);
+					}
+				}
+			};
 
-					const int64_t index = ix + iy * gridSize + iz * gridSize * gridSize;
+			if (task->spillKey >= 0) {
+				// decode into the output layout once, count from there and keep the points for distributePoints
+				const int64_t decodedBytes = numToRead * outputAttributes.bytes;
+				auto decoded = make_shared<Buffer>(decodedBytes);
+				memset(decoded->data, 0, decodedBytes);
 
-					grid[index]++;
-				}
+				Attributes attributes = withoutStatistics(outputAttributes);
+				decodePoints(path, task->lazChunkSize, nullptr, task->firstPoint, numToRead, task->inputAttributes, attributes, decoded->data_u8);
+
+				countRecords(decoded->data_u8, outputAttributes.bytes, numToRead, posScale, posOffset);
+
+				mergeStatistics(attributes, outputAttributes);
+				spill->store(task->spillKey, decoded);
+			} else if (task->reader != nullptr) {
+				// uncompressed: decode coordinates straight from the mapped file
+				auto& reader = *task->reader;
+				const uint8_t* records = reader.record(task->firstPoint);
 
+				countRecords(records, reader.stride, numToRead, reader.header.scale, reader.header.offset);
+			} else {
+				auto& session = acquireSession(path, task->lazChunkSize, task->firstPoint);
+
+				double coordinates[3];
+
+				for (int i = 0; i < numToRead; i++) {
+					session.readPoint();
+					laszip_get_coordinates(session.reader, coordinates);
+
+					{
+						// transfer las integer coordinates to new scale/offset/box values
+						const double x = coordinates[0];
+						const double y = coordinates[1];
+						const double z = coordinates[2];
+
+						const int32_t X = int32_t((x - posOffset.x) / posScale.x);
+						const int32_t Y = int32_t((y - posOffset.y) / posScale.y);
+						const int32_t Z = int32_t((z - posOffset.z) / posScale.z);
+
+						const double ux = (double(X) * posScale.x + posOffset.x - min.x) / size.x;
+						const double uy = (double(Y) * posScale.y + posOffset.y - min.y) / size.y;
+						const double uz = (double(Z) * posScale.z + posOffset.z - min.z) / size.z;
+
+						bool inBox = ux >= 0.0 && uy >= 0.0 && uz >= 0.0;
+						inBox = inBox && ux <= 1.0 && uy <= 1.0 && uz <= 1.0;
+
+						if (!inBox) {
+							reportPointOutsideBox({ x, y, z });
+						}
+
+						const int64_t ix = int64_t(std::min(dGridSize * ux, dGridSize - 1.0));
+						const int64_t iy = int64_t(std::min(dGridSize * uy, dGridSize - 1.0));
+						const int64_t iz = int64_t(std::min(dGridSize * uz, dGridSize - 1.0));
+
+						const int64_t index = ix + iy * gridSize + iz * gridSize * gridSize;
+
+						addToCell(index);
+						extendBounds(X, Y, Z);
+					}
+
+				}
 			}
 
-			laszip_close_reader(laszip_reader);
-			laszip_destroy(laszip_reader);
+			if (numToRead > 0) {
+				// same tolerance as in ChunkSealer, coordinates are rounded to the output scale
+				const Vector3 boundsMin = {
+					double(minX) * posScale.x + posOffset.x,
+					double(minY) * posScale.y + posOffset.y,
+					double(minZ) * posScale.z + posOffset.z };
+				const Vector3 boundsMax = {
+					double(maxX) * posScale.x + posOffset.x,
+					double(maxY) * posScale.y + posOffset.y,
+					double(maxZ) * posScale.z + posOffset.z };
+				const Vector3 sourceMin = task->sourceMin - posScale;
+				const Vector3 sourceMax = task->sourceMax + posScale;
+
+				const bool exceeds =
+					boundsMin.x < sourceMin.x || boundsMin.y < sourceMin.y || boundsMin.z < sourceMin.z ||
+					boundsMax.x > sourceMax.x || boundsMax.y > sourceMax.y || boundsMax.z > sourceMax.z;
+
+				if (exceeds) {
+					lock_guard<mutex> lock(mtx_exceedingSources);
+
+					if (sourcesExceedingHeaderBox.insert(path).second) {
+						logger::WARN("points of " + path + " exceed the bounding box in its header. "
+							+ "Its chunks are handed to the indexer only after all sources were distributed.");
+					}
+				}
+			}
 
 			static int64_t pointsProcessed = 0;
-			pointsProcessed += task->numPoints;
+			pointsProcessed += int64_t(double(task->numPoints) * task->weight);
 
-			state.name = "COUNTING";
+			state.setName("COUNTING");
 			state.pointsProcessed = pointsProcessed;
 			state.duration = now() - tStart;
 
@@ -265,59 +957,66 @@ namespace chunker_countsort_laszip {
 
 		const auto tStartTaskAssembly = now();
 
+		int64_t taskIndex = 0;
 		for (auto && source : sources) {
-			laszip_POINTER laszip_reader;
-			laszip_header* header;
-			{
-				laszip_create(&laszip_reader);
+			const auto& header = source.header;
 
-				constexpr laszip_BOOL request_reader = 1;
-				laszip_BOOL is_compressed = iEndsWith(source.path, ".laz") ? 1 : 0;
-
-				laszip_request_compatibility_mode(laszip_reader, request_reader);
-				laszip_open_reader(laszip_reader, source.path.c_str(), &is_compressed);
-				laszip_get_header_pointer(laszip_reader, &header);
+			shared_ptr<LasReader> reader = nullptr;
+			if (LasReader::canRead(source.path)) {
+				reader = make_shared<LasReader>(source.path, header);
+				reader = reader->isValid() ? reader : nullptr;
 			}
 
-			const int64_t bpp = header->point_data_record_length;
-			const int64_t numPoints = std::max(uint64_t(header->number_of_point_records), header->extended_number_of_point_records);
-
-			int64_t pointsLeft = numPoints;
-			constexpr int64_t batchSize = 1'000'000;
-			int64_t numRead = 0;
+			const int64_t bpp = header.bytesPerPoint;
+			const int64_t numPoints = header.numPoints;
 
-			while (pointsLeft > 0) {
+			vector<PointRange> ranges;
+			double weight = 1.0;
+			if (countSample < 1.0) {
+				ranges = sampleRanges(splitIntoTasks(header, sampleRangeSize), countSample);
 
-				int64_t numToRead;
-				if (pointsLeft < batchSize) {
-					numToRead = pointsLeft;
-					pointsLeft = 0;
-				} else {
-					numToRead = batchSize;
-					pointsLeft = pointsLeft - batchSize;
+				int64_t numSampled = 0;
+				for (const auto& range : ranges) {
+					numSampled += range.count;
 				}
 
-				const int64_t firstByte = header->offset_to_point_data + numRead * bpp;
-				const int64_t numBytes = numToRead * bpp;
+				weight = numSampled > 0 ? double(numPoints) / double(numSampled) : 1.0;
+			} else {
+				ranges = splitIntoTasks(header, fixedTaskSize);
+			}
+
+			// compressed sources are decoded by laszip
+			if (reader == nullptr) {
+				countFixedSplitWaste(header, ranges, countSample < 1.0 ? sampleRangeSize : fixedTaskSize);
+			}
+
+			for (const auto& range : ranges) {
+
+				const int64_t firstByte = header.offsetToPointData + range.first * bpp;
+				const int64_t numBytes = range.count * bpp;
 
 				auto task = make_shared<Task>();
 				task->path = source.path;
 				task->totalPoints = numPoints;
-				task->firstPoint = numRead;
+				task->firstPoint = range.first;
 				task->firstByte = firstByte;
 				task->numBytes = numBytes;
-				task->numPoints = numToRead;
-				task->bpp = header->point_data_record_length;
+				task->numPoints = range.count;
+				task->bpp = bpp;
 				task->min = min;
 				task->max = max;
+				task->lazChunkSize = header.lazChunkSize;
+				task->reader = reader;
+				task->inputAttributes = Attributes(source.attributes);
+				task->spillKey = isSpilled(reader) ? taskIndex : -1;
+				task->weight = weight;
+				task->sourceMin = source.min;
+				task->sourceMax = source.max;
 
 				pool.addTask(task);
 
-				numRead += batchSize;
+				taskIndex++;
 			}
-
-			laszip_close_reader(laszip_reader);
-			laszip_destroy(laszip_reader);
 		}
 
 		printElapsedTime("tStartTaskAssembly", tStartTaskAssembly);
@@ -325,6 +1024,13 @@ namespace chunker_countsort_laszip {
 		pool.waitTillEmpty();
 		pool.close();
 
+		const auto tReduce = now();
+		auto grid = grids.reduce();
+		printElapsedTime("reduce count grids", tReduce);
+
+		cout << "count grid: " << formatNumber(grid.numAllocatedBlocks()) << " of " << formatNumber(grid.blocks.size())
+			<< " blocks, " << formatNumber(double(grid.memory()) / (1024.0 * 1024.0), 1) << "MB" << endl;
+
 		printElapsedTime("countPointsInCells", tStart);
 
 		double duration = now() - tStart;
@@ -334,308 +1040,343 @@ namespace chunker_countsort_laszip {
 
 		{
 			duration = now() - tStart;
-			state.values["duration(chunking-count)"] = formatNumber(duration, 3);
+			state.setValue("duration(chunking-count)", formatNumber(duration, 3));
 		}
 
 
-		return std::move(grid);
+		return grid;
 	}
 
-	void addBuckets(string targetDir, vector<shared_ptr<Buffer>>& newBuckets) {
+	// Removes duplicate points while they are distributed, see --dedup.
+	// Each chunk keeps a set of the positions it received so far. With a cell size, positions are snapped to
+	// a grid of that spacing first and one point per cell is kept. Points closer than the cell size may still
+	// remain if they fall into neighbouring cells, so this is grid snapping rather than a distance threshold.
+	// The sets of all chunks together hold at most <maxBytes>. Beyond that, the sets of the least recently
+	// used chunks are dropped, and their later points are only compared against the points after that.
+	struct ChunkDedup {
 
-		for(int nodeIndex = 0; nodeIndex < nodes.size(); nodeIndex++){
+		// size of the grid cells, in units of the integer coordinates. 1 if only identical positions are merged.
+		Vector3 cellSize;
+		bool exact = true;
 
-			if (newBuckets[nodeIndex]->size == 0) {
-				continue;
+		int64_t maxBytes = 0;
+
+		vector<unique_ptr<XYZHashSet>> sets;
+		vector<mutex> mutexes;
+		// memory of each set, and the last call to filter() that used it
+		unique_ptr<atomic_int64_t[]> setBytes;
+		unique_ptr<atomic_int64_t[]> lastUse;
+
+		atomic_int64_t bytes = 0;
+		atomic_int64_t numFilterCalls = 0;
+		mutex mtx_evict;
+
+		atomic_int64_t numRemoved = 0;
+		// sets that were dropped to stay within <maxBytes>, before their chunk was sealed
+		atomic_int64_t numEvicted = 0;
+
+		ChunkDedup(int64_t numChunks, double cellSizeInMeters, Vector3 scale, int64_t maxBytes)
+			: sets(numChunks), mutexes(numChunks) {
+
+			this->maxBytes = maxBytes;
+
+			setBytes.reset(new atomic_int64_t[numChunks]);
+			lastUse.reset(new atomic_int64_t[numChunks]);
+			for (int64_t i = 0; i < numChunks; i++) {
+				setBytes[i] = 0;
+				lastUse[i] = 0;
 			}
 
-			auto& node = nodes[nodeIndex];
-			string path = targetDir + "/chunks/" + node.id + ".bin";
-			auto buffer = newBuckets[nodeIndex];
+			// cells smaller than the precision of the coordinates merge nothing but identical positions
+			cellSize.x = std::max(1.0, cellSizeInMeters / scale.x);
+			cellSize.y = std::max(1.0, cellSizeInMeters / scale.y);
+			cellSize.z = std::max(1.0, cellSizeInMeters / scale.z);
+
+			exact = cellSize.x == 1.0 && cellSize.y == 1.0 && cellSize.z == 1.0;
+		}
 
-			writer->write(path, buffer);
+		// Moves the points at <data> that chunk <chunkIndex> didn't receive yet to the front, in their order.
+		// Returns how many there are.
+		int64_t filter(int64_t chunkIndex, uint8_t* data, int64_t numPoints, int64_t bpp) {
+			int64_t numKept = 0;
+
+			{
+				lock_guard<mutex> lock(mutexes[chunkIndex]);
 
+				auto& set = sets[chunkIndex];
+
+				if (set == nullptr) {
+					// grows with the points that arrive, rather than reserving for all planned points
+					set = std::make_unique<XYZHashSet>(numPoints);
+				}
+
+				for (int64_t i = 0; i < numPoints; i++) {
+					const int32_t* xyz = reinterpret_cast<int32_t*>(data + i * bpp);
+
+					bool isNew = false;
+					if (exact) {
+						isNew = set->insert(xyz[0], xyz[1], xyz[2]);
+					} else {
+						isNew = set->insert(
+							int32_t(std::floor(double(xyz[0]) / cellSize.x)),
+							int32_t(std::floor(double(xyz[1]) / cellSize.y)),
+							int32_t(std::floor(double(xyz[2]) / cellSize.z))
+						);
+					}
+
+					if (isNew) {
+						if (numKept != i) {
+							memcpy(data + numKept * bpp, data + i * bpp, bpp);
+						}
+
+						numKept++;
+					}
+				}
+
+				const int64_t memory = set->memory();
+				bytes += memory - setBytes[chunkIndex];
+				setBytes[chunkIndex] = memory;
+				lastUse[chunkIndex] = numFilterCalls++;
+			}
+
+			numRemoved += numPoints - numKept;
+
+			if (bytes > maxBytes) {
+				evict(chunkIndex);
+			}
+
+			return numKept;
 		}
-	}
 
-	vector<function<void(int64_t)>> createAttributeHandlers(laszip_header* header, uint8_t* data, laszip_point* point, Attributes& inputAttributes, Attributes& outputAttributes) {
+		// drops the sets of the least recently used chunks, other than <keep>, until a quarter of the budget is free
+		void evict(int64_t keep) {
+			lock_guard<mutex> lock(mtx_evict);
 
-		vector<function<void(int64_t)>> handlers;
-		int attributeOffset = 0;
+			if (bytes <= maxBytes) {
+				return;
+			}
 
-		// reset min/max, we're writing the values to a per-thread copy anyway
-		for (auto& attribute : outputAttributes.list) {
-			attribute.min = { Infinity, Infinity, Infinity };
-			attribute.max = { -Infinity, -Infinity, -Infinity };
+			// last use and index of each chunk with a set
+			vector<std::pair<int64_t, int64_t>> candidates;
+			for (int64_t i = 0; i < int64_t(sets.size()); i++) {
+				if (i != keep && setBytes[i] > 0) {
+					candidates.push_back({ int64_t(lastUse[i]), i });
+				}
+			}
+
+			std::sort(candidates.begin(), candidates.end());
+
+			for (auto [use, chunkIndex] : candidates) {
+				if (bytes <= maxBytes - maxBytes / 4) {
+					break;
+				}
+
+				drop(chunkIndex);
+				numEvicted++;
+			}
 		}
 
-		{ // STANDARD LAS ATTRIBUTES
+		void drop(int64_t chunkIndex) {
+			lock_guard<mutex> lock(mutexes[chunkIndex]);
 
-			const int offsetRGB = outputAttributes.getOffset("rgb");
-			Attribute* attributeRGB = outputAttributes.get("rgb");
-			auto rgb = [data, point, header, offsetRGB, attributeRGB](int64_t offset) {
-				if (offsetRGB >= 0) {
+			bytes -= setBytes[chunkIndex];
+			setBytes[chunkIndex] = 0;
+			sets[chunkIndex] = nullptr;
+		}
 
-					uint16_t rgb[] = { 0, 0, 0 };
-					memcpy(rgb, &point->rgb, 6);
-					memcpy(data + offset + offsetRGB, rgb, 6);
+		// the chunk won't receive any more points
+		void release(int64_t chunkIndex) {
+			drop(chunkIndex);
+		}
+
+	};
+
+	ChunkDedup* dedup = nullptr;
+
+	// pushes a chunk that can't receive any more points to sealedChunks
+	void sealChunk(int64_t chunkIndex) {
+
+		if (dedup != nullptr) {
+			dedup->release(chunkIndex);
+		}
+
+		SealedChunk chunk;
+		chunk.id = nodes[chunkIndex].id;
+
+		if (chunkMemory != nullptr) {
+			chunk.size = chunkMemory->sizeOf(chunkIndex);
+			chunk.buckets = chunkMemory->take(chunkIndex);
+		} else {
+			chunk.file = arena->file->path;
+			chunk.extents = arena->extentsOf(chunkIndex);
+
+			for (const auto& extent : chunk.extents) {
+				chunk.size += extent.size;
+			}
+		}
 
-					attributeRGB->min.x = std::min(attributeRGB->min.x, double(rgb[0]));
-					attributeRGB->min.y = std::min(attributeRGB->min.y, double(rgb[1]));
-					attributeRGB->min.z = std::min(attributeRGB->min.z, double(rgb[2]));
+		if (chunk.size > 0) {
+			sealedChunks->push(chunk);
+		}
+	}
 
-					attributeRGB->max.x = std::max(attributeRGB->max.x, double(rgb[0]));
-					attributeRGB->max.y = std::max(attributeRGB->max.y, double(rgb[1]));
-					attributeRGB->max.z = std::max(attributeRGB->max.z, double(rgb[2]));
-				}
-			};
+	// Finds out when chunks are complete during distributePoints.
+	// A chunk waits for all sources whose bounding box intersects it, and for the writes of its points.
+	// Once neither is outstanding, it is sealed.
+	struct ChunkSealer {
 
-			const int offsetIntensity = outputAttributes.getOffset("intensity");
-			Attribute* attributeIntensity = outputAttributes.get("intensity");
-			auto intensity = [data, point, header, offsetIntensity, attributeIntensity](int64_t offset) {
-				memcpy(data + offset + offsetIntensity, &point->intensity, 2);
+		// per chunk: unfinished intersecting sources plus pending writes
+		unique_ptr<atomic_int64_t[]> outstanding;
 
-				attributeIntensity->min.x = std::min(attributeIntensity->min.x, double(point->intensity));
-				attributeIntensity->max.x = std::max(attributeIntensity->max.x, double(point->intensity));
-			};
+		// per source: the chunks that its bounding box intersects, and its unfinished tasks
+		vector<vector<int64_t>> chunksOfSource;
+		unique_ptr<atomic_int64_t[]> remainingTasks;
 
-			const int offsetReturnNumber = outputAttributes.getOffset("return number");
-			Attribute* attributeReturnNumber = outputAttributes.get("return number");
-			auto returnNumber = [data, point, header, offsetReturnNumber, attributeReturnNumber](int64_t offset) {
-				const uint8_t value = point->return_number;
+		atomic_int64_t remainingSources = 0;
+		atomic_int64_t numSealed = 0;
+		// chunks that were sealed before the last source was distributed
+		atomic_int64_t numSealedEarly = 0;
 
-				memcpy(data + offset + offsetReturnNumber, &value, 1);
+		ChunkSealer(const vector<Source>& sources, const vector<int64_t>& tasksPerSource, Vector3 min, double cubeSize, Vector3 posScale) {
 
-				attributeReturnNumber->min.x = std::min(attributeReturnNumber->min.x, double(value));
-				attributeReturnNumber->max.x = std::max(attributeReturnNumber->max.x, double(value));
-			};
+			outstanding.reset(new atomic_int64_t[nodes.size()]);
+			remainingTasks.reset(new atomic_int64_t[sources.size()]);
+			chunksOfSource.resize(sources.size());
 
-			const int offsetNumberOfReturns = outputAttributes.getOffset("number of returns");
-			Attribute* attributeNumberOfReturns = outputAttributes.get("number of returns");
-			auto numberOfReturns = [data, point, header, offsetNumberOfReturns, attributeNumberOfReturns](int64_t offset) {
-				const uint8_t value = point->number_of_returns;
+			for (int64_t i = 0; i < nodes.size(); i++) {
+				outstanding[i] = 0;
+			}
 
-				memcpy(data + offset + offsetNumberOfReturns, &value, 1);
+			// same mapping from coordinates to cells as in distributePoints
+			const auto toCell = [cubeSize](double value, double boxMin) {
+				const double u = (value - boxMin) / cubeSize;
 
-				attributeNumberOfReturns->min.x = std::min(attributeNumberOfReturns->min.x, double(value));
-				attributeNumberOfReturns->max.x = std::max(attributeNumberOfReturns->max.x, double(value));
+				return std::clamp(int64_t(double(gridSize) * u), int64_t(0), int64_t(gridSize) - 1);
 			};
 
-			const int offsetScanAngleRank = outputAttributes.getOffset("scan angle rank");
-			Attribute* attributeScanAngleRank = outputAttributes.get("scan angle rank");
-			auto scanAngleRank = [data, point, header, offsetScanAngleRank, attributeScanAngleRank](int64_t offset) {
-				memcpy(data + offset + offsetScanAngleRank, &point->scan_angle_rank, 1);
-
-				attributeScanAngleRank->min.x = std::min(attributeScanAngleRank->min.x, double(point->scan_angle_rank));
-				attributeScanAngleRank->max.x = std::max(attributeScanAngleRank->max.x, double(point->scan_angle_rank));
-			};
+			for (int64_t s = 0; s < sources.size(); s++) {
+				// coordinates are rounded to the output scale, which may move points by one unit
+				const Vector3 sourceMin = sources[s].min - posScale;
+				const Vector3 sourceMax = sources[s].max + posScale;
 
-			const int offsetScanAngle= outputAttributes.getOffset("scan angle");
-			Attribute* attributeScanAngle = outputAttributes.get("scan angle");
-			auto scanAngle = [data, point, header, offsetScanAngle, attributeScanAngle](int64_t offset) {
-				memcpy(data + offset + offsetScanAngle, &point->extended_scan_angle, 2);
+				const int64_t minX = toCell(sourceMin.x, min.x), maxX = toCell(sourceMax.x, min.x);
+				const int64_t minY = toCell(sourceMin.y, min.y), maxY = toCell(sourceMax.y, min.y);
+				const int64_t minZ = toCell(sourceMin.z, min.z), maxZ = toCell(sourceMax.z, min.z);
 
-				attributeScanAngle->min.x = std::min(attributeScanAngle->min.x, double(point->extended_scan_angle));
-				attributeScanAngle->max.x = std::max(attributeScanAngle->max.x, double(point->extended_scan_angle));
-			};
+				// a sampled count didn't look at all points, so no header box is known to hold
+				const bool trusted = countSample >= 1.0 && !sourcesExceedingHeaderBox.contains(sources[s].path);
 
-			const int offsetUserData = outputAttributes.getOffset("user data");
-			Attribute* attributeUserData = outputAttributes.get("user data");
-			auto userData = [data, point, header, offsetUserData, attributeUserData](int64_t offset) {
-				memcpy(data + offset + offsetUserData, &point->user_data, 1);
+				for (int64_t i = 0; i < nodes.size(); i++) {
+					const auto& node = nodes[i];
 
-				attributeUserData->min.x = std::min(attributeUserData->min.x, double(point->user_data));
-				attributeUserData->max.x = std::max(attributeUserData->max.x, double(point->user_data));
-			};
+					const int64_t x = node.x * node.size;
+					const int64_t y = node.y * node.size;
+					const int64_t z = node.z * node.size;
 
-			const int offsetClassification = outputAttributes.getOffset("classification");
-			Attribute* attributeClassification = outputAttributes.get("classification");
-			auto classification = [data, point, header, offsetClassification, attributeClassification](int64_t offset) {
+					const bool intersects = !trusted || (
+						x <= maxX && x + node.size > minX &&
+						y <= maxY && y + node.size > minY &&
+						z <= maxZ && z + node.size > minZ);
 
-				uint8_t value = 0;
-				if (point->extended_classification > 31){
-					value = point->extended_classification;
-				}else{
-					value = point->classification;
+					if (intersects) {
+						chunksOfSource[s].push_back(i);
+						outstanding[i]++;
+					}
 				}
 
-				data[offset + offsetClassification] = value;
-				attributeClassification->histogram[value]++;
-
-				attributeClassification->min.x = std::min(attributeClassification->min.x, double(value));
-				attributeClassification->max.x = std::max(attributeClassification->max.x, double(value));
-			};
+				remainingTasks[s] = tasksPerSource[s];
+				remainingSources += tasksPerSource[s] > 0 ? 1 : 0;
+			}
 
-			const int offsetSourceId = outputAttributes.getOffset("point source id");
-			Attribute* attributePointSourceId = outputAttributes.get("point source id");
-			auto pointSourceId = [data, point, header, offsetSourceId, attributePointSourceId](int64_t offset) {
-				memcpy(data + offset + offsetSourceId, &point->point_source_ID, 2);
+			// chunks that no source intersects are empty
+			for (int64_t i = 0; i < nodes.size(); i++) {
+				if (outstanding[i] == 0) {
+					numSealed++;
+				}
+			}
+		}
 
-				attributePointSourceId->min.x = std::min(attributePointSourceId->min.x, double(point->point_source_ID));
-				attributePointSourceId->max.x = std::max(attributePointSourceId->max.x, double(point->point_source_ID));
-			};
+		// a write of points of <source> to the chunk is about to start.
+		// Sources whose points exceed their header box hold all chunks, so a sealed chunk can't receive points.
+		void acquire(int64_t chunkIndex, const string& source) {
+			if (outstanding[chunkIndex].fetch_add(1) == 0) {
+				stringstream ss;
+				ss << "chunk " << nodes[chunkIndex].id << " was already sealed when points of " << source << " arrived." << endl;
+				ss << "the counting pass and the distribution pass disagree on the points of the file." << endl;
+				logger::ERROR(ss.str());
 
-			const int offsetGpsTime= outputAttributes.getOffset("gps-time");
-			Attribute* attributeGpsTime = outputAttributes.get("gps-time");
-			auto gpsTime = [data, point, header, offsetGpsTime, attributeGpsTime](int64_t offset) {
-				memcpy(data + offset + offsetGpsTime, &point->gps_time, 8);
+				exit(123);
+			}
+		}
 
-				attributeGpsTime->min.x = std::min(attributeGpsTime->min.x, point->gps_time);
-				attributeGpsTime->max.x = std::max(attributeGpsTime->max.x, point->gps_time);
-			};
+		void release(int64_t chunkIndex) {
+			if (outstanding[chunkIndex].fetch_sub(1) == 1) {
+				numSealed++;
+				numSealedEarly += remainingSources > 0 ? 1 : 0;
 
-			const int offsetClassificationFlags = outputAttributes.getOffset("classification flags");
-			Attribute* attributeClassificationFlags = outputAttributes.get("classification flags");
-			auto classificationFlags = [data, point, header, offsetClassificationFlags, attributeClassificationFlags](int64_t offset) {
-				const uint8_t value = point->extended_classification_flags;
+				sealChunk(chunkIndex);
+			}
+		}
 
-				memcpy(data + offset + offsetClassificationFlags, &value, 1);
+		// once all tasks of a source are done, the source stops holding back its chunks
+		void finishTask(int64_t sourceIndex) {
+			if (remainingTasks[sourceIndex].fetch_sub(1) == 1) {
+				remainingSources--;
 
-				attributeClassificationFlags->min.x = std::min(attributeClassificationFlags->min.x, double(point->extended_classification_flags));
-				attributeClassificationFlags->max.x = std::max(attributeClassificationFlags->max.x, double(point->extended_classification_flags));
-			};
+				for (int64_t chunkIndex : chunksOfSource[sourceIndex]) {
+					release(chunkIndex);
+				}
+			}
+		}
 
-			unordered_map<string, function<void(int64_t)>> mapping = {
-				{"rgb", rgb},
-				{"intensity", intensity},
-				{"return number", returnNumber},
-				{"number of returns", numberOfReturns},
-				{"classification", classification},
-				{"scan angle rank", scanAngleRank},
-				{"scan angle", scanAngle},
-				{"user data", userData},
-				{"point source id", pointSourceId},
-				{"gps-time", gpsTime},
-				{"classification flags", classificationFlags},
-			};
+	};
 
-			for (auto& attribute : inputAttributes.list) {
+	ChunkSealer* sealer = nullptr;
 
-				attributeOffset += attribute.size;
+	// Hands the points of a batch to the writer. <batch> is sorted by chunk, with the points of chunk i
+	// starting at point bucketOffsets[i]. Each chunk receives a slice of the batch, so nothing is copied.
+	void addBuckets(shared_ptr<Buffer> batch, const vector<int64_t>& bucketOffsets, const vector<int64_t>& counts, int64_t bpp, const string& source) {
 
-				if (attribute.name == "position") {
-					continue;
-				}
+		for(int nodeIndex = 0; nodeIndex < nodes.size(); nodeIndex++){
 
-				bool standardMappingExists = mapping.find(attribute.name) != mapping.end();
-				const bool isIncludedInOutput = outputAttributes.get(attribute.name) != nullptr;
-				if (standardMappingExists && isIncludedInOutput) {
-					handlers.push_back(mapping[attribute.name]);
-				}
+			if (counts[nodeIndex] == 0) {
+				continue;
 			}
-		}
 
-		{ // EXTRA ATTRIBUTES
+			const int64_t bucketOffset = bucketOffsets[nodeIndex] * bpp;
+			const int64_t bucketSize = counts[nodeIndex] * bpp;
 
-			// mapping from las format to index of first extra attribute
-			// +1 for all formats with returns, which is split into return number and number of returns
-			unordered_map<int, int> formatToExtraIndex = {
-				{0, 8},
-				{1, 9},
-				{2, 9},
-				{3, 10},
-				{4, 14},
-				{5, 15},
-				{6, 10},
-				{7, 11},
-			};
+			if (chunkMemory != nullptr) {
+				if (sealer != nullptr) sealer->acquire(nodeIndex, source);
 
-			bool noMapping = formatToExtraIndex.find(header->point_data_format) == formatToExtraIndex.end();
-			if (noMapping) {
-				string msg = "ERROR: las format not supported: " + formatNumber(header->point_data_format) + "\n";
-				cout << msg;
+				chunkMemory->add(nodeIndex, make_shared<Buffer>(batch, bucketOffset, bucketSize));
 
-				exit(123);
-			}
+				if (sealer != nullptr) sealer->release(nodeIndex);
 
-			// handle extra bytes individually to compute per-attribute information
-			const int firstExtraIndex = formatToExtraIndex[header->point_data_format];
-			int sourceOffset = 0;
-
-			int attributeOffset = 0;
-			for (int i = 0; i < firstExtraIndex; i++) {
-				attributeOffset += inputAttributes.list[i].size;
-			}
-
-			for (int i = firstExtraIndex; i < inputAttributes.list.size(); i++) {
-				const Attribute& inputAttribute = inputAttributes.list[i];
-				Attribute* attribute = outputAttributes.get(inputAttribute.name);
-				const int targetOffset = outputAttributes.getOffset(inputAttribute.name);
-
-				const int attributeSize = inputAttribute.size;
-
-				if (attribute != nullptr) {
-					const auto handleAttribute = [data, point, header, attributeSize, attributeOffset, sourceOffset, attribute](int64_t offset) {
-						memcpy(data + offset + attributeOffset, point->extra_bytes + sourceOffset, attributeSize);
-
-						std::function<double(uint8_t*)> f;
-
-						// TODO: shouldn't use DOUBLE as a unifying type
-						// it won't work with uint64_t and int64_t
-						if (attribute->type == AttributeType::INT8) {
-							f = asDouble<int8_t>;
-						} else if (attribute->type == AttributeType::INT16) {
-							f = asDouble<int16_t>;
-						} else if (attribute->type == AttributeType::INT32) {
-							f = asDouble<int32_t>;
-						} else if (attribute->type == AttributeType::INT64) {
-							f = asDouble<int64_t>;
-						} else if (attribute->type == AttributeType::UINT8) {
-							f = asDouble<uint8_t>;
-						} else if (attribute->type == AttributeType::UINT16) {
-							f = asDouble<uint16_t>;
-						} else if (attribute->type == AttributeType::UINT32) {
-							f = asDouble<uint32_t>;
-						} else if (attribute->type == AttributeType::UINT64) {
-							f = asDouble<uint64_t>;
-						} else if (attribute->type == AttributeType::FLOAT) {
-							f = asDouble<float>;
-						} else if (attribute->type == AttributeType::DOUBLE) {
-							f = asDouble<double>;
-						}
+				continue;
+			}
 
-						if (attribute->numElements == 1) {
-							const double x = f(point->extra_bytes + sourceOffset);
-
-							attribute->min.x = std::min(attribute->min.x, x);
-							attribute->max.x = std::max(attribute->max.x, x);
-						} else if (attribute->numElements == 2) {
-							const double x = f(point->extra_bytes + sourceOffset + 0 * attribute->elementSize);
-							const double y = f(point->extra_bytes + sourceOffset + 1 * attribute->elementSize);
-
-							attribute->min.x = std::min(attribute->min.x, x);
-							attribute->min.y = std::min(attribute->min.y, y);
-							attribute->max.x = std::max(attribute->max.x, x);
-							attribute->max.y = std::max(attribute->max.y, y);
-
-						} else if (attribute->numElements == 3) {
-							const double x = f(point->extra_bytes + sourceOffset + 0 * attribute->elementSize);
-							const double y = f(point->extra_bytes + sourceOffset + 1 * attribute->elementSize);
-							const double z = f(point->extra_bytes + sourceOffset + 2 * attribute->elementSize);
-
-							attribute->min.x = std::min(attribute->min.x, x);
-							attribute->min.y = std::min(attribute->min.y, y);
-							attribute->min.z = std::min(attribute->min.z, z);
-							attribute->max.x = std::max(attribute->max.x, x);
-							attribute->max.y = std::max(attribute->max.y, y);
-							attribute->max.z = std::max(attribute->max.z, z);
-						}
+			const auto extents = arena->reserve(nodeIndex, bucketSize);
 
+			// more than one extent if the bucket doesn't fit into the chunk's region
+			int64_t bufferOffset = bucketOffset;
+			for (const auto& extent : extents) {
+				auto part = make_shared<Buffer>(batch, bufferOffset, extent.size);
 
-					};
+				if (sealer != nullptr) {
+					sealer->acquire(nodeIndex, source);
 
-					handlers.push_back(handleAttribute);
+					writer->write(arena->file, extent.offset, part, [nodeIndex]() {
+						sealer->release(nodeIndex);
+					});
+				} else {
+					writer->write(arena->file, extent.offset, part);
 				}
 
-				sourceOffset += attribute->size;
-				attributeOffset += attribute->size;
+				bufferOffset += extent.size;
 			}
 
 		}
-
-
-		return handlers;
-
 	}
 
 	void distributePoints(const vector<Source> &sources, Vector3 min, Vector3 max, const string &targetDir, NodeLUT& lut, State& state, Attributes& outputAttributes) {
@@ -651,7 +1392,27 @@ namespace chunker_countsort_laszip {
 		state.bytesProcessed = 0;
 		state.duration = 0;
 
-		writer = new ConcurrentWriter(numFlushThreads, state);
+		shared_ptr<AsyncIOBackend> io = nullptr;
+
+		if (chunksInMemory) {
+			// chunks stay in memory, nothing to write
+			chunkMemory = make_shared<ChunkMemory>(nodes.size());
+		} else {
+			io = createAsyncIOBackend(ioBackend, ioQueueDepth);
+			writer = new ConcurrentWriter(numFlushThreads, state, 2'000 * 1024 * 1024, io);
+
+			// lay out the chunks in the arena according to the counts
+			vector<int64_t> capacities;
+			for (const auto& node : nodes) {
+				capacities.push_back(node.numPoints * outputAttributes.bytes);
+			}
+
+			arena = new ChunkArena(targetDir + "/chunks/" + arenaFilename, capacities);
+		}
+
+		if (dedupCellSize >= 0.0) {
+			dedup = new ChunkDedup(nodes.size(), dedupCellSize, outputAttributes.posScale, dedupMaxBytes);
+		}
 
 		printElapsedTime("distributePoints0", tStart);
 
@@ -668,6 +1429,10 @@ namespace chunker_countsort_laszip {
 			Vector3 min;
 			Vector3 max;
 			Attributes inputAttributes;
+			int64_t lazChunkSize = 0;
+			shared_ptr<LasReader> reader = nullptr;
+			int64_t spillKey = -1;
+			int64_t sourceIndex = 0;
 		};
 
 		mutex mtx_push_point;
@@ -682,7 +1447,6 @@ namespace chunker_countsort_laszip {
 			const auto bpp = outputAttributes.bytes;
 			const auto numBytes = bpp * batchSize;
 			const Vector3 scale = task->scale;
-			const Vector3 offset = task->offset;
 			const Vector3 min = task->min;
 			Vector3 max = task->max;
 			Attributes inputAttributes = task->inputAttributes;
@@ -701,92 +1465,35 @@ namespace chunker_countsort_laszip {
 				}
 			}
 
-			if (bufferSize < numBytes) {
-				buffer.reset(malloc(numBytes));
-				bufferSize = numBytes;
-			}
-
-			uint8_t* data = reinterpret_cast<uint8_t*>(buffer.get());
-			// memset necessary if attribute handlers don't set all values.
-			// previous handlers from input with different point formats
-			// may have set the values before.
-			memset(data, 0, bufferSize);
-
-			writer->waitUntilMemoryBelow(2'000);
-
-			int pointFormat = -1;
-			// per-thread copy of outputAttributes to compute min/max in a thread-safe way
-			// will be merged to global outputAttributes instance at the end of this function
-			Attributes outputAttributesCopy = outputAttributes;
+			// points that the counting pass already decoded
+			shared_ptr<Buffer> spilled = task->spillKey >= 0 ? spill->take(task->spillKey) : nullptr;
 
-			for(auto& attribute: outputAttributesCopy.list){
-				if(attribute.name == "classification"){
-					for(int i = 0; i < attribute.histogram.size(); i++){
-						attribute.histogram[i] = 0;
-					}
+			uint8_t* data = nullptr;
+			if (spilled != nullptr) {
+				data = spilled->data_u8;
+			} else {
+				if (bufferSize < numBytes) {
+					buffer.reset(malloc(numBytes));
+					bufferSize = numBytes;
 				}
-			}
 
-			{
-				laszip_POINTER laszip_reader;
-				laszip_header* header;
-				laszip_point* point;
-
-				constexpr laszip_BOOL request_reader = 1;
-				laszip_BOOL is_compressed = iEndsWith(path, ".laz") ? 1 : 0;
-
-				laszip_create(&laszip_reader);
-				laszip_request_compatibility_mode(laszip_reader, request_reader);
-				laszip_open_reader(laszip_reader, path.c_str(), &is_compressed);
-				laszip_get_header_pointer(laszip_reader, &header);
-				laszip_get_point_pointer(laszip_reader, &point);
-
-				laszip_seek_point(laszip_reader, task->firstPoint);
-
-				auto attributeHandlers = createAttributeHandlers(header, data, point, inputAttributes, outputAttributesCopy);
-
-				double coordinates[3];
-				auto aPosition = outputAttributesCopy.get("position");
-
-				for (int64_t i = 0; i < batchSize; i++) {
-					laszip_read_point(laszip_reader);
-					laszip_get_coordinates(laszip_reader, coordinates);
-
-					int64_t offset = i * outputAttributes.bytes;
-
-					{ // copy position
-						const double x = coordinates[0];
-						const double y = coordinates[1];
-						const double z = coordinates[2];
-
-						const int32_t X = int32_t((x - outputAttributes.posOffset.x) / scale.x);
-						const int32_t Y = int32_t((y - outputAttributes.posOffset.y) / scale.y);
-						const int32_t Z = int32_t((z - outputAttributes.posOffset.z) / scale.z);
-
-						memcpy(data + offset + 0, &X, 4);
-						memcpy(data + offset + 4, &Y, 4);
-						memcpy(data + offset + 8, &Z, 4);
-
-						aPosition->min.x = std::min(aPosition->min.x, x);
-						aPosition->min.y = std::min(aPosition->min.y, y);
-						aPosition->min.z = std::min(aPosition->min.z, z);
-
-						aPosition->max.x = std::max(aPosition->max.x, x);
-						aPosition->max.y = std::max(aPosition->max.y, y);
-						aPosition->max.z = std::max(aPosition->max.z, z);
-					}
-
-					// copy other attributes
-					for (auto& handler : attributeHandlers) {
-						handler(offset);
-					}
+				data = reinterpret_cast<uint8_t*>(buffer.get());
+				// memset necessary if transcode plans don't set all values.
+				// previous plans from input with different point formats
+				// may have set the values before.
+				memset(data, 0, bufferSize);
+			}
 
-				}
+			if (writer != nullptr) {
+				writer->waitUntilMemoryBelow(2'000);
+			}
 
-				pointFormat = header->point_data_format;
+			// per-thread copy of outputAttributes to compute min/max in a thread-safe way
+			// will be merged to global outputAttributes instance at the end of this function
+			Attributes outputAttributesCopy = withoutStatistics(outputAttributes);
 
-				laszip_close_reader(laszip_reader);
-				laszip_destroy(laszip_reader);
+			if (spilled == nullptr) {
+				decodePoints(path, task->lazChunkSize, task->reader.get(), task->firstPoint, batchSize, inputAttributes, outputAttributesCopy, data);
 			}
 
 			const double cubeSize = (max - min).max();
@@ -815,12 +1522,16 @@ namespace chunker_countsort_laszip {
 				return index;
 			};
 
+			// chunk of each point, so that the lookup is only done once
+			thread_local vector<int32_t> chunkIndices;
+			chunkIndices.resize(batchSize);
+
 			// COUNT POINTS PER BUCKET
 			vector<int64_t> counts(nodes.size(), 0);
 			for (int64_t i = 0; i < batchSize; i++) {
 				const auto index = toIndex(i * bpp);
 
-				auto nodeIndex = grid[index];
+				auto nodeIndex = grid.get(grid.keyOfIndex(index));
 
 				// ERROR
 				if (nodeIndex == -1) {
@@ -853,127 +1564,183 @@ namespace chunker_countsort_laszip {
 					exit(123);
 				}
 
+				chunkIndices[i] = nodeIndex;
 				counts[nodeIndex]++;
 			}
 
-			// ALLOCATE BUCKETS
-			vector<shared_ptr<Buffer>> buckets(nodes.size(), nullptr);
-			for (int i = 0; i < nodes.size(); i++) {
-				const int64_t numPoints = counts[i];
-				const int64_t bytes = numPoints * bpp;
-				buckets[i] = make_shared<Buffer>(bytes);
+			// first point of each bucket within the sorted batch
+			vector<int64_t> bucketOffsets(nodes.size(), 0);
+			for (int64_t i = 1; i < nodes.size(); i++) {
+				bucketOffsets[i] = bucketOffsets[i - 1] + counts[i - 1];
 			}
 
-			// ADD POINTS TO BUCKETS
-			shared_ptr<Buffer> previousBucket = nullptr;
-			int64_t previousNodeIndex = -1;
-			for (int64_t i = 0; i < batchSize; i++) {
-				const int64_t pointOffset = i * bpp;
+			// SORT POINTS INTO BUCKETS
+			// a single allocation for all buckets of the batch. It's freed once the writer wrote all slices of it.
+			auto batch = make_shared<Buffer>(numBytes);
+			{
+				vector<int64_t> cursors = bucketOffsets;
 
-				const auto index = toIndex(pointOffset);
+				for (int64_t i = 0; i < batchSize; i++) {
+					const int64_t target = cursors[chunkIndices[i]]++;
 
-				const auto nodeIndex = grid[index];
-				auto& node = nodes[nodeIndex];
+					memcpy(batch->data_u8 + target * bpp, &data[0] + i * bpp, bpp);
+				}
+			}
 
-				if (nodeIndex == previousNodeIndex) {
-					previousBucket->write(&data[0] + pointOffset, bpp);
-				} else {
-					previousBucket = buckets[nodeIndex];
-					previousNodeIndex = nodeIndex;
-					previousBucket->write(&data[0] + pointOffset, bpp);
+			if (dedup != nullptr) { // REMOVE DUPLICATES
+				for (int64_t i = 0; i < nodes.size(); i++) {
+					if (counts[i] > 0) {
+						counts[i] = dedup->filter(i, batch->data_u8 + bucketOffsets[i] * bpp, counts[i], bpp);
+					}
 				}
 			}
 
+			for (int i = 0; i < nodes.size(); i++) {
+				counters[i] += counts[i];
+			}
+
 			state.pointsProcessed += batchSize;
 			state.bytesProcessed += numBytes;
 			state.duration = now() - tStart;
 
-			const auto tAddBuckets = now();
-			addBuckets(targetDir, buckets);
-
-			// merge attribute metadata of this batch into global attribute metadata
-			for (int i = 0; i < outputAttributesCopy.list.size(); i++) {
-				Attribute& source = outputAttributesCopy.list[i];
-				Attribute& target = outputAttributes.list[i];
-
-				lock_guard<mutex> lock(mtx_attributes);
-				target.min.x = std::min(target.min.x, source.min.x);
-				target.min.y = std::min(target.min.y, source.min.y);
-				target.min.z = std::min(target.min.z, source.min.z);
+			addBuckets(batch, bucketOffsets, counts, bpp, path);
 
-				target.max.x = std::max(target.max.x, source.max.x);
-				target.max.y = std::max(target.max.y, source.max.y);
-				target.max.z = std::max(target.max.z, source.max.z);
-
-				for(int j = 0; j < target.histogram.size(); j++){
-					target.histogram[j] = target.histogram[j] + source.histogram[j];
-				}
+			if (sealer != nullptr) {
+				sealer->finishTask(task->sourceIndex);
 			}
 
+			mergeStatistics(outputAttributesCopy, outputAttributes);
 
 		};
 
-		TaskPool<Task> pool(numChunkerThreads, processor);
-
-		for (auto source: sources) {
+		// same enumeration of tasks as in countPointsInCells, so that spill keys match
+		vector<shared_ptr<Task>> tasks;
+		vector<int64_t> tasksPerSource;
+		int64_t taskIndex = 0;
+		for (int64_t sourceIndex = 0; sourceIndex < sources.size(); sourceIndex++) {
+			const auto& source = sources[sourceIndex];
 
-			laszip_POINTER laszip_reader;
-			laszip_header* header;
-			{
-				constexpr laszip_BOOL request_reader = 1;
-				laszip_BOOL is_compressed = iEndsWith(source.path, ".laz") ? 1 : 0;
+			const Attributes inputAttributes(source.attributes);
 
-				laszip_create(&laszip_reader);
-				laszip_request_compatibility_mode(laszip_reader, request_reader);
-				laszip_open_reader(laszip_reader, source.path.c_str(), &is_compressed);
-				laszip_get_header_pointer(laszip_reader, &header);
+			shared_ptr<LasReader> reader = nullptr;
+			if (LasReader::canRead(source.path)) {
+				reader = make_shared<LasReader>(source.path, source.header);
+				reader = reader->isValid() ? reader : nullptr;
 			}
 
-			const int64_t numPoints = std::max(uint64_t(header->number_of_point_records), header->extended_number_of_point_records);
-			int64_t pointsLeft = numPoints;
-			constexpr int64_t maxBatchSize = 1'000'000;
-			int64_t numRead = 0;
+			const auto ranges = splitIntoTasks(source.header, fixedTaskSize);
+			tasksPerSource.push_back(ranges.size());
 
-			vector<Source> tmpSources = { source };
-			const Attributes inputAttributes = computeOutputAttributes(tmpSources, {});
+			// spilled sources were already decoded while counting
+			if (reader == nullptr && !isSpilled(reader)) {
+				countFixedSplitWaste(source.header, ranges, fixedTaskSize);
+			}
 
-			while (pointsLeft > 0) {
+			if (reader == nullptr && source.header.lazChunkSize < 0) {
+				numVariableChunkSources++;
+			}
 
-				int64_t numToRead;
-				if (pointsLeft < maxBatchSize) {
-					numToRead = pointsLeft;
-					pointsLeft = 0;
-				} else {
-					numToRead = maxBatchSize;
-					pointsLeft = pointsLeft - maxBatchSize;
-				}
+			for (const auto& range : ranges) {
 
 				auto task = make_shared<Task>();
-				task->maxBatchSize = maxBatchSize;
-				task->batchSize = numToRead;
+				task->maxBatchSize = fixedTaskSize;
+				task->batchSize = range.count;
 				task->lut = &lut;
-				task->firstPoint = numRead;
+				task->firstPoint = range.first;
 				task->path = source.path;
 				task->scale = outputAttributes.posScale;
 				task->offset = outputAttributes.posOffset;
 				task->min = min;
 				task->max = max;
 				task->inputAttributes = inputAttributes;
+				task->lazChunkSize = source.header.lazChunkSize;
+				task->reader = reader;
+				task->spillKey = isSpilled(reader) ? taskIndex : -1;
+				task->sourceIndex = sourceIndex;
 
-				pool.addTask(task);
+				tasks.push_back(task);
+
+				taskIndex++;
+			}
+
+		}
+
+		if (sealedChunks != nullptr) {
+			const double cubeSize = (max - min).max();
 
-				numRead += numToRead;
+			sealer = new ChunkSealer(sources, tasksPerSource, min, cubeSize, outputAttributes.posScale);
+
+			if (countSample < 1.0) {
+				logger::INFO("--count-sample doesn't verify the bounding boxes of the sources, chunks are handed to the indexer once all points were distributed.");
 			}
+		}
 
-			laszip_close_reader(laszip_reader);
-			laszip_destroy(laszip_reader);
+		TaskPool<Task> pool(numChunkerThreads, processor);
 
+		for (auto& task : tasks) {
+			pool.addTask(task);
 		}
 
+		tasks.clear();
+
 		pool.close();
-		writer->join();
 
-		delete writer;
+		if (writer != nullptr) { // writer statistics
+			writer->join();
+
+			constexpr double MB = 1024.0 * 1024.0;
+
+			state.setValue("io backend", io->name());
+			state.setValue("writer throughput(MB/s)", formatNumber(writer->throughput(), 1));
+			state.setValue("writer peak queue depth", formatNumber(int64_t(writer->maxNumQueued)));
+			state.setValue("writer peak queued(MB)", formatNumber(double(writer->maxBytesQueuedObserved) / MB, 1));
+			state.setValue("writer producers blocked(s)", formatNumber(double(writer->blockedDuration), 3));
+
+			delete writer;
+			writer = nullptr;
+		}
+
+		if (sealer != nullptr) {
+			state.setValue("chunks sealed early", formatNumber(int64_t(sealer->numSealedEarly)) + " of " + formatNumber(int64_t(nodes.size())));
+
+			delete sealer;
+			sealer = nullptr;
+		}
+
+		if (dedup != nullptr) {
+			const int64_t numRemoved = dedup->numRemoved;
+
+			state.setValue("duplicates removed", formatNumber(numRemoved));
+			state.pointsTotal -= numRemoved;
+
+			if (dedup->numEvicted > 0) {
+				logger::WARN("--dedup exceeded " + formatNumber(dedupMaxBytes / (1024 * 1024)) + "MB, "
+					+ "the positions of " + formatNumber(int64_t(dedup->numEvicted)) + " chunks were dropped before the chunks were complete. "
+					+ "Duplicates far apart in the input may remain in these chunks.");
+			}
+
+			delete dedup;
+			dedup = nullptr;
+		}
+
+		{ // replace the planned point counts of the chunks with the distributed ones
+			int64_t numOversized = 0;
+			int64_t largest = 0;
+
+			for (int i = 0; i < nodes.size(); i++) {
+				nodes[i].numPoints = counters[i];
+
+				largest = std::max(largest, nodes[i].numPoints);
+				numOversized += nodes[i].numPoints > maxPointsPerChunk ? 1 : 0;
+			}
+
+			state.setValue("largest chunk", formatNumber(largest));
+
+			if (numOversized > 0) {
+				logger::WARN(formatNumber(numOversized) + " chunks hold more than "
+					+ formatNumber(maxPointsPerChunk) + " points, up to " + formatNumber(largest));
+			}
+		}
 
 		const auto duration = now() - tStart;
 		cout << "finished creating chunks in " << formatNumber(duration) << "s" << endl;
@@ -986,6 +1753,48 @@ namespace chunker_countsort_laszip {
 		js["min"] = { min.x, min.y, min.z };
 		js["max"] = { max.x, max.y, max.z };
 
+		js["chunks"] = json::array();
+
+		if (chunkMemory != nullptr) {
+			// the points stay in memory, the indexer finds them through the index of the chunk
+			js["memory"] = true;
+
+			for (int64_t i = 0; i < nodes.size(); i++) {
+				if (chunkMemory->sizeOf(i) == 0) {
+					continue;
+				}
+
+				json jsChunk;
+				jsChunk["id"] = nodes[i].id;
+				jsChunk["index"] = i;
+
+				js["chunks"].push_back(jsChunk);
+			}
+		}
+
+		// location of each chunk's points within the arena
+		if (arena != nullptr) {
+			js["arena"] = arenaFilename;
+		}
+
+		for (int64_t i = 0; arena != nullptr && i < nodes.size(); i++) {
+			const auto extents = arena->extentsOf(i);
+
+			if (extents.empty()) {
+				continue;
+			}
+
+			json jsChunk;
+			jsChunk["id"] = nodes[i].id;
+			jsChunk["extents"] = json::array();
+
+			for (const auto& extent : extents) {
+				jsChunk["extents"].push_back({ extent.offset, extent.size });
+			}
+
+			js["chunks"].push_back(jsChunk);
+		}
+
 		js["attributes"] = {};
 		for (auto && attribute : attributes.list) {
 
@@ -1049,154 +1858,291 @@ namespace chunker_countsort_laszip {
 	// XXX_high: variables of the higher/more detailed level of the pyramid that we're evaluating right now
 	// XXX_low: one level lower than _high; the target of the "downsampling" operation
 	//
-	NodeLUT createLUT(vector<atomic_int32_t>& grid, int64_t gridSize) {
+	// Creates chunks by merging cells of the counting grid in "image pyramid" fashion, from the finest level up to the root.
+	// - the 8 children of a cell are merged into it if they don't hold more than maxPointsPerChunk points together
+	// - otherwise, the children become chunks, and the cell is marked as unmergeable (-1) for the next level.
+	// Cells are kept in lists sorted by their morton code, which only contain occupied cells,
+	// and in which the children of a cell are always next to each other.
+	NodeLUT createLUT(const SparseGrid<int32_t>& grid, int64_t gridSize) {
 		const auto tStart = now();
 
-		const auto for_xyz = [](int64_t gridSize, function< void(int64_t, int64_t, int64_t)> callback) {
+		struct Cell {
+			uint64_t key = 0;
+			int64_t count = 0;
+		};
 
-			for (int x = 0; x < gridSize; x++) {
-			for (int y = 0; y < gridSize; y++) {
-			for (int z = 0; z < gridSize; z++) {
-				callback(x, y, z);
-			}
-			}
-			}
+		const int64_t level_max = int64_t(log2(gridSize));
+		const int64_t numSegments = 4 * numChunkerThreads;
 
-		};
+		// occupied cells of the finest level
+		vector<Cell> cells_high;
+		{
+			vector<vector<Cell>> perBlock(grid.blocks.size());
+
+			parallelFor(0, grid.blocks.size(), 1, [&grid, &perBlock](int64_t blockIndex) {
+				const int32_t* block = grid.blocks[blockIndex].get();
+
+				if (block == nullptr) {
+					return;
+				}
 
-		// atomic vectors are cumbersome, convert the highest level into a regular integer vector first.
-		vector<int64_t> grid_high;
-		grid_high.reserve(grid.size());
-		for (auto& value : grid) {
-			grid_high.push_back(value);
+				for (int64_t i = 0; i < SparseGrid<int32_t>::cellsPerBlock; i++) {
+					if (block[i] > 0) {
+						const uint64_t key = (uint64_t(blockIndex) << SparseGrid<int32_t>::blockBits) | i;
+
+						perBlock[blockIndex].push_back({ key, block[i] });
+					}
+				}
+			});
+
+			for (auto& cells : perBlock) {
+				cells_high.insert(cells_high.end(), cells.begin(), cells.end());
+			}
 		}
 
-		const int64_t level_max = int64_t(log2(gridSize));
+		const auto createNode = [level_max](int64_t level, uint64_t key, int64_t numPoints) {
+			Node node(toNodeID(level, key), numPoints);
+			node.level = level;
+			node.key = key;
+			node.size = int64_t(1) << (level_max - level);
+
+			uint32_t x, y, z;
+			mortonDecode_magicbits(key, z, y, x);
+			node.x = x;
+			node.y = y;
+			node.z = z;
 
-		// - evaluate counting grid in "image pyramid" fashion
-		// - merge smaller cells into larger ones
-		// - unmergeable cells are resulting chunks; push them to "nodes" array.
-		for (int64_t level_low = level_max - 1; level_low >= 0; level_low--) {
+			return node;
+		};
 
-			const int64_t level_high = level_low + 1;
+		for (int64_t level_high = level_max; level_high > 0; level_high--) {
 
-			const int64_t gridSize_high = pow(2, level_high);
-			const int64_t gridSize_low = pow(2, level_low);
+			// split the list into segments that can be merged independently,
+			// without separating the children of a cell
+			vector<int64_t> bounds = { 0 };
+			for (int64_t i = 1; i < numSegments; i++) {
+				int64_t bound = std::max(bounds.back(), int64_t(cells_high.size()) * i / numSegments);
 
-			vector<int64_t> grid_low(gridSize_low * gridSize_low * gridSize_low, 0);
-			// grid_high
+				while (bound > 0 && bound < cells_high.size() && (cells_high[bound].key >> 3) == (cells_high[bound - 1].key >> 3)) {
+					bound++;
+				}
 
-			// loop through all cells of the lower detail target grid, and for each cell through the 8 enclosed cells of the higher level grid
-			for_xyz(gridSize_low, [&grid_low,  &grid_high, gridSize_low, gridSize_high, level_low, level_high, level_max](int64_t x, int64_t y, int64_t z){
+				bounds.push_back(bound);
+			}
+			bounds.push_back(cells_high.size());
 
-				const int64_t index_low = x + y * gridSize_low + z * gridSize_low * gridSize_low;
+			vector<vector<Cell>> segmentCells(numSegments);
+			vector<vector<Node>> segmentNodes(numSegments);
 
-				int64_t sum = 0;
-				int64_t max = 0;
-				bool unmergeable = false;
+			parallelFor(0, numSegments, 1, [&](int64_t segment) {
 
-				// loop through the 8 enclosed cells of the higher detailed grid
-				for (int64_t j = 0; j < 8; j++) {
-					const int64_t ox = (j & 0b100) >> 2;
-					const int64_t oy = (j & 0b010) >> 1;
-					const int64_t oz = (j & 0b001) >> 0;
+				auto& cells_low = segmentCells[segment];
+				auto& finished = segmentNodes[segment];
 
-					const int64_t nx = 2 * x + ox;
-					const int64_t ny = 2 * y + oy;
-					const int64_t nz = 2 * z + oz;
+				int64_t first = bounds[segment];
+				const int64_t end = bounds[segment + 1];
 
-					const int64_t index_high = nx + ny * gridSize_high + nz * gridSize_high * gridSize_high;
+				while (first < end) {
+					const uint64_t parent = cells_high[first].key >> 3;
 
-					const auto value = grid_high[index_high];
+					int64_t last = first;
+					while (last + 1 < end && (cells_high[last + 1].key >> 3) == parent) {
+						last++;
+					}
 
-					if (value == -1) {
-						unmergeable = true;
-					} else {
-						sum += value;
+					int64_t sum = 0;
+					bool unmergeable = false;
+					for (int64_t i = first; i <= last; i++) {
+						unmergeable = unmergeable || cells_high[i].count == -1;
+						sum += std::max(cells_high[i].count, int64_t(0));
 					}
 
-					max = std::max(max, value);
-				}
+					if (unmergeable || sum > maxPointsPerChunk) {
+						// finished chunks
+						for (int64_t i = first; i <= last; i++) {
+							if (cells_high[i].count > 0) {
+								finished.push_back(createNode(level_high, cells_high[i].key, cells_high[i].count));
+							}
+						}
 
+						// invalidate the cell to show the parent that nothing can be merged with it
+						cells_low.push_back({ parent, -1 });
+					} else {
+						cells_low.push_back({ parent, sum });
+					}
 
-				if (unmergeable || sum > maxPointsPerChunk) {
+					first = last + 1;
+				}
+			});
 
-					// finished chunks
-					for (int64_t j = 0; j < 8; j++) {
-						const int64_t ox = (j & 0b100) >> 2;
-						const int64_t oy = (j & 0b010) >> 1;
-						const int64_t oz = (j & 0b001) >> 0;
+			cells_high.clear();
+			for (int64_t i = 0; i < numSegments; i++) {
+				cells_high.insert(cells_high.end(), segmentCells[i].begin(), segmentCells[i].end());
+				nodes.insert(nodes.end(), segmentNodes[i].begin(), segmentNodes[i].end());
+			}
+		}
 
-						const int64_t nx = 2 * x + ox;
-						const int64_t ny = 2 * y + oy;
-						const int64_t nz = 2 * z + oz;
+		// everything merged into a single chunk
+		if (cells_high.size() == 1 && cells_high[0].count > 0) {
+			nodes.push_back(createNode(0, 0, cells_high[0].count));
+		}
 
-						const int64_t index_high = nx + ny * gridSize_high + nz * gridSize_high * gridSize_high;
+		const auto startOf = [level_max](const Node& node) {
+			return node.key << (3 * (level_max - node.level));
+		};
+		const auto endOf = [level_max](const Node& node) {
+			return (node.key + 1) << (3 * (level_max - node.level));
+		};
 
-						const auto value = grid_high[index_high];
+		parallelSort(nodes.begin(), nodes.end(), [&startOf](const Node& a, const Node& b) {
+			return startOf(a) < startOf(b);
+		});
 
+		if (countSample < 1.0) {
+			// With sampled counts, cells without samples may still contain points.
+			// The gaps between chunks are covered with the largest cells that fit in,
+			// which become chunks of their own, and stay empty if they don't contain points after all.
+			vector<Node> gapNodes;
 
-						if (value > 0) {
-							string nodeID = toNodeID(level_high, gridSize_high, nx, ny, nz);
+			const auto addGap = [&gapNodes, &createNode, level_max](uint64_t start, uint64_t end) {
+				while (start < end) {
+					int64_t level = level_max;
 
-							Node node(nodeID, value);
-							node.x = nx;
-							node.y = ny;
-							node.z = nz;
-							node.size = pow(2, (level_max - level_high));
+					while (level > 0) {
+						const uint64_t parentSize = uint64_t(1) << (3 * (level_max - level + 1));
 
-							nodes.push_back(node);
+						if ((start % parentSize) != 0 || start + parentSize > end) {
+							break;
 						}
+
+						level--;
 					}
 
-					// invalidate the field to show the parent that nothing can be merged with it
-					grid_low[index_low] = -1;
-				} else {
-					grid_low[index_low] = sum;
+					const uint64_t size = uint64_t(1) << (3 * (level_max - level));
+					gapNodes.push_back(createNode(level, start / size, 0));
+
+					start += size;
 				}
+			};
 
-			});
+			uint64_t cursor = 0;
+			for (const auto& node : nodes) {
+				addGap(cursor, startOf(node));
+				cursor = endOf(node);
+			}
+			addGap(cursor, uint64_t(1) << (3 * level_max));
 
-			grid_high = grid_low;
+			nodes.insert(nodes.end(), gapNodes.begin(), gapNodes.end());
+			parallelSort(nodes.begin(), nodes.end(), [&startOf](const Node& a, const Node& b) {
+				return startOf(a) < startOf(b);
+			});
 		}
 
 		// - create lookup table
-		// - loop through nodes, add pointers to node/chunk for all enclosed cells in LUT.
-		vector<int32_t> lut(gridSize* gridSize* gridSize, -1);
-		for (int i = 0; i < nodes.size(); i++) {
-			const auto node = nodes[i];
-
-			for_xyz(node.size, [node, &lut, gridSize, i](int64_t ox, int64_t oy, int64_t oz) {
-				const int64_t x = node.size * node.x + ox;
-				const int64_t y = node.size * node.y + oy;
-				const int64_t z = node.size * node.z + oz;
-				const int64_t index = x + y * gridSize + z * gridSize * gridSize;
-
-				lut[index] = i;
+		// - chunks of at least a block's size fill whole blocks without allocating them
+		// - smaller chunks are contiguous ranges of cells within a block, since cells are sorted by morton code
+		SparseGrid<int32_t> lut(gridSize, -1);
+		{
+			const uint64_t blockBits = SparseGrid<int32_t>::blockBits;
+
+			for (int64_t i = 0; i < nodes.size(); i++) {
+				const uint64_t start = startOf(nodes[i]);
+				const uint64_t end = endOf(nodes[i]);
+
+				if ((end - start) >= SparseGrid<int32_t>::cellsPerBlock) {
+					for (uint64_t blockIndex = start >> blockBits; blockIndex < (end >> blockBits); blockIndex++) {
+						lut.fill[blockIndex] = i;
+					}
+				} else if (lut.blocks[start >> blockBits] == nullptr) {
+					lut.allocate(start >> blockBits);
+				}
+			}
+
+			parallelFor(0, nodes.size(), 256, [&lut, &startOf, &endOf, blockBits](int64_t i) {
+				const uint64_t start = startOf(nodes[i]);
+				const uint64_t end = endOf(nodes[i]);
+
+				if ((end - start) < SparseGrid<int32_t>::cellsPerBlock) {
+					int32_t* block = lut.blocks[start >> blockBits].get();
+					const uint64_t first = start & SparseGrid<int32_t>::cellMask;
+
+					std::fill(block + first, block + first + (end - start), int32_t(i));
+				}
 			});
 		}
 
+		cout << "chunks: " << formatNumber(nodes.size()) << ", lookup table: "
+			<< formatNumber(double(lut.memory()) / (1024.0 * 1024.0), 1) << "MB" << endl;
+
 		printElapsedTime("createLUT", tStart);
 
-		return {gridSize, lut};
+		return {gridSize, std::move(lut)};
+	}
+
+	// Sources sorted along a morton curve through the centers of their bounding boxes.
+	// For spatially tiled inputs, neighbouring tiles are then distributed one after another,
+	// so that chunks are complete, and can be sealed, long before the last source is done.
+	vector<Source> orderSpatially(const vector<Source>& sources, Vector3 min, Vector3 max) {
+
+		const double cubeSize = (max - min).max();
+		constexpr double gridSize = double(1 << 20);
+
+		vector<std::pair<uint64_t, int64_t>> keys;
+		for (int64_t i = 0; i < sources.size(); i++) {
+			const Vector3 center = (sources[i].min + sources[i].max) / 2.0;
+
+			const auto toGrid = [cubeSize, gridSize](double value, double boxMin) {
+				return uint32_t(std::clamp(gridSize * (value - boxMin) / cubeSize, 0.0, gridSize - 1.0));
+			};
+
+			const uint64_t key = mortonEncode_magicbits(toGrid(center.z, min.z), toGrid(center.y, min.y), toGrid(center.x, min.x));
+
+			keys.push_back({ key, i });
+		}
+
+		std::stable_sort(keys.begin(), keys.end(), [](const auto& a, const auto& b) {
+			return a.first < b.first;
+		});
+
+		vector<Source> ordered;
+		for (const auto& [key, index] : keys) {
+			ordered.push_back(sources[index]);
+		}
+
+		return ordered;
 	}
 
-	void doChunking(const vector<Source> &sources, const string &targetDir, Vector3 min, Vector3 max, State& state, Attributes &outputAttributes) {
+	void doChunking(const Options& options, const vector<Source> &unorderedSources, const string &targetDir, Vector3 min, Vector3 max, State& state, Attributes &outputAttributes, shared_ptr<SealedChunks> sealed) {
 
 		const auto tStart = now();
 
+		sealedChunks = sealed;
+
+		// only the order matters for sealing chunks early. Both passes need the same order, since it determines the spill keys.
+		const vector<Source> sources = sealedChunks != nullptr ? orderSpatially(unorderedSources, min, max) : unorderedSources;
+
 		const int64_t tmp = state.pointsTotal / 20;
 		maxPointsPerChunk = std::min(tmp, int64_t(10'000'000));
+
+		countSample = std::clamp(options.countSample, 0.000'001, 1.0);
+		ioBackend = options.ioBackend;
+		ioQueueDepth = options.ioQueueDepth;
+		dedupCellSize = parseDedup(options);
 #ifdef _DEBUG
 		cout << "maxPointsPerChunk: " << maxPointsPerChunk << endl;
 #endif // _DEBUG
 
+		// the lookup table only allocates memory for occupied regions, so large inputs can use finer grids
 		if (state.pointsTotal < 100'000'000) {
 			gridSize = 128;
 		}else if(state.pointsTotal < 500'000'000){
 			gridSize = 256;
-		} else {
+		} else if (state.pointsTotal < 2'000'000'000) {
 			gridSize = 512;
+		} else if (state.pointsTotal < 10'000'000'000) {
+			gridSize = 1024;
+		} else {
+			gridSize = 2048;
 		}
 
 		state.currentPass = 1;
@@ -1210,32 +2156,80 @@ namespace chunker_countsort_laszip {
 			}
 		}
 
+		const string spillMode = chooseSpillMode(options, sources, outputAttributes, targetDir);
+		state.setValue("decode-once", spillMode);
+
+		chunksInMemory = keepChunksInMemory(options, state, outputAttributes);
+		state.setValue("chunks", chunksInMemory ? "memory" : "arena");
+
+		unique_ptr<PointSpill> pointSpill = nullptr;
+		if (spillMode != "off") {
+			pointSpill = std::make_unique<PointSpill>(spillMode == "memory", targetDir + "/chunks/.spill.bin");
+			spill = pointSpill.get();
+		}
+
 		// COUNT
 		auto grid = countPointsInCells(sources, min, max, gridSize, state, outputAttributes);
 
 		{ // DISTIRBUTE
 			const auto tStartDistribute = now();
 
+			const int plannedMaxPointsPerChunk = maxPointsPerChunk;
+			if (countSample < 1.0) {
+				maxPointsPerChunk = int(double(maxPointsPerChunk) * (1.0 - sampledChunkMargin));
+			}
+
 			auto lut = createLUT(grid, gridSize);
 
+			maxPointsPerChunk = plannedMaxPointsPerChunk;
+
+			if (sealedChunks != nullptr) {
+				const double cubeSize = (max - min).max();
+
+				sealedChunks->start(outputAttributes, min, min + cubeSize);
+			}
+
 			state.currentPass = 2;
 			distributePoints(sources, min, max, targetDir, lut, state, outputAttributes);
 
+			spill = nullptr;
+			pointSpill = nullptr;
+
 			{
 				const double duration = now() - tStartDistribute;
-				state.values["duration(chunking-distribute)"] = formatNumber(duration, 3);
+				state.setValue("duration(chunking-distribute)", formatNumber(duration, 3));
 			}
 		}
 
 		string metadataPath = targetDir + "/chunks/metadata.json";
 		const double cubeSize = (max - min).max();
-		const Vector3 size = { cubeSize, cubeSize, cubeSize };
 		max = min + cubeSize;
 
 		writeMetadata(metadataPath, min, max, outputAttributes);
 
+		delete arena;
+		arena = nullptr;
+
 		const double duration = now() - tStart;
-		state.values["duration(chunking-total)"] = formatNumber(duration, 3);
+		state.setValue("duration(chunking-total)", formatNumber(duration, 3));
+
+		// points decompressed only to reach the start of a task, summed over both passes
+		state.setValue("seek-wasted points(fixed split)", formatNumber(int64_t(seekWastedPointsFixedSplit)));
+		state.setValue("seek-wasted points(chunk-aligned)", formatNumber(int64_t(seekWastedPoints)));
+
+		if (numVariableChunkSources > 0) {
+			state.setValue("sources with variable-sized LAZ chunks(not in seek-wasted)", formatNumber(int64_t(numVariableChunkSources)));
+		}
+
+		if (countSample < 1.0) {
+			state.setValue("count-sample", formatNumber(countSample, 4));
+		}
+
+		// closing hands the state over to the indexer, so all chunker stats must be written by now
+		if (sealedChunks != nullptr) {
+			sealedChunks->close(outputAttributes);
+			sealedChunks = nullptr;
+		}
 
 	}
 
@@ -10,6 +10,7 @@
 #include "PotreeConverter.h"
 #include "brotli/encode.h"
 #include "HierarchyBuilder.h"
+#include "XYZHashSet.h"
 
 using std::unique_lock;
 
@@ -26,12 +27,9 @@ namespace indexer{
 	};
 
 	void sortBreadthFirst(vector<Node*>& nodes) {
+		// keys of lower levels are smaller, see NodeKey
 		sort(nodes.begin(), nodes.end(), [](Node* a, Node* b) {
-			if (a->name.size() != b->name.size()) {
-				return a->name.size() < b->name.size();
-			} else {
-				return a->name < b->name;
-			}
+			return a->key < b->key;
 		});
 	}
 
@@ -49,6 +47,19 @@ namespace indexer{
 		return mask;
 	}
 
+	// bounding box of a chunk, from the child indices in its id
+	BoundingBox boundingBoxOfChunk(const string& chunkID, Vector3 min, Vector3 max) {
+		BoundingBox box = { min, max };
+
+		for (int i = 1; i < chunkID.size(); i++) {
+			const int index = chunkID[i] - '0'; // this feels so wrong...
+
+			box = childBoundingBoxOf(box.min, box.max, index);
+		}
+
+		return box;
+	}
+
 	shared_ptr<Chunks> getChunks(string pathIn) {
 		string chunkDirectory = pathIn + "/chunks";
 
@@ -137,7 +148,60 @@ namespace indexer{
 			return strID;
 		};
 
+		const auto boxOf = [min, max](const string& chunkID) {
+			return boundingBoxOfChunk(chunkID, min, max);
+		};
+
 		vector<shared_ptr<Chunk>> chunksToLoad;
+
+		// chunks that the chunker kept in memory
+		if (js.contains("memory")) {
+			if (chunkMemory == nullptr) {
+				logger::ERROR("the chunks in " + chunkDirectory + " were only kept in memory. Run the chunking step again.");
+				exit(123);
+			}
+
+			for (auto& jsChunk : js["chunks"]) {
+				shared_ptr<Chunk> chunk = make_shared<Chunk>();
+				chunk->id = jsChunk["id"];
+
+				const int64_t index = jsChunk["index"];
+				chunk->bucketsSize = chunkMemory->sizeOf(index);
+				chunk->buckets = chunkMemory->take(index);
+
+				BoundingBox box = boxOf(chunk->id);
+				chunk->min = box.min;
+				chunk->max = box.max;
+
+				chunksToLoad.push_back(chunk);
+			}
+
+			// the chunks own their points now
+			chunkMemory = nullptr;
+		}
+
+		// chunks stored in a single arena file, as written by the chunker
+		if (js.contains("arena")) {
+			const string arenaPath = chunkDirectory + "/" + js["arena"].get<string>();
+
+			for (auto& jsChunk : js["chunks"]) {
+				shared_ptr<Chunk> chunk = make_shared<Chunk>();
+				chunk->file = arenaPath;
+				chunk->id = jsChunk["id"];
+
+				for (auto& jsExtent : jsChunk["extents"]) {
+					chunk->extents.push_back({ jsExtent[0].get<int64_t>(), jsExtent[1].get<int64_t>() });
+				}
+
+				BoundingBox box = boxOf(chunk->id);
+				chunk->min = box.min;
+				chunk->max = box.max;
+
+				chunksToLoad.push_back(chunk);
+			}
+		}
+
+		// chunks stored in individual files
 		for (const auto& entry : fs::directory_iterator(chunkDirectory)) {
 			string filename = entry.path().filename().string();
 			string chunkID = toID(filename);
@@ -150,13 +214,7 @@ namespace indexer{
 			chunk->file = entry.path().string();
 			chunk->id = chunkID;
 
-			BoundingBox box = { min, max };
-
-			for (int i = 1; i < chunkID.size(); i++) {
-				const int index = chunkID[i] - '0'; // this feels so wrong...
-
-				box = childBoundingBoxOf(box.min, box.max, index);
-			}
+			BoundingBox box = boxOf(chunkID);
 
 			chunk->min = box.min;
 			chunk->max = box.max;
@@ -193,28 +251,25 @@ namespace indexer{
 
 	vector<CRNode> Indexer::processChunkRoots(){
 
-		unordered_map<string, shared_ptr<CRNode>> nodesMap;
+		unordered_map<NodeKey, shared_ptr<CRNode>> nodesMap;
 		vector<shared_ptr<CRNode>> nodesList;
 
 		// create/copy nodes
 		this->root->traverse([&nodesMap, &nodesList](Node* node){
 			auto crnode = make_shared<CRNode>();
-			crnode->name = node->name;
+			crnode->key = node->key;
 			crnode->node = node;
-			crnode->children.resize(node->children.size());
 
 			nodesList.push_back(crnode);
-			nodesMap[crnode->name] = crnode;
+			nodesMap[crnode->key] = crnode;
 		});
 
 		// establish hierarchy
 		for(auto crnode : nodesList){
 
-			string parentName = crnode->name.substr(0, crnode->name.size() - 1);
-
-			if(parentName != ""){
-				auto parent = nodesMap[parentName];
-				const int index = crnode->name.at(crnode->name.size() - 1) - '0';
+			if(crnode->key != NodeKey::root()){
+				auto parent = nodesMap[crnode->key.parent()];
+				const int64_t index = crnode->key.childIndex();
 
 				parent->children[index] = crnode;
 			}
@@ -222,14 +277,14 @@ namespace indexer{
 
 		// mark/flag/insert flushed chunk roots
 		for(auto fcr : flushedChunkRoots){
-			auto node = nodesMap[fcr.node->name];
+			auto node = nodesMap[fcr.node->key];
 
 			node->fcrs.push_back(fcr);
 			node->numPoints += fcr.node->numPoints;
 		}
 
 		// recursively merge leaves if sum(points) < threshold
-		auto cr_root = nodesMap["r"];
+		auto cr_root = nodesMap[NodeKey::root()];
 		static int64_t threshold = 5'000'000;
 
 		cr_root->traversePost([](CRNode* node){
@@ -254,7 +309,7 @@ namespace indexer{
 						node->fcrs.insert(node->fcrs.end(), child->fcrs.begin(), child->fcrs.end());
 					}
 
-					node->children.clear();
+					node->children.fill(nullptr);
 				}
 			}
 		});
@@ -262,7 +317,7 @@ namespace indexer{
 		vector<CRNode> tasks;
 		cr_root->traverse([&tasks](CRNode* node){
 #ifdef _DEBUG
-			cout << node->name << ", #points: " << node->numPoints << ", #fcrs: " << node->fcrs.size() << endl;
+			cout << node->key.toString() << ", #points: " << node->numPoints << ", #fcrs: " << node->fcrs.size() << endl;
 #endif // _DEBUG
 
 			if(node->fcrs.size() > 0){
@@ -280,38 +335,20 @@ namespace indexer{
 
 		logger::INFO("start reloadChunkRoots");
 
-		struct LoadTask {
-			shared_ptr<Node> node;
-			int64_t offset;
-			int64_t size;
-
-			LoadTask(shared_ptr<Node> node, int64_t offset, int64_t size) {
-				this->node = node;
-				this->offset = offset;
-				this->size = size;
-			}
-		};
-
-		string targetDir = this->targetDir;
-		TaskPool<LoadTask> pool(16, [targetDir](shared_ptr<LoadTask> task) {
-			string octreePath = targetDir + "/tmpChunkRoots.bin";
-
-			shared_ptr<Node> node = task->node;
-			const int64_t start = task->offset;
-			int64_t size = task->size;
+		string octreePath = this->targetDir + "/tmpChunkRoots.bin";
 
-			auto buffer = make_shared<Buffer>(size);
-			readBinaryFile(octreePath, start, size, buffer->data);
-
-			node->points = buffer;
-		});
+		TaskGroup loads(Scheduler::global());
 
 		for (auto fcr : flushedChunkRoots) {
-			auto task = make_shared<LoadTask>(fcr.node, fcr.offset, fcr.size);
-			pool.addTask(task);
+			loads.run([octreePath, fcr]() {
+				auto buffer = make_shared<Buffer>(fcr.size);
+				readBinaryFile(octreePath, fcr.offset, fcr.size, buffer->data);
+
+				fcr.node->points = buffer;
+			});
 		}
 
-		pool.close();
+		loads.wait();
 
 		logger::INFO("end reloadChunkRoots");
 	}
@@ -521,10 +558,10 @@ HierarchyChunk Indexer::gatherChunk(Node* start, int levels) {
 	// create vector containing start node and all descendants up to and including levels deeper
 	// e.g. start 0 and levels 5 -> all nodes from level 0 to inclusive 5.
 
-	const int64_t startLevel = start->name.size() - 1;
+	const int64_t startLevel = start->level();
 
 	HierarchyChunk chunk;
-	chunk.name = start->name;
+	chunk.key = start->key;
 
 	vector<Node*> stack = { start };
 	while (!stack.empty()) {
@@ -533,7 +570,7 @@ HierarchyChunk Indexer::gatherChunk(Node* start, int levels) {
 
 		chunk.nodes.push_back(node);
 
-		const int64_t childLevel = node->name.size();
+		const int64_t childLevel = node->level() + 1;
 		if (childLevel <= startLevel + levels) {
 
 			for (auto child : node->children) {
@@ -594,21 +631,21 @@ Hierarchy Indexer::createHierarchy(string path) {
 		stringstream ss;
 
 		for(auto node : chunk.nodes){
-			ss << node->name << endl;
+			ss << node->name() << endl;
 		}
 
 
-		writeFile(dbgChunksPath + "/" + chunk.name + ".txt", ss.str());
+		writeFile(dbgChunksPath + "/" + chunk.key.toString() + ".txt", ss.str());
 	}
 #endif // _DEBUG
 
-	unordered_map<string, int> chunkPointers;
+	unordered_map<NodeKey, int> chunkPointers;
 	vector<int64_t> chunkByteOffsets(chunks.size(), 0);
 	int64_t hierarchyBufferSize = 0;
 
 	for (size_t i = 0; i < chunks.size(); i++) {
 		auto& chunk = chunks[i];
-		chunkPointers[chunk.name] = i;
+		chunkPointers[chunk.key] = i;
 
 		sortBreadthFirst(chunk.nodes);
 
@@ -630,7 +667,7 @@ Hierarchy Indexer::createHierarchy(string path) {
 	int offset = 0;
 	for (int i = 0; i < chunks.size(); i++) {
 		auto& chunk = chunks[i];
-		const auto chunkLevel = chunk.name.size() - 1;
+		const auto chunkLevel = chunk.key.level();
 
 		for (auto node : chunk.nodes) {
 			const bool isProxy = node->level() == chunkLevel + hierarchyStepSize;
@@ -642,7 +679,7 @@ Hierarchy Indexer::createHierarchy(string path) {
 			uint8_t type = node->isLeaf() ? TYPE::LEAF : TYPE::NORMAL;
 
 			if (isProxy) {
-				const int targetChunkIndex = chunkPointers[node->name];
+				const int targetChunkIndex = chunkPointers[node->key];
 				auto targetChunk = chunks[targetChunkIndex];
 
 				type = TYPE::PROXY;
@@ -675,7 +712,8 @@ Hierarchy Indexer::createHierarchy(string path) {
 
 
 struct NodeCandidate {
-	string name = "";
+	// child indices from the refined node down to this candidate, 3 bits per level, see NodeKey
+	uint64_t path = 0;
 	int64_t indexStart = 0;
 	int64_t numPoints = 0;
 	int64_t level = 0;
@@ -752,7 +790,7 @@ vector<NodeCandidate> createNodes(vector<vector<int64_t>>& pyramid) {
 	const auto maxLevel = pyramid.size() - 1;
 
 	NodeCandidate root;
-	root.name = "";
+	root.path = 0;
 	root.level = 0;
 	root.x = 0;
 	root.y = 0;
@@ -791,7 +829,7 @@ vector<NodeCandidate> createNodes(vector<vector<int64_t>>& pyramid) {
 				if (count > 0) {
 					NodeCandidate child;
 					child.level = level + 1;
-					child.name = candidate.name + to_string(i);
+					child.path = (candidate.path << 3) | uint64_t(i);
 					child.indexStart = pyramidOffsets[level + 1][index_p1];
 					child.numPoints = count;
 					child.x = 2 * x + ((i & 0b100) >> 2);
@@ -812,10 +850,105 @@ vector<NodeCandidate> createNodes(vector<vector<int64_t>>& pyramid) {
 	return nodes;
 }
 
+// Maps the integer coordinates along one axis to the cells of a counting grid over [min, min + size).
+// bounds[k] is the smallest integer coordinate in cell k or above. Found by bisection of the floating point mapping,
+// cellOf() then finds the cell of a coordinate with integer comparisons only.
+struct CellBounds {
+
+	int64_t bounds[32];
+	int64_t gridSize = 0;
+
+	CellBounds(double min, double size, double scale, double offset, int64_t gridSize) {
+		this->gridSize = gridSize;
+
+		// the mapping that buildHierarchy used to evaluate for each point
+		const auto cellOfScaled = [=](int64_t X) {
+			const double x = (X * scale) + offset;
+			int64_t i = double(gridSize) * (x - min) / size;
+
+			return std::max(int64_t(0), std::min(i, gridSize - 1));
+		};
+
+		bounds[0] = std::numeric_limits<int32_t>::min();
+
+		for (int64_t k = 1; k < gridSize; k++) {
+			int64_t low = std::numeric_limits<int32_t>::min();
+			int64_t high = int64_t(std::numeric_limits<int32_t>::max()) + 1;
+
+			while (low < high) {
+				const int64_t mid = low + (high - low) / 2;
+
+				if (cellOfScaled(mid) >= k) {
+					high = mid;
+				} else {
+					low = mid + 1;
+				}
+			}
+
+			bounds[k] = low;
+		}
+	}
+
+	int64_t cellOf(int32_t X) const {
+		int64_t cell = 0;
+
+		for (int64_t step = gridSize / 2; step > 0; step /= 2) {
+			cell += (X >= bounds[cell + step]) ? step : 0;
+		}
+
+		return cell;
+	}
+
+};
+
+// Reorders the <bpp>-sized records of <data> by their cell, in place (american flag sort).
+// Each record is swapped into its final location at most once. <cells> is reordered along with the records.
+void partitionInPlace(uint8_t* data, int64_t bpp, vector<uint16_t>& cells, const vector<int64_t>& counters) {
+
+	const int64_t numCells = counters.size();
+
+	vector<int64_t> next(numCells, 0);
+	vector<int64_t> end(numCells, 0);
+
+	for (int64_t i = 0, offset = 0; i < numCells; i++) {
+		next[i] = offset;
+		offset += counters[i];
+		end[i] = offset;
+	}
+
+	vector<uint8_t> tmp(bpp);
+
+	for (int64_t cell = 0; cell < numCells; cell++) {
+		while (next[cell] < end[cell]) {
+			const int64_t i = next[cell];
+			const int64_t target = cells[i];
+
+			if (target == cell) {
+				next[cell]++;
+				continue;
+			}
+
+			const int64_t j = next[target]++;
+
+			memcpy(tmp.data(), data + i * bpp, bpp);
+			memcpy(data + i * bpp, data + j * bpp, bpp);
+			memcpy(data + j * bpp, tmp.data(), bpp);
+
+			std::swap(cells[i], cells[j]);
+		}
+	}
+
+}
+
 // 1. Counter grid
 // 2. Hierarchy from counter grid
 // 3. identify nodes that need further refinment
 // 4. Recursively repeat at 1. for identified nodes
+//
+// Nodes with at least this many points are refined in jobs of their own, so that dense regions of a
+// chunk are split up by all idle workers instead of only the one that processes the chunk.
+constexpr int64_t minPointsForParallelRefinement = 10 * maxPointsPerChunk;
+
 void buildHierarchy(Indexer* indexer, Node* node, shared_ptr<Buffer> points, int64_t numPoints, int64_t depth = 0) {
 
 	if (numPoints < maxPointsPerChunk) {
@@ -828,9 +961,24 @@ void buildHierarchy(Indexer* indexer, Node* node, shared_ptr<Buffer> points, int
 	}
 
 
+	constexpr int64_t levels = 5; // = gridSize 32
+
+	if (node->level() + levels > NodeKey::maxLevel) {
+		// can't address nodes that deep. Only happens with many points at nearly the same position.
+		stringstream ss;
+		ss << "node " << node->name() << " exceeds the maximum depth of " << NodeKey::maxLevel << " levels. ";
+		ss << "Keeping its " << numPoints << " points in a leaf.";
+		logger::WARN(ss.str());
+
+		node->indexStart = 0;
+		node->numPoints = numPoints;
+		node->points = points;
+
+		return;
+	}
+
 	const auto tStart = now();
 
-	constexpr int64_t levels = 5; // = gridSize 32
 	const int64_t counterGridSize = pow(2, levels);
 	vector<int64_t> counters(counterGridSize * counterGridSize * counterGridSize, 0);
 
@@ -842,47 +990,40 @@ void buildHierarchy(Indexer* indexer, Node* node, shared_ptr<Buffer> points, int
 	const auto scale = attributes.posScale;
 	const auto offset = attributes.posOffset;
 
-	const auto gridIndexOf = [&points, bpp, scale, offset, min, size, counterGridSize](int64_t pointIndex) {
-
-		const int64_t pointOffset = pointIndex * bpp;
-		const int32_t* xyz = reinterpret_cast<int32_t*>(points->data_u8 + pointOffset);
-
-		const double x = (xyz[0] * scale.x) + offset.x;
-		const double y = (xyz[1] * scale.y) + offset.y;
-		const double z = (xyz[2] * scale.z) + offset.z;
-
-		int64_t ix = double(counterGridSize) * (x - min.x) / size.x;
-		int64_t iy = double(counterGridSize) * (y - min.y) / size.y;
-		int64_t iz = double(counterGridSize) * (z - min.z) / size.z;
-
-		ix = std::max(int64_t(0), std::min(ix, counterGridSize - 1));
-		iy = std::max(int64_t(0), std::min(iy, counterGridSize - 1));
-		iz = std::max(int64_t(0), std::min(iz, counterGridSize - 1));
-
-		const int64_t index = mortonEncode_magicbits(iz, iy, ix);
-
-		return index;
-	};
+	// Cells are computed from the integer coordinates, see CellBounds. They match the cells of
+	// the scaled and offset coordinates exactly, so the resulting hierarchy doesn't change.
+	const CellBounds boundsX(min.x, size.x, scale.x, offset.x, counterGridSize);
+	const CellBounds boundsY(min.y, size.y, scale.y, offset.y, counterGridSize);
+	const CellBounds boundsZ(min.z, size.z, scale.z, offset.z, counterGridSize);
+
+	// morton code of the cell, split into the contribution of each axis
+	uint32_t mortonX[32], mortonY[32], mortonZ[32];
+	for (int64_t i = 0; i < counterGridSize; i++) {
+		mortonX[i] = mortonEncode_magicbits(0, 0, i);
+		mortonY[i] = mortonEncode_magicbits(0, i, 0);
+		mortonZ[i] = mortonEncode_magicbits(i, 0, 0);
+	}
 
 	// COUNTING
+	// the cell of each point is computed once, and reused for distributing
+	vector<uint16_t> cells(numPoints);
 	for (int64_t i = 0; i < numPoints; i++) {
-		const auto index = gridIndexOf(i);
+		const int32_t* xyz = reinterpret_cast<int32_t*>(points->data_u8 + i * bpp);
+
+		const uint16_t index = mortonX[boundsX.cellOf(xyz[0])] | mortonY[boundsY.cellOf(xyz[1])] | mortonZ[boundsZ.cellOf(xyz[2])];
+
+		cells[i] = index;
 		counters[index]++;
 	}
 
 	{ // DISTRIBUTING
-		vector<int64_t> offsets(counters.size(), 0);
-		for (int64_t i = 1; i < counters.size(); i++) {
-			offsets[i] = offsets[i - 1] + counters[i - 1];
-		}
-
 		if(numPoints * bpp < 0){
 			stringstream ss;
 
 			const auto size = numPoints * bpp;
 			ss << "invalid call to malloc(" << to_string(size) << ")\n";
 			ss << "in function buildHierarchy()\n";
-			ss << "node: " << node->name << "\n";
+			ss << "node: " << node->name() << "\n";
 			ss << "#points: " << node->numPoints<< "\n";
 			ss << "min: " << node->min.toString() << "\n";
 			ss << "max: " << node->max.toString() << "\n";
@@ -890,16 +1031,7 @@ void buildHierarchy(Indexer* indexer, Node* node, shared_ptr<Buffer> points, int
 			logger::ERROR(ss.str());
 		}
 
-		Buffer tmp(numPoints * bpp);
-
-		for (int64_t i = 0; i < numPoints; i++) {
-			const auto index = gridIndexOf(i);
-			const auto targetIndex = offsets[index]++;
-
-			memcpy(tmp.data_u8 + targetIndex * bpp, points->data_u8 + i * bpp, bpp);
-		}
-
-		memcpy(points->data, tmp.data, numPoints * bpp);
+		partitionInPlace(points->data_u8, bpp, cells, counters);
 	}
 
 	auto pyramid = createSumPyramid(counters, counterGridSize);
@@ -908,25 +1040,16 @@ void buildHierarchy(Indexer* indexer, Node* node, shared_ptr<Buffer> points, int
 
 	const auto expandTo = [node](NodeCandidate& candidate) {
 
-		string startName = node->name;
-		string fullName = startName + candidate.name;
-
-		// e.g. startName: r, fullName: r031
-		// start iteration with char at index 1: "0"
+		// e.g. path 0b000'011'001 at level 3 -> children 0, 3 and 1 of node
 
 		Node* currentNode = node;
-		for (int64_t i = startName.size(); i < fullName.size(); i++) {
-			const int64_t index = fullName.at(i) - '0';
+		for (int64_t i = candidate.level - 1; i >= 0; i--) {
+			const int64_t index = (candidate.path >> (3 * i)) & 0b111;
 
 			if (currentNode->children[index] == nullptr) {
 				const auto childBox = childBoundingBoxOf(currentNode->min, currentNode->max, index);
-				string childName = currentNode->name + to_string(index);
 
-				shared_ptr<Node> child = make_shared<Node>();
-				child->min = childBox.min;
-				child->max = childBox.max;
-				child->name = childName;
-				child->children.resize(8);
+				shared_ptr<Node> child = makeNode(currentNode->key.child(index), childBox.min, childBox.max);
 
 				currentNode->children[index] = child;
 				currentNode = child.get();
@@ -955,7 +1078,7 @@ void buildHierarchy(Indexer* indexer, Node* node, shared_ptr<Buffer> points, int
 
 			ss << "invalid call to malloc(" << to_string(bytes) << ")\n";
 			ss << "in function buildHierarchy()\n";
-			ss << "node: " << node->name << "\n";
+			ss << "node: " << node->name() << "\n";
 			ss << "#points: " << node->numPoints << "\n";
 			ss << "min: " << node->min.toString() << "\n";
 			ss << "max: " << node->max.toString() << "\n";
@@ -963,13 +1086,8 @@ void buildHierarchy(Indexer* indexer, Node* node, shared_ptr<Buffer> points, int
 			logger::ERROR(ss.str());
 		}
 
-		auto buffer = make_shared<Buffer>(bytes);
-		memcpy(buffer->data,
-			points->data_u8 + candidate.indexStart * bpp,
-			candidate.numPoints * bpp
-		);
-
-		realization->points = buffer;
+		// a view of the partitioned points. Refining it later on partitions it in place, again.
+		realization->points = make_shared<Buffer>(points, candidate.indexStart * bpp, bytes);
 
 		if (realization->numPoints > maxPointsPerChunk) {
 			needRefinement.push_back(realization);
@@ -984,6 +1102,9 @@ void buildHierarchy(Indexer* indexer, Node* node, shared_ptr<Buffer> points, int
 		indexer->octreeDepth = std::max(indexer->octreeDepth, octreeDepth);
 	}
 
+	// subtrees are disjoint, so they can be refined concurrently
+	TaskGroup refinements(Scheduler::current());
+
 	constexpr int64_t sanityCheck = 0;
 	for (int64_t nodeIndex = 0; nodeIndex < needRefinement.size(); nodeIndex++) {
 		auto subject = needRefinement[nodeIndex];
@@ -996,28 +1117,24 @@ void buildHierarchy(Indexer* indexer, Node* node, shared_ptr<Buffer> points, int
 		if (subject->numPoints == numPoints) {
 			// the subsplit has the same number of points than the input -> ERROR
 
-			unordered_map<string, int> counters;
-
 			const auto bpp = attributes.bytes;
 
-			for (int64_t i = 0; i < numPoints; i++) {
-
-				const int64_t sourceOffset = i * bpp;
-
-				int32_t X, Y, Z;
-				memcpy(&X, buffer->data_u8 + sourceOffset + 0, 4);
-				memcpy(&Y, buffer->data_u8 + sourceOffset + 4, 4);
-				memcpy(&Z, buffer->data_u8 + sourceOffset + 8, 4);
+			// first occurrence of each distinct position
+			vector<int64_t> distinct;
+			{
+				XYZHashSet positions(numPoints);
 
-				stringstream ss;
-				ss << X << ", " << Y << ", " << Z;
+				for (int64_t i = 0; i < numPoints; i++) {
+					const int32_t* xyz = reinterpret_cast<int32_t*>(buffer->data_u8 + i * bpp);
 
-				const string key = ss.str();
-				counters[key]++;
+					if (positions.insert(xyz[0], xyz[1], xyz[2])) {
+						distinct.push_back(i);
+					}
+				}
 			}
 
 			const int64_t numPointsInBox = subject->numPoints;
-			const int64_t numUniquePoints = counters.size();
+			const int64_t numUniquePoints = distinct.size();
 			const int64_t numDuplicates = numPointsInBox - numUniquePoints;
 
 			if (numDuplicates < maxPointsPerChunk / 2) {
@@ -1033,39 +1150,7 @@ void buildHierarchy(Indexer* indexer, Node* node, shared_ptr<Buffer> points, int
 				logger::WARN(ss.str());
 			} else {
 
-				// remove the duplicates, then try again
-
-				vector<int64_t> distinct;
-				unordered_map<string, int> handled;
-
-				const auto contains = [](auto const & map, auto const & key) {
-					return map.find(key) != map.end();
-				};
-
-				for (int64_t i = 0; i < numPoints; i++) {
-
-					const int64_t sourceOffset = i * bpp;
-
-					int32_t X, Y, Z;
-					memcpy(&X, buffer->data_u8 + sourceOffset + 0, 4);
-					memcpy(&Y, buffer->data_u8 + sourceOffset + 4, 4);
-					memcpy(&Z, buffer->data_u8 + sourceOffset + 8, 4);
-
-					stringstream ss;
-					ss << X << ", " << Y << ", " << Z;
-
-					const string key = ss.str();
-
-					if (contains(counters, key)) {
-						if (!contains(handled, key)) {
-							distinct.push_back(i);
-							handled[key] = true;
-						}
-					} else {
-						distinct.push_back(i);
-					}
-
-				}
+				// remove the duplicates, then refine the remaining points
 
 #ifdef _DEBUG
 				cout << "#distinct: " << distinct.size() << endl;
@@ -1082,14 +1167,14 @@ void buildHierarchy(Indexer* indexer, Node* node, shared_ptr<Buffer> points, int
 				const shared_ptr<Buffer> distinctBuffer = make_shared<Buffer>(distinct.size() * bpp);
 
 				for(int64_t i = 0; i < distinct.size(); i++){
-					distinctBuffer->write(buffer->data_u8 + i * bpp, bpp);
+					distinctBuffer->write(buffer->data_u8 + distinct[i] * bpp, bpp);
 				}
 
 				subject->points = distinctBuffer;
 				subject->numPoints = distinct.size();
 
-				// try again
-				nodeIndex--;
+				// refine the distinct points, not the original records
+				buffer = distinctBuffer;
 			}
 
 		}
@@ -1099,9 +1184,17 @@ void buildHierarchy(Indexer* indexer, Node* node, shared_ptr<Buffer> points, int
 		subject->points = nullptr;
 		subject->numPoints = 0;
 
-		buildHierarchy(indexer, subject, buffer, nextNumPoins, depth + 1);
+		if (nextNumPoins >= minPointsForParallelRefinement) {
+			refinements.run([indexer, subject, buffer, nextNumPoins, depth]() {
+				buildHierarchy(indexer, subject, buffer, nextNumPoins, depth + 1);
+			});
+		} else {
+			buildHierarchy(indexer, subject, buffer, nextNumPoins, depth + 1);
+		}
 	}
 
+	refinements.wait();
+
 }
 
 struct MortonCode {
@@ -1344,7 +1437,7 @@ shared_ptr<Buffer> compress(Node* node, Attributes attributes) {
 
 		if (success == BROTLI_FALSE) {
 			stringstream ss;
-			ss << "failed to compress node " << node->name << ". aborting conversion." ;
+			ss << "failed to compress node " << node->name() << ". aborting conversion." ;
 			logger::ERROR(ss.str());
 
 			exit(123);
@@ -1397,19 +1490,61 @@ Writer::Writer(Indexer* indexer) {
 	this->indexer = indexer;
 
 	string octreePath = indexer->targetDir + "/octree.bin";
-	fsOctree.open(octreePath, ios::out | ios::binary);
+	octreeFile = make_shared<PositionalFile>(octreePath, true);
+
+	if (!octreeFile->isOpen()) {
+		logger::ERROR("failed to create " + octreePath);
+		exit(123);
+	}
 
-	launchWriterThread();
+	io = createAsyncIOBackend(indexer->options.ioBackend, indexer->options.ioQueueDepth);
+
+	for (int64_t i = 0; i < numPooledBuffers; i++) {
+		freeBuffers.push_back(make_shared<Buffer>(capacity));
+	}
+
+	io->registerBuffers(freeBuffers);
 }
 
-mutex mtx_backlog;
 int64_t Writer::backlogSizeMB() {
-	lock_guard<mutex> lock(mtx_backlog);
+	return backlogBytes / (1024 * 1024);
+}
 
-	const int64_t backlogBytes = backlog.size() * capacity;
-	const int64_t backlogMB = backlogBytes / (1024 * 1024);
+shared_ptr<Buffer> Writer::acquireBuffer(int64_t size) {
 
-	return backlogMB;
+	if (size == capacity && !freeBuffers.empty()) {
+		auto buffer = freeBuffers.back();
+		freeBuffers.pop_back();
+
+		return buffer;
+	}
+
+	return make_shared<Buffer>(size);
+}
+
+void Writer::submit(shared_ptr<OctreeBuffer> octreeBuffer) {
+
+	const int64_t numBytes = octreeBuffer->reserved;
+
+	AsyncWrite write;
+	write.file = octreeFile;
+	write.offset = octreeBuffer->fileOffset;
+	write.buffer = octreeBuffer->buffer;
+	write.size = numBytes;
+	write.onComplete = [this, numBytes](shared_ptr<Buffer> buffer) {
+		indexer->bytesWritten += numBytes;
+		indexer->bytesToWrite -= numBytes;
+		indexer->bytesInMemory -= numBytes;
+		backlogBytes -= numBytes;
+
+		// recycle buffers of the regular size
+		lock_guard<mutex> lock(mtx);
+		if (buffer->size == capacity && freeBuffers.size() < numPooledBuffers) {
+			freeBuffers.push_back(buffer);
+		}
+	};
+
+	io->submit(write);
 }
 
 void Writer::writeAndUnload(Node* node) {
@@ -1437,7 +1572,7 @@ void Writer::writeAndUnload(Node* node) {
 
 			ss << "invalid call to malloc(" << to_string(size) << ")\n";
 			ss << "in function writeAndUnload()\n";
-			ss << "node: " << node->name << "\n";
+			ss << "node: " << node->name() << "\n";
 			ss << "#points: " << node->numPoints << "\n";
 			ss << "min: " << node->min.toString() << "\n";
 			ss << "max: " << node->max.toString() << "\n";
@@ -1446,7 +1581,8 @@ void Writer::writeAndUnload(Node* node) {
 		}
 	};
 
-	shared_ptr<Buffer> buffer = nullptr;
+	shared_ptr<OctreeBuffer> target = nullptr;
+	shared_ptr<OctreeBuffer> ready = nullptr;
 	int64_t targetOffset = 0;
 	{
 		lock_guard<mutex> lock(mtx);
@@ -1454,92 +1590,164 @@ void Writer::writeAndUnload(Node* node) {
 		const int64_t byteOffset = indexer->byteOffset.fetch_add(byteSize);
 		node->byteOffset = byteOffset;
 
-		if (activeBuffer == nullptr) {
-			errorCheck(capacity);
-			activeBuffer = make_shared<Buffer>(capacity);
-		} else if (activeBuffer->pos + byteSize > capacity) {
-			backlog.push_back(activeBuffer);
+		const bool fits = activeBuffer != nullptr && activeBuffer->reserved + byteSize <= activeBuffer->buffer->size;
+
+		if (!fits) {
+			if (activeBuffer != nullptr) {
+				activeBuffer->sealed = true;
+				backlogBytes += activeBuffer->reserved;
+
+				if (activeBuffer->copied == activeBuffer->reserved) {
+					ready = activeBuffer;
+				}
+			}
+
+			const int64_t size = std::max(capacity, byteSize);
+			errorCheck(size);
 
-			capacity = std::max(capacity, byteSize);
-			errorCheck(capacity);
-			activeBuffer = make_shared<Buffer>(capacity);
+			activeBuffer = make_shared<OctreeBuffer>();
+			activeBuffer->buffer = acquireBuffer(size);
+			activeBuffer->fileOffset = byteOffset;
 		}
 
-		buffer = activeBuffer;
-		targetOffset = activeBuffer->pos;
+		target = activeBuffer;
+		targetOffset = activeBuffer->reserved;
 
-		activeBuffer->pos += byteSize;
+		activeBuffer->reserved += byteSize;
 	}
 
-	memcpy(buffer->data_char + targetOffset, sourceBuffer->data, byteSize);
+	memcpy(target->buffer->data_char + targetOffset, sourceBuffer->data, byteSize);
 
 	node->points = nullptr;
+
+	// the last copy into a sealed buffer submits it
+	shared_ptr<OctreeBuffer> completed = nullptr;
+	{
+		lock_guard<mutex> lock(mtx);
+
+		target->copied += byteSize;
+
+		if (target->sealed && target->copied == target->reserved) {
+			completed = target;
+		}
+	}
+
+	// submit outside the lock, since it blocks while the queue of the backend is full
+	if (ready != nullptr) {
+		submit(ready);
+	}
+
+	if (completed != nullptr) {
+		submit(completed);
+	}
 }
 
-void Writer::launchWriterThread() {
-	thread([&]() {
+void Writer::closeAndWait() {
+	if (closed) {
+		return;
+	}
 
-		while (true) {
+	shared_ptr<OctreeBuffer> ready = nullptr;
+	{
+		lock_guard<mutex> lock(mtx);
 
-			shared_ptr<Buffer> buffer = nullptr;
+		if (activeBuffer != nullptr) {
+			activeBuffer->sealed = true;
+			backlogBytes += activeBuffer->reserved;
 
-			{
-				lock_guard<mutex> lock(mtx);
+			// all nodes are written by now, so nothing is still being copied
+			ready = activeBuffer;
+			activeBuffer = nullptr;
+		}
+	}
 
-				if (backlog.size() > 0) {
-					buffer = backlog.front();
-					backlog.pop_front();
-				} else if (backlog.size() == 0 && closeRequested) {
-					// DONE! No more work and close requested. quit thread.
+	if (ready != nullptr && ready->reserved > 0) {
+		submit(ready);
+	}
 
-					cvClose.notify_one();
+	io->drain();
 
-					break;
-				}
-			}
+	octreeFile = nullptr;
+	closed = true;
+}
 
-			if (buffer != nullptr) {
-				const int64_t numBytes = buffer->pos;
-				indexer->bytesWritten += numBytes;
-				indexer->bytesToWrite -= numBytes;
 
-				fsOctree.write(buffer->data_char, numBytes);
 
-				indexer->bytesInMemory -= numBytes;
-			} else {
-				using namespace std::chrono_literals;
-				std::this_thread::sleep_for(10ms);
-			}
 
-		}
 
-	}).detach();
+
+
+// Estimated cost of indexing a chunk, in points times levels. buildHierarchy and the samplers touch every point
+// of the chunk about once per level below the chunk root at <level>. Point clouds are mostly surfaces, so the number
+// of nodes roughly quadruples with each level, until they hold fewer than maxPointsPerChunk points.
+// Chunks deep in the octree run out of levels before that, their leaves then keep the remaining points.
+double estimateIndexingCost(int64_t numPoints, int64_t level) {
+	const double levelsUntilSmall = std::log(double(numPoints) / double(maxPointsPerChunk)) / std::log(4.0);
+	const double levelsLeft = double(NodeKey::maxLevel - level);
+	const double depth = std::clamp(levelsUntilSmall, 0.0, std::max(levelsLeft, 0.0));
+
+	return double(numPoints) * (1.0 + depth);
 }
 
-void Writer::closeAndWait() {
-	if (closed) {
-		return;
-	}
+// Chunks are indexed largest first, so that no large chunk starts when all others are done.
+// The cost estimates are calibrated with the durations of the chunks that are already done,
+// to predict the duration of the next chunks and the critical path of the indexing phase.
+struct IndexingSchedule {
+
+	mutex mtx;
+	// chunks indexed concurrently. Measured durations are wall-clock times while sharing the cores.
+	int64_t numThreads = 1;
+
+	double totalCost = 0.0;
+	double maxCost = 0.0;
+
+	// of the chunks that are done
+	double measuredCost = 0.0;
+	double measuredSeconds = 0.0;
+	double maxSeconds = 0.0;
+	double sumRelativeError = 0.0;
+	int64_t numPredicted = 0;
 
-	unique_lock<mutex> lock(mtx);
-	if (activeBuffer != nullptr) {
-		backlog.push_back(activeBuffer);
+	void add(double cost) {
+		lock_guard<mutex> lock(mtx);
+
+		totalCost += cost;
+		maxCost = std::max(maxCost, cost);
 	}
 
-	closeRequested = true;
-	cvClose.wait(lock);
+	// predicted seconds, or -1 until the first chunk is done
+	double predict(double cost) {
+		lock_guard<mutex> lock(mtx);
 
-	fsOctree.close();
+		return measuredCost > 0.0 ? cost * (measuredSeconds / measuredCost) : -1.0;
+	}
 
-}
+	void finished(double cost, double predicted, double seconds) {
+		lock_guard<mutex> lock(mtx);
 
+		measuredCost += cost;
+		measuredSeconds += seconds;
+		maxSeconds = std::max(maxSeconds, seconds);
 
+		if (predicted > 0.0 && seconds > 0.0) {
+			sumRelativeError += std::abs(predicted - seconds) / seconds;
+			numPredicted++;
+		}
+	}
 
+	// Shortest possible duration of the chunk phase: it can't be shorter than the largest chunk,
+	// nor than the work of all chunks spread evenly over all threads.
+	double criticalPath() {
+		lock_guard<mutex> lock(mtx);
 
+		const double secondsPerCost = measuredCost > 0.0 ? measuredSeconds / measuredCost : 0.0;
 
+		return std::max(maxCost, totalCost / double(numThreads)) * secondsPerCost;
+	}
 
+};
 
-void doIndexing(string targetDir, State& state, Options& options, Sampler& sampler) {
+void doIndexing(string targetDir, State& state, Options& options, Sampler& sampler, shared_ptr<SealedChunks> sealedChunks) {
 
 	cout << endl;
 	cout << "=======================================" << endl;
@@ -1548,19 +1756,36 @@ void doIndexing(string targetDir, State& state, Options& options, Sampler& sampl
 
 	const auto tStart = now();
 
-	state.name = "INDEXING";
-	state.currentPass = 3;
-	state.pointsProcessed = 0;
-	state.bytesProcessed = 0;
-	state.duration = 0;
+	// while the chunker is running, it reports the progress
+	std::atomic_bool reportProgress = sealedChunks == nullptr;
+
+	if (reportProgress) {
+		state.setName("INDEXING");
+		state.currentPass = 3;
+		state.pointsProcessed = 0;
+		state.bytesProcessed = 0;
+		state.duration = 0;
+	}
+
+	shared_ptr<Chunks> chunks = nullptr;
+	if (sealedChunks != nullptr) {
+		if (!sealedChunks->waitForStart()) {
+			logger::ERROR("chunking finished without creating any chunks");
+			exit(123);
+		}
+
+		// the list is filled as chunks are sealed
+		chunks = make_shared<Chunks>(vector<shared_ptr<Chunk>>(), sealedChunks->min, sealedChunks->max);
+		chunks->attributes = sealedChunks->attributes;
+	} else {
+		chunks = getChunks(targetDir);
+	}
 
-	auto chunks = getChunks(targetDir);
 	auto attributes = chunks->attributes;
 
-	Indexer indexer(targetDir);
-	indexer.options = options;
+	Indexer indexer(targetDir, options);
 	indexer.attributes = attributes;
-	indexer.root = make_shared<Node>("r", chunks->min, chunks->max);
+	indexer.root = makeNode(NodeKey::root(), chunks->min, chunks->max);
 	indexer.spacing = (chunks->max - chunks->min).x / 128.0;
 
 	auto onNodeCompleted = [&indexer](Node* node) {
@@ -1572,16 +1797,20 @@ void doIndexing(string targetDir, State& state, Options& options, Sampler& sampl
 
 	struct Task {
 		shared_ptr<Chunk> chunk;
+		double cost = 0.0;
 
-		Task(shared_ptr<Chunk> chunk) {
+		Task(shared_ptr<Chunk> chunk, double cost) {
 			this->chunk = chunk;
+			this->cost = cost;
 		}
 	};
 
-	int64_t totalPoints = 0;
+	IndexingSchedule schedule;
+
+	int64_t totalPoints = sealedChunks != nullptr ? int64_t(state.pointsTotal) : 0;
 	int64_t totalBytes = 0;
 	for (auto chunk : chunks->list) {
-		auto filesize = fs::file_size(chunk->file);
+		auto filesize = chunk->size();
 		totalPoints += filesize / attributes.bytes;
 		totalBytes += filesize;
 	}
@@ -1597,17 +1826,21 @@ void doIndexing(string targetDir, State& state, Options& options, Sampler& sampl
 	mutex mtx_nodes;
 	vector<shared_ptr<Node>> nodes;
 	const int numThreads = getCpuData().numProcessors + 4;
-	TaskPool<Task> pool(numThreads, [&onNodeCompleted, &onNodeDiscarded, &writeAndUnload, &state, &options, &activeThreads, tStart, &lastReport, &totalPoints, totalBytes, &pointsProcessed, chunks, &indexer, &nodes, &mtx_nodes, &sampler](auto task) {
+	schedule.numThreads = Scheduler::global().numThreads();
+	TaskPool<Task> pool(numThreads, [&onNodeCompleted, &onNodeDiscarded, &writeAndUnload, &state, &options, &activeThreads, tStart, &lastReport, &totalPoints, totalBytes, &pointsProcessed, chunks, &indexer, &nodes, &mtx_nodes, &sampler, &reportProgress, &schedule](auto task) {
 
 		auto chunk = task->chunk;
-		auto chunkRoot = make_shared<Node>(chunk->id, chunk->min, chunk->max);
+		auto chunkRoot = makeNode(NodeKey::fromString(chunk->id), chunk->min, chunk->max);
 		auto attributes = chunks->attributes;
 		const int64_t bpp = attributes.bytes;
 
 		indexer.waitUntilWriterBacklogBelow(1'000);
 		activeThreads++;
 
-		auto filesize = fs::file_size(chunk->file);
+		const double tStartTask = now();
+		const double predicted = schedule.predict(task->cost);
+
+		auto filesize = chunk->size();
 
 		stringstream msg;
 		msg << "start indexing chunk " + chunk->id << "\n";
@@ -1617,11 +1850,12 @@ void doIndexing(string targetDir, State& state, Options& options, Sampler& sampl
 		logger::INFO(msg.str());
 
 		indexer.bytesInMemory += filesize;
-		const auto pointBuffer = readBinaryFile(chunk->file);
+		const auto pointBuffer = chunk->read();
 
 		const auto tStartChunking = now();
 
-		if (!options.keepChunks) {
+		// the arena is removed once all chunks are indexed
+		if (!options.keepChunks && chunk->extents.empty() && !chunk->inMemory()) {
 			fs::remove(chunk->file);
 		}
 
@@ -1633,22 +1867,25 @@ void doIndexing(string targetDir, State& state, Options& options, Sampler& sampl
 
 		// detach anything below the chunk root. Will be reloaded from
 		// temporarily flushed hierarchy during creation of the hierarchy file
-		chunkRoot->children.clear();
+		chunkRoot->children.fill(nullptr);
 
 		indexer.flushChunkRoot(chunkRoot);
 
 		// add chunk root, provided it isn't the root.
-		if (chunkRoot->name.size() > 1) {
+		if (chunkRoot->level() > 0) {
 			indexer.root->addDescendant(chunkRoot);
 		}
 
+		const double duration = now() - tStartTask;
+		schedule.finished(task->cost, predicted, duration);
+
 		const lock_guard<mutex> lock(mtx_nodes);
 
 		pointsProcessed = pointsProcessed + numPoints;
 		const double progress = double(pointsProcessed) / double(totalPoints);
 
 
-		if (now() - lastReport > 1.0) {
+		if (reportProgress && now() - lastReport > 1.0) {
 			state.pointsProcessed = pointsProcessed;
 			state.duration = now() - tStart;
 
@@ -1657,19 +1894,83 @@ void doIndexing(string targetDir, State& state, Options& options, Sampler& sampl
 
 		nodes.push_back(chunkRoot);
 
-		logger::INFO("finished indexing chunk " + chunk->id);
+		stringstream msgFinished;
+		msgFinished << "finished indexing chunk " << chunk->id << ", duration: " << formatNumber(duration, 3) << "s";
+		if (predicted > 0.0) {
+			msgFinished << ", predicted: " << formatNumber(predicted, 3) << "s";
+		}
+		logger::INFO(msgFinished.str());
 
 		activeThreads--;
 	});
 
+	const auto addChunk = [&pool, &schedule, bpp = attributes.bytes](shared_ptr<Chunk> chunk) {
+		const double cost = estimateIndexingCost(chunk->size() / bpp, NodeKey::fromString(chunk->id).level());
+
+		schedule.add(cost);
+		pool.addTask(make_shared<Task>(chunk, cost), cost);
+	};
+
+	const double tStartChunks = now();
+
+	// all chunks are known up front, unless they come from the chunker
 	for (auto chunk : chunks->list) {
-		auto task = make_shared<Task>(chunk);
-		pool.addTask(task);
+		addChunk(chunk);
+	}
+
+	if (sealedChunks != nullptr) {
+		SealedChunk sealed;
+
+		while (sealedChunks->pop(sealed)) {
+			auto chunk = make_shared<Chunk>();
+			chunk->id = sealed.id;
+			chunk->file = sealed.file;
+			chunk->extents = sealed.extents;
+			chunk->buckets = std::move(sealed.buckets);
+			chunk->bucketsSize = sealed.size;
+
+			BoundingBox box = boundingBoxOfChunk(chunk->id, chunks->min, chunks->max);
+			chunk->min = box.min;
+			chunk->max = box.max;
+
+			chunks->list.push_back(chunk);
+			addChunk(chunk);
+		}
+
+		// the chunker is done, the indexer takes over the progress
+		lock_guard<mutex> lock(mtx_nodes);
+
+		// without the duplicates that the chunker removed
+		totalPoints = state.pointsTotal;
+
+		state.setName("INDEXING");
+		state.currentPass = 3;
+		state.pointsProcessed = pointsProcessed;
+		state.bytesProcessed = 0;
+		state.duration = now() - tStart;
+		reportProgress = true;
 	}
 
 	pool.waitTillEmpty();
 	pool.close();
 
+	{ // predicted and actual duration of the chunk phase
+		const double duration = now() - tStartChunks;
+		const double meanError = schedule.numPredicted > 0 ? schedule.sumRelativeError / double(schedule.numPredicted) : 0.0;
+
+		state.setValue("duration(indexing-chunks)", formatNumber(duration, 3));
+		state.setValue("indexing critical path(s)", formatNumber(schedule.criticalPath(), 3));
+		state.setValue("slowest chunk(s)", formatNumber(schedule.maxSeconds, 3));
+		state.setValue("chunk duration prediction error", formatNumber(100.0 * meanError, 1) + "%");
+	}
+
+	if (sealedChunks != nullptr) {
+		// statistics of all points are only known once the chunker is done
+		attributes = sealedChunks->attributes;
+		chunks->attributes = attributes;
+		indexer.attributes = attributes;
+	}
+
 	indexer.fChunkRoots.close();
 
 	{ // process chunk roots in batches
@@ -1688,7 +1989,7 @@ void doIndexing(string targetDir, State& state, Options& options, Sampler& sampl
 
 			sampler.sample(task.node, attributes, indexer.spacing, onNodeCompleted, onNodeDiscarded);
 
-			task.node->children.clear();
+			task.node->children.fill(nullptr);
 		}
 	}
 
@@ -1736,6 +2037,7 @@ void doIndexing(string targetDir, State& state, Options& options, Sampler& sampl
 			string chunksMetadataPath = targetDir + "/chunks/metadata.json";
 
 			fs::remove(chunksMetadataPath);
+			fs::remove(targetDir + "/chunks/" + arenaFilename);
 			fs::remove(targetDir + "/chunks");
 		}
 
@@ -1745,7 +2047,7 @@ void doIndexing(string targetDir, State& state, Options& options, Sampler& sampl
 	}
 
 	const double duration = now() - tStart;
-	state.values["duration(indexing)"] = formatNumber(duration, 3);
+	state.setValue("duration(indexing)", formatNumber(duration, 3));
 
 
 }
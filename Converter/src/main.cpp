@@ -7,10 +7,12 @@
 #include "sampler_poisson.h"
 #include "sampler_poisson_average.h"
 #include "sampler_random.h"
+#include "sampler_voxel.h"
 #include "Attributes.h"
 #include "PotreeConverter.h"
 #include "logger.h"
 #include "Monitor.h"
+#include "SourceCatalog.h"
 
 #include "arguments/Arguments.hpp"
 
@@ -23,15 +25,23 @@ Options parseArguments(int argc, char** argv) {
 	args.addArgument("help,h", "Display help information");
 	args.addArgument("outdir,o", "Output directory");
 	args.addArgument("encoding", "Encoding type \"BROTLI\", \"UNCOMPRESSED\" (default)");
-	args.addArgument("method,m", "Point sampling method \"poisson\", \"poisson_average\", \"random\"");
+	args.addArgument("method,m", "Point sampling method \"poisson\", \"poisson_average\", \"random\", \"voxel\"");
 	args.addArgument("chunkMethod", "Chunking method");
 	args.addArgument("keep-chunks", "Skip deleting temporary chunks during conversion");
 	args.addArgument("no-chunking", "Disable chunking phase");
 	args.addArgument("no-indexing", "Disable indexing phase");
+	args.addArgument("no-overlap", "Start indexing only after all chunks were created");
 	args.addArgument("attributes", "Attributes in output file");
 	args.addArgument("projection", "Add the projection of the pointcloud to the metadata");
 	args.addArgument("generate-page,p", "Generate a ready to use web page with the given name");
 	args.addArgument("title", "Page title used when generating a web page");
+	args.addArgument("source-cache", "Path of the cached source catalog. Defaults to <outdir>/.sourceCatalog.json");
+	args.addArgument("count-sample", "Fraction of points used to plan the chunks, e.g. 0.05. Defaults to 1, all points");
+	args.addArgument("io-backend", "Backend for writing chunks and octree.bin: \"auto\" (default), \"uring\", \"threads\"");
+	args.addArgument("io-queue-depth", "Maximum number of writes in flight. Defaults to 64");
+	args.addArgument("memory-budget", "Keep the chunks in memory instead of writing them to disk if they fit into this many MB. Defaults to a quarter of the available memory, 0 disables it");
+	args.addArgument("dedup", "Remove duplicate points while creating chunks: \"exact\" for identical positions, or a cell size, e.g. 0.001, to snap positions to a grid of that spacing and keep one point per cell. Off by default");
+	args.addArgument("decode-once", "Decode compressed sources only once and keep the points for the second chunking pass: \"auto\" (default), \"memory\", \"disk\", \"off\"");
 
 	if (args.has("help")) {
 		cout << "PotreeConverter <source> -o <outdir>" << endl;
@@ -110,6 +120,14 @@ Options parseArguments(int argc, char** argv) {
 	const bool keepChunks = args.has("keep-chunks");
 	const bool noChunking = args.has("no-chunking");
 	const bool noIndexing = args.has("no-indexing");
+	const bool noOverlap = args.has("no-overlap");
+	const string sourceCache = args.get("source-cache").as<string>(outdir + "/.sourceCatalog.json");
+	const string decodeOnce = args.get("decode-once").as<string>("auto");
+	const double countSample = args.get("count-sample").as<double>(1.0);
+	const string ioBackend = args.get("io-backend").as<string>("auto");
+	const int64_t ioQueueDepth = std::max(args.get("io-queue-depth").as<int>(64), 1);
+	const int64_t memoryBudget = int64_t(args.get("memory-budget").as<double>(-1.0));
+	const string dedup = args.has("dedup") ? args.get("dedup").as<string>("exact") : "off";
 
 	Options options;
 	options.source = source;
@@ -125,7 +143,15 @@ Options parseArguments(int argc, char** argv) {
 
 	options.keepChunks = keepChunks;
 	options.noChunking = noChunking;
+	options.noOverlap = noOverlap;
 	options.noIndexing = noIndexing;
+	options.sourceCache = sourceCache;
+	options.decodeOnce = decodeOnce;
+	options.countSample = countSample;
+	options.ioBackend = ioBackend;
+	options.ioQueueDepth = ioQueueDepth;
+	options.memoryBudget = memoryBudget;
+	options.dedup = dedup;
 
 	return options;
 }
@@ -134,7 +160,7 @@ struct Curated{
 	string name;
 	vector<Source> files;
 };
-Curated curateSources(const vector<string> &paths) {
+Curated curateSources(const vector<string> &paths, const string &sourceCache) {
 
 	Curated curated;
 
@@ -161,25 +187,10 @@ Curated curateSources(const vector<string> &paths) {
 
 	cout << "#paths: " << expanded.size() << endl;
 
-	auto &sources = curated.files;
-	sources.reserve(expanded.size());
+	SourceCatalog catalog(sourceCache);
+	curated.files = catalog.load(expanded);
 
-	mutex mtx;
-	constexpr auto parallel = std::execution::par;
-	for_each(parallel, expanded.begin(), expanded.end(), [&mtx, &sources](string path) {
-
-		const auto header = loadLasHeader(path);
-
-		Source source;
-		source.path = path;
-		source.min = { header.min.x, header.min.y, header.min.z };
-		source.max = { header.max.x, header.max.y, header.max.z };
-		source.numPoints = header.numPoints;
-		source.filesize = fs::file_size(path);
-
-		lock_guard<mutex> lock(mtx);
-		sources.push_back(source);
-	});
+	cout << "#headers loaded: " << catalog.numLoaded << ", #headers cached: " << catalog.numCached << endl;
 
 	return curated;
 }
@@ -252,7 +263,7 @@ Stats computeStats(const vector<Source> &sources){
 	return stats;
 }
 
-void chunking(const Options& options, const vector<Source>& sources, const string &targetDir, const Stats& stats, State& state, Attributes &outputAttributes) {
+void chunking(const Options& options, const vector<Source>& sources, const string &targetDir, const Stats& stats, State& state, Attributes &outputAttributes, shared_ptr<SealedChunks> sealedChunks = nullptr) {
 
 	if (options.noChunking) {
 		return;
@@ -260,7 +271,7 @@ void chunking(const Options& options, const vector<Source>& sources, const strin
 
 	if (options.chunkMethod == "LASZIP") {
 
-		chunker_countsort_laszip::doChunking(sources, targetDir, stats.min, stats.max, state, outputAttributes);
+		chunker_countsort_laszip::doChunking(options, sources, targetDir, stats.min, stats.max, state, outputAttributes, sealedChunks);
 
 	} else if (options.chunkMethod == "LAS_CUSTOM") {
 	} else if (options.chunkMethod == "SKIP") {
@@ -275,7 +286,7 @@ void chunking(const Options& options, const vector<Source>& sources, const strin
 	}
 }
 
-void indexing(Options& options, string targetDir, State& state) {
+void indexing(Options& options, string targetDir, State& state, shared_ptr<SealedChunks> sealedChunks = nullptr) {
 
 	if (options.noIndexing) {
 		return;
@@ -284,17 +295,22 @@ void indexing(Options& options, string targetDir, State& state) {
 	if (options.method == "random") {
 
 		SamplerRandom sampler;
-		indexer::doIndexing(targetDir, state, options, sampler);
+		indexer::doIndexing(targetDir, state, options, sampler, sealedChunks);
 
 	} else if (options.method == "poisson") {
 
 		SamplerPoisson sampler;
-		indexer::doIndexing(targetDir, state, options, sampler);
+		indexer::doIndexing(targetDir, state, options, sampler, sealedChunks);
 
 	} else if (options.method == "poisson_average") {
 
 		SamplerPoissonAverage sampler;
-		indexer::doIndexing(targetDir, state, options, sampler);
+		indexer::doIndexing(targetDir, state, options, sampler, sealedChunks);
+
+	} else if (options.method == "voxel") {
+
+		SamplerVoxel sampler;
+		indexer::doIndexing(targetDir, state, options, sampler, sealedChunks);
 
 	}
 }
@@ -432,7 +448,7 @@ int main(int argc, char** argv) {
 
 	auto options = parseArguments(argc, argv);
 
-	auto [name, sources] = curateSources(options.source);
+	auto [name, sources] = curateSources(options.source, options.sourceCache);
 	if (options.name.empty()) {
 		options.name = name;
 	}
@@ -462,9 +478,24 @@ int main(int argc, char** argv) {
 
 	{ //	this is the real important stuff
 
-		chunking(options, sources, targetDir, stats, state, outputAttributes);
+		// chunks are indexed while the chunker is still creating the others
+		const bool overlap = !options.noOverlap && !options.noChunking && !options.noIndexing && options.chunkMethod == "LASZIP";
 
-		indexing(options, targetDir, state);
+		if (overlap) {
+			auto sealedChunks = make_shared<SealedChunks>();
+
+			thread indexingThread([&options, &targetDir, &state, sealedChunks]() {
+				indexing(options, targetDir, state, sealedChunks);
+			});
+
+			chunking(options, sources, targetDir, stats, state, outputAttributes, sealedChunks);
+
+			indexingThread.join();
+		} else {
+			chunking(options, sources, targetDir, stats, state, outputAttributes);
+
+			indexing(options, targetDir, state);
+		}
 
 	}
 
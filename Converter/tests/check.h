@@ -0,0 +1,20 @@
+#pragma once
+
+#include <iostream>
+
+// Checks for the unit tests in this directory. Unlike assert, they also run in release builds,
+// and a failed check doesn't stop the test, so that one run reports all failures.
+inline int numFailedChecks = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " << #condition << std::endl; \
+			numFailedChecks++; \
+		} \
+	} while (false)
+
+// exit code of the test
+inline int testResult() {
+	return numFailedChecks == 0 ? 0 : 1;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "converter_utils.h"
+#include "structures.h"
+#include "Attributes.h"
+
+using std::array;
+using std::shared_ptr;
+using std::vector;
+
+// Small octrees for the sampler tests. Points only have a position, stored as integer coordinates
+// with scale 1 and offset 0, so that coordinates and positions are the same.
+
+struct Position {
+	int32_t x = 0;
+	int32_t y = 0;
+	int32_t z = 0;
+
+	bool operator==(const Position& other) const {
+		return x == other.x && y == other.y && z == other.z;
+	}
+};
+
+inline Attributes positionAttributes() {
+	Attributes attributes({ Attribute("position", 12, 3, 4, AttributeType::INT32) });
+	attributes.posScale = { 1.0, 1.0, 1.0 };
+	attributes.posOffset = { 0.0, 0.0, 0.0 };
+
+	return attributes;
+}
+
+inline shared_ptr<Buffer> toBuffer(const vector<Position>& positions) {
+	auto buffer = make_shared<Buffer>(positions.size() * sizeof(Position));
+
+	if (!positions.empty()) {
+		memcpy(buffer->data, positions.data(), buffer->size);
+	}
+
+	return buffer;
+}
+
+inline vector<Position> positionsOf(const Node* node) {
+	vector<Position> positions(node->numPoints);
+
+	if (node->numPoints > 0) {
+		memcpy(positions.data(), node->points->data, node->numPoints * sizeof(Position));
+	}
+
+	return positions;
+}
+
+// A root node of the cube [0, size]^3, with one leaf per octant that holds <pointsPerChild>.
+// Octants without points don't get a child.
+inline shared_ptr<Node> createOctree(double size, const array<vector<Position>, 8>& pointsPerChild) {
+	auto root = makeNode(NodeKey::root(), Vector3{ 0.0, 0.0, 0.0 }, Vector3{ size, size, size });
+
+	for (int childIndex = 0; childIndex < 8; childIndex++) {
+		const auto& positions = pointsPerChild[childIndex];
+
+		if (positions.empty()) {
+			continue;
+		}
+
+		const auto box = childBoundingBoxOf(root->min, root->max, childIndex);
+
+		auto child = makeNode(root->key.child(childIndex), box.min, box.max);
+		child->points = toBuffer(positions);
+		child->numPoints = positions.size();
+
+		root->children[childIndex] = child;
+	}
+
+	return root;
+}
@@ -0,0 +1,57 @@
+#include <string>
+#include <vector>
+
+#include "NodeKey.h"
+#include "check.h"
+
+using std::string;
+using std::vector;
+
+void testRoundTrip() {
+	const vector<string> names = { "r", "r0", "r7", "r01234567", "r7777777", "r000000000000000000001" };
+
+	for (const string& name : names) {
+		const NodeKey key = NodeKey::fromString(name);
+
+		CHECK(key.toString() == name);
+		CHECK(key.level() == int64_t(name.size()) - 1);
+	}
+
+	CHECK(NodeKey::fromString("r") == NodeKey::root());
+	CHECK(NodeKey::fromString("r5").value == 0b1'101);
+
+	// the deepest level that fits into 64 bits
+	const string deepest = "r" + string(NodeKey::maxLevel, '7');
+	CHECK(NodeKey::fromString(deepest).toString() == deepest);
+	CHECK(NodeKey::fromString(deepest).level() == NodeKey::maxLevel);
+}
+
+void testNavigation() {
+	const NodeKey key = NodeKey::fromString("r3061");
+
+	CHECK(key.ancestor(0) == NodeKey::root());
+	CHECK(key.ancestor(2).toString() == "r30");
+	CHECK(key.ancestor(4) == key);
+	CHECK(key.parent().toString() == "r306");
+	CHECK(key.parent().child(1) == key);
+	CHECK(key.childIndex() == 1);
+	CHECK(key.childIndexAt(1) == 3);
+	CHECK(key.childIndexAt(2) == 0);
+	CHECK(key.childIndexAt(3) == 6);
+}
+
+// keys of a lower level are smaller, keys of the same level are ordered like their names
+void testOrder() {
+	CHECK(NodeKey::fromString("r7") < NodeKey::fromString("r00"));
+	CHECK(NodeKey::fromString("r06") < NodeKey::fromString("r10"));
+	CHECK(NodeKey::fromString("r123") < NodeKey::fromString("r124"));
+}
+
+int main() {
+
+	testRoundTrip();
+	testNavigation();
+	testOrder();
+
+	return testResult();
+}
@@ -0,0 +1,114 @@
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "NodePool.h"
+#include "check.h"
+
+using std::thread;
+using std::vector;
+
+using Pool = BlockPool<64>;
+
+int64_t numSlabs() {
+	lock_guard<mutex> lock(Pool::shared().mtx);
+
+	return Pool::shared().numSlabs;
+}
+
+// blocks allocated on one thread and freed on another go back to the slabs once both threads exit
+void testCrossThreadFree() {
+	constexpr int64_t numBlocks = 10 * Pool::blocksPerSlab;
+
+	vector<void*> blocks;
+
+	thread producer([&blocks]() {
+		for (int64_t i = 0; i < numBlocks; i++) {
+			void* block = Pool::allocate();
+			memset(block, int(i & 0xff), 64);
+
+			blocks.push_back(block);
+		}
+	});
+	producer.join();
+
+	CHECK(numSlabs() >= 10);
+
+	bool intact = true;
+	for (int64_t i = 0; i < numBlocks; i++) {
+		intact = intact && reinterpret_cast<uint8_t*>(blocks[i])[63] == uint8_t(i & 0xff);
+	}
+	CHECK(intact);
+
+	thread consumer([&blocks]() {
+		for (void* block : blocks) {
+			Pool::deallocate(block);
+		}
+	});
+	consumer.join();
+
+	CHECK(numSlabs() == 0);
+}
+
+// blocks freed by one thread are reused by another, instead of new slabs
+void testReuse() {
+	constexpr int64_t numBlocks = 4 * Pool::blocksPerSlab;
+
+	vector<void*> blocks;
+
+	thread([&blocks]() {
+		for (int64_t i = 0; i < numBlocks; i++) {
+			blocks.push_back(Pool::allocate());
+		}
+	}).join();
+
+	const int64_t slabsUsed = numSlabs();
+
+	thread([&blocks]() {
+		for (int64_t i = 0; i < numBlocks / 2; i++) {
+			Pool::deallocate(blocks[i]);
+		}
+	}).join();
+
+	thread([&blocks]() {
+		for (int64_t i = 0; i < numBlocks / 2; i++) {
+			blocks[i] = Pool::allocate();
+		}
+	}).join();
+
+	CHECK(numSlabs() <= slabsUsed);
+
+	thread([&blocks]() {
+		for (void* block : blocks) {
+			Pool::deallocate(block);
+		}
+	}).join();
+
+	CHECK(numSlabs() == 0);
+}
+
+void testPoolAllocator() {
+	struct Item {
+		int64_t values[5];
+	};
+
+	PoolAllocator<Item> allocator;
+
+	Item* item = allocator.allocate(1);
+	CHECK(reinterpret_cast<uintptr_t>(item) % alignof(std::max_align_t) == 0);
+	allocator.deallocate(item, 1);
+
+	// arrays don't come from the pool
+	Item* items = allocator.allocate(3);
+	allocator.deallocate(items, 3);
+}
+
+int main() {
+
+	testCrossThreadFree();
+	testReuse();
+	testPoolAllocator();
+
+	return testResult();
+}
@@ -0,0 +1,78 @@
+#include <cstdint>
+#include <limits>
+
+#include "XYZHashSet.h"
+#include "check.h"
+
+constexpr int32_t MIN = std::numeric_limits<int32_t>::min();
+
+void testInsert() {
+	XYZHashSet set;
+
+	CHECK(set.insert(1, 2, 3));
+	CHECK(!set.insert(1, 2, 3));
+	CHECK(set.insert(3, 2, 1));
+	CHECK(set.insert(-1, -2, -3));
+	CHECK(set.size() == 3);
+}
+
+// (MIN, MIN, MIN) marks free slots, so it's tracked apart from the table
+void testEmptyKey() {
+	XYZHashSet set(8);
+	const int64_t memory = set.memory();
+
+	CHECK(set.insert(MIN, MIN, MIN));
+	CHECK(!set.insert(MIN, MIN, MIN));
+	CHECK(set.containsEmptyKey);
+	CHECK(set.size() == 1);
+
+	// keys that share some of the components with the marker are regular keys
+	CHECK(set.insert(MIN, 0, 0));
+	CHECK(set.insert(MIN, MIN, 0));
+	CHECK(set.insert(0, MIN, MIN));
+	CHECK(!set.insert(MIN, MIN, 0));
+	CHECK(set.size() == 4);
+	CHECK(set.memory() == memory);
+
+	set.clear();
+
+	CHECK(set.size() == 0);
+	CHECK(!set.containsEmptyKey);
+	CHECK(set.insert(MIN, MIN, MIN));
+	CHECK(set.insert(MIN, 0, 0));
+	CHECK(set.memory() == memory);
+}
+
+// keys must survive the rehash when the table grows beyond what was reserved
+void testGrowth() {
+	XYZHashSet set;
+
+	constexpr int32_t n = 40;
+	for (int32_t x = 0; x < n; x++) {
+		for (int32_t y = 0; y < n; y++) {
+			CHECK(set.insert(x, y, x - y));
+		}
+	}
+
+	CHECK(set.size() == n * n);
+	CHECK(set.memory() >= int64_t(2 * n * n * sizeof(XYZHashSet::Key)));
+
+	int64_t numDuplicates = 0;
+	for (int32_t x = 0; x < n; x++) {
+		for (int32_t y = 0; y < n; y++) {
+			numDuplicates += set.insert(x, y, x - y) ? 0 : 1;
+		}
+	}
+
+	CHECK(numDuplicates == n * n);
+	CHECK(set.size() == n * n);
+}
+
+int main() {
+
+	testInsert();
+	testEmptyKey();
+	testGrowth();
+
+	return testResult();
+}
@@ -0,0 +1,97 @@
+#include <cstdint>
+#include <vector>
+
+#include "octree_fixtures.h"
+#include "check.h"
+
+using std::vector;
+
+vector<Position> positionsFrom(int32_t first, int32_t count) {
+	vector<Position> positions;
+
+	for (int32_t i = first; i < first + count; i++) {
+		positions.push_back({ i, i, i });
+	}
+
+	return positions;
+}
+
+void testCompaction() {
+	array<vector<Position>, 8> points;
+	points[0] = positionsFrom(0, 10);
+	points[2] = positionsFrom(100, 4);
+	points[5] = positionsFrom(200, 3);
+
+	auto root = createOctree(128.0, points);
+
+	// child 2 is an inner node
+	auto child2 = root->children[2];
+	child2->children[0] = makeNode(child2->key.child(0), child2->min, child2->max);
+
+	// points are numbered in the order of the children: 0-9 in child 0, 10-13 in child 2, 14-16 in child 5
+	const vector<int64_t> acceptedIndices = { 1, 4, 5, 9, 10, 11, 12, 13, 14, 15, 16 };
+
+	PointFlags flags;
+	flags.reset(17);
+	for (int64_t index : acceptedIndices) {
+		flags.set(index);
+	}
+
+	vector<Node*> completed;
+	vector<Node*> discarded;
+
+	Sampler::acceptIntoParent(root.get(), flags, acceptedIndices.size(), sizeof(Position),
+		[&completed](Node* node) { completed.push_back(node); },
+		[&discarded](Node* node) { discarded.push_back(node); });
+
+	// accepted points are gathered in order
+	const vector<Position> expectedAccepted = {
+		{ 1, 1, 1 }, { 4, 4, 4 }, { 5, 5, 5 }, { 9, 9, 9 },
+		{ 100, 100, 100 }, { 101, 101, 101 }, { 102, 102, 102 }, { 103, 103, 103 },
+		{ 200, 200, 200 }, { 201, 201, 201 }, { 202, 202, 202 },
+	};
+	CHECK(root->numPoints == 11);
+	CHECK(positionsOf(root.get()) == expectedAccepted);
+
+	// rejected points are compacted in place, in their original order
+	const vector<Position> expectedRejected = {
+		{ 0, 0, 0 }, { 2, 2, 2 }, { 3, 3, 3 }, { 6, 6, 6 }, { 7, 7, 7 }, { 8, 8, 8 },
+	};
+	CHECK(root->children[0]->numPoints == 6);
+	CHECK(root->children[0]->points->size == 6 * int64_t(sizeof(Position)));
+	CHECK(positionsOf(root->children[0].get()) == expectedRejected);
+
+	// an inner node without points is kept empty, a leaf without points is discarded
+	CHECK(root->children[2] == child2);
+	CHECK(child2->numPoints == 0);
+	CHECK(child2->points == nullptr);
+	CHECK(root->children[5] == nullptr);
+
+	CHECK(completed.size() == 2);
+	CHECK(discarded.size() == 1);
+}
+
+void testNothingAccepted() {
+	array<vector<Position>, 8> points;
+	points[3] = positionsFrom(0, 70);
+	points[4] = positionsFrom(70, 70);
+
+	auto root = createOctree(128.0, points);
+
+	PointFlags flags;
+	flags.reset(140);
+
+	Sampler::acceptIntoParent(root.get(), flags, 0, sizeof(Position), [](Node*) {}, [](Node*) {});
+
+	CHECK(root->numPoints == 0);
+	CHECK(positionsOf(root->children[3].get()) == positionsFrom(0, 70));
+	CHECK(positionsOf(root->children[4].get()) == positionsFrom(70, 70));
+}
+
+int main() {
+
+	testCompaction();
+	testNothingAccepted();
+
+	return testResult();
+}
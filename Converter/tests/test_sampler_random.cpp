@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "octree_fixtures.h"
+#include "sampler_random.h"
+#include "check.h"
+
+using std::vector;
+
+// The root spans [0, 256]^3, so each cell of the sampler's 128^3 grid is 2 units wide.
+// Odd coordinates are at the center of a cell, even coordinates at its corner.
+constexpr double size = 256.0;
+
+Position cellCenter(int32_t cx, int32_t cy, int32_t cz) {
+	return { 2 * cx + 1, 2 * cy + 1, 2 * cz + 1 };
+}
+
+Position cellCorner(int32_t cx, int32_t cy, int32_t cz) {
+	return { 2 * cx, 2 * cy, 2 * cz };
+}
+
+void sample(Node* root) {
+	SamplerRandom sampler;
+	sampler.sample(root, positionAttributes(), 1.0, [](Node*) {}, [](Node*) {});
+}
+
+// accepts the first point near the center of each cell that isn't occupied yet
+void testOnePointPerCell() {
+	array<vector<Position>, 8> points;
+
+	for (int32_t cx = 0; cx < 10; cx++) {
+		for (int32_t cy = 0; cy < 10; cy++) {
+			for (int32_t cz = 0; cz < 2; cz++) {
+				points[0].push_back(cellCenter(cx, cy, cz));
+			}
+		}
+	}
+
+	// cells that are already occupied
+	for (int32_t cx = 0; cx < 10; cx++) {
+		for (int32_t cy = 0; cy < 10; cy++) {
+			points[0].push_back(cellCenter(cx, cy, 0));
+		}
+	}
+
+	// too far from the centers of free cells
+	for (int32_t cx = 20; cx < 25; cx++) {
+		for (int32_t cy = 20; cy < 30; cy++) {
+			points[0].push_back(cellCorner(cx, cy, 10));
+		}
+	}
+
+	auto root = createOctree(size, points);
+
+	sample(root.get());
+
+	CHECK(points[0].size() == 350);
+	CHECK(root->numPoints == 200);
+	CHECK(root->children[0]->numPoints == 150);
+}
+
+// children with fewer than 100 points are taken as a whole
+void testSmallChildren() {
+	array<vector<Position>, 8> points;
+
+	for (int i = 0; i < 50; i++) {
+		points[1].push_back(cellCorner(0, 0, 70));
+		points[6].push_back(cellCenter(70, 70, 0));
+	}
+
+	auto root = createOctree(size, points);
+
+	sample(root.get());
+
+	CHECK(root->numPoints == 100);
+	CHECK(root->isLeaf());
+}
+
+// leaves are shuffled in place
+void testShuffleLeaf() {
+	vector<Position> positions;
+	for (int32_t i = 0; i < 1000; i++) {
+		positions.push_back({ i, 2 * i, 3 * i });
+	}
+
+	auto leaf = createOctree(size, {});
+	leaf->points = toBuffer(positions);
+	leaf->numPoints = positions.size();
+
+	sample(leaf.get());
+
+	auto shuffled = positionsOf(leaf.get());
+
+	CHECK(leaf->numPoints == 1000);
+	CHECK(shuffled != positions);
+
+	std::sort(shuffled.begin(), shuffled.end(), [](const Position& a, const Position& b) { return a.x < b.x; });
+	CHECK(shuffled == positions);
+}
+
+int main() {
+
+	testOnePointPerCell();
+	testSmallChildren();
+	testShuffleLeaf();
+
+	return testResult();
+}
@@ -0,0 +1,95 @@
+#include <cstdint>
+#include <vector>
+
+#include "octree_fixtures.h"
+#include "sampler_voxel.h"
+#include "check.h"
+
+using std::vector;
+
+// The root spans [0, 128]^3 and has a spacing of 8, so its voxels are 8 units wide.
+constexpr double size = 128.0;
+constexpr double baseSpacing = 8.0;
+
+// a point at the center of voxel <v> of each axis, shifted by <delta>
+Position inVoxel(int32_t vx, int32_t vy, int32_t vz, int32_t delta) {
+	return { 8 * vx + 4 + delta, 8 * vy + 4 + delta, 8 * vz + 4 + delta };
+}
+
+// one point per voxel is kept, the one closest to the voxel's center
+void testOnePointPerVoxel() {
+	array<vector<Position>, 8> points;
+
+	// 4x4x4 voxels with three points each in the first octant
+	for (int32_t vx = 0; vx < 4; vx++) {
+		for (int32_t vy = 0; vy < 4; vy++) {
+			for (int32_t vz = 0; vz < 4; vz++) {
+				points[0].push_back(inVoxel(vx, vy, vz, -3));
+				points[0].push_back(inVoxel(vx, vy, vz, 0));
+				points[0].push_back(inVoxel(vx, vy, vz, 2));
+			}
+		}
+	}
+
+	// 2x2x2 voxels with two points each in the last octant
+	for (int32_t vx = 8; vx < 10; vx++) {
+		for (int32_t vy = 8; vy < 10; vy++) {
+			for (int32_t vz = 8; vz < 10; vz++) {
+				points[7].push_back(inVoxel(vx, vy, vz, 3));
+				points[7].push_back(inVoxel(vx, vy, vz, 0));
+			}
+		}
+	}
+
+	auto root = createOctree(size, points);
+
+	int64_t numCompleted = 0;
+	int64_t numDiscarded = 0;
+
+	SamplerVoxel sampler;
+	sampler.sample(root.get(), positionAttributes(), baseSpacing,
+		[&numCompleted](Node*) { numCompleted++; },
+		[&numDiscarded](Node*) { numDiscarded++; });
+
+	CHECK(root->sampled);
+	CHECK(root->numPoints == 64 + 8);
+	CHECK(numCompleted == 2);
+	CHECK(numDiscarded == 0);
+
+	bool allCentered = true;
+	for (const auto& position : positionsOf(root.get())) {
+		allCentered = allCentered && position.x % 8 == 4 && position.y % 8 == 4 && position.z % 8 == 4;
+	}
+	CHECK(allCentered);
+
+	CHECK(root->children[0]->numPoints == 2 * 64);
+	CHECK(root->children[7]->numPoints == 8);
+}
+
+// leaves whose points are all accepted are discarded
+void testSparsePoints() {
+	array<vector<Position>, 8> points;
+	points[0] = { inVoxel(0, 0, 0, 1), inVoxel(1, 0, 0, 1), inVoxel(0, 5, 0, -1) };
+	points[3] = { inVoxel(0, 9, 9, 0) };
+
+	auto root = createOctree(size, points);
+
+	vector<Node*> discarded;
+
+	SamplerVoxel sampler;
+	sampler.sample(root.get(), positionAttributes(), baseSpacing,
+		[](Node*) {},
+		[&discarded](Node* node) { discarded.push_back(node); });
+
+	CHECK(root->numPoints == 4);
+	CHECK(discarded.size() == 2);
+	CHECK(root->isLeaf());
+}
+
+int main() {
+
+	testOnePointPerVoxel();
+	testSparsePoints();
+
+	return testResult();
+}